@@ -578,6 +578,9 @@ static const char vValues[] ALIGN1 =
 	"\034\0"    "\0"        "\377";
 #define str_percent_dot_6g vValues
 
+/* number of compiled dynamic regexes to keep */
+#define REGEX_CACHE_SIZE 8
+
 /* hash size may grow to these values */
 #define FIRST_PRIME 61
 static const uint16_t PRIMES[] ALIGN2 = { 251, 1021, 4093, 16381, 65521 };
@@ -626,6 +629,9 @@ struct globals {
 
 	/* former statics from various functions */
 	char *split_f0__fstrings;
+	char *split_f0__rest;       /* unsplit part of $0, NULL: no more fields */
+	char split_f0__delim[4];    /* single-char FS, or " " for space split */
+	smallint split_f0__lazy;    /* $0 is being split on demand */
 
 	unsigned next_input_file__argind;
 	smallint next_input_file__input_file_seen;
@@ -634,7 +640,6 @@ struct globals {
 
 	unsigned evaluate__seed;
 	var *evaluate__fnargs;
-	regex_t evaluate__sreg;
 
 	var ptest__tmpvar;
 	var awk_printf__tmpvar;
@@ -643,6 +648,15 @@ struct globals {
 	var main__tmpvar;
 
 	tsplitter exec_builtin__tspl;
+	char *exec_builtin__tspl_str;
+
+	unsigned as_regex__clock;
+	struct regex_cache {
+		char *str;      /* NULL: unused slot */
+		int cflags;
+		unsigned last_used;
+		regex_t re;
+	} as_regex__cache[REGEX_CACHE_SIZE];
 
 	/* biggest and least used members go last */
 	tsplitter fsplitter, rsplitter;
@@ -1007,15 +1021,15 @@ static var *clrvar(var *v)
 	return v;
 }
 
-static void handle_special(var *);
+static var *handle_special(var *);
 
-/* assign string value to variable */
+/* assign string value to variable.
+ * Assigning $N can move Fields[]: use the returned pointer, not v */
 static var *setvar_p(var *v, char *value)
 {
 	clrvar(v);
 	v->string = value;
-	handle_special(v);
-	return v;
+	return handle_special(v);
 }
 
 /* same as setvar_p but make a copy of string */
@@ -1052,8 +1066,7 @@ static var *setvar_i(var *v, double value)
 	clrvar(v);
 	v->type |= VF_NUMBER;
 	v->number = value;
-	handle_special(v);
-	return v;
+	return handle_special(v);
 }
 
 static void setvar_ERRNO(void)
@@ -1130,8 +1143,7 @@ static var *copyvar(var *dest, const var *src)
 		if (src->string)
 			dest->string = xstrdup(src->string);
 	}
-	handle_special(dest);
-	return dest;
+	return handle_special(dest);
 }
 
 static var *incvar(var *v)
@@ -1966,12 +1978,15 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 
 static var *evaluate(node *, var *);
 
-/* Use node as a regular expression. Supplied with node ptr and regex_t
- * storage space. Return ptr to regex (if result points to preg, it should
- * be later regfree'd manually).
+/* Use node as a regular expression. Return ptr to regex.
+ * Dynamic regexes ("$0 ~ var", split(s, a, var), gsub(var, ...)) are
+ * usually the same for every record: keep the last few compiled ones.
+ * Returned regex stays valid until REGEX_CACHE_SIZE other dynamic
+ * regexes are used.
  */
-static regex_t *as_regex(node *op, regex_t *preg)
+static regex_t *as_regex(node *op)
 {
+	struct regex_cache *rc, *lru;
 	int cflags;
 	const char *s;
 
@@ -1988,18 +2003,38 @@ static regex_t *as_regex(node *op, regex_t *preg)
 	s = getvar_s(evaluate(op, TMPVAR));
 
 	cflags = icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED;
+
+	lru = rc = G.as_regex__cache;
+	for (; rc < &G.as_regex__cache[REGEX_CACHE_SIZE]; rc++) {
+		if (!rc->str) {
+			lru = rc;
+			break;
+		}
+		if (rc->cflags == cflags && strcmp(rc->str, s) == 0)
+			goto found;
+		if (rc->last_used < lru->last_used)
+			lru = rc;
+	}
+	rc = lru;
+	if (rc->str) {
+		regfree(&rc->re);
+		free(rc->str);
+	}
 	/* Testcase where REG_EXTENDED fails (unpaired '{'):
 	 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
 	 * gawk 3.1.5 eats this. We revert to ~REG_EXTENDED
 	 * (maybe gsub is not supposed to use REG_EXTENDED?).
 	 */
-	if (regcomp(preg, s, cflags)) {
-		cflags &= ~REG_EXTENDED;
-		xregcomp(preg, s, cflags);
+	if (regcomp(&rc->re, s, cflags)) {
+		xregcomp(&rc->re, s, cflags & ~REG_EXTENDED);
 	}
+	rc->str = xstrdup(s);
+	rc->cflags = cflags;
+ found:
+	rc->last_used = ++G.as_regex__clock;
 	//nvfree(tmpvar, 1);
 #undef TMPVAR
-	return preg;
+	return &rc->re;
 }
 
 /* gradually increasing buffer.
@@ -2155,10 +2190,18 @@ static int awk_split(const char *s, node *spl, char **slist)
 	return n;
 }
 
-static void split_f0(void)
+/* Split $0 up to field UPTO (0: all fields).
+ * With single-char or default FS, fields are split on demand:
+ * "print $1" on a wide record does not need to look at the rest of it.
+ * Other separators split the whole record at once.
+ */
+static void split_f0_upto(int upto)
 {
 /* static char *fstrings; */
 #define fstrings (G.split_f0__fstrings)
+#define rest     (G.split_f0__rest)
+#define delim    (G.split_f0__delim)
+#define lazy     (G.split_f0__lazy)
 
 	int i, n;
 	char *s;
@@ -2166,26 +2209,82 @@ static void split_f0(void)
 	if (is_f0_split)
 		return;
 
-	is_f0_split = TRUE;
-	free(fstrings);
-	fsrealloc(0);
-	n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings);
-	fsrealloc(n);
-	s = fstrings;
-	for (i = 0; i < n; i++) {
-		Fields[i].string = nextword(&s);
-		Fields[i].type |= (VF_FSTR | VF_USER | VF_DIRTY);
+	if (!lazy) {
+		free(fstrings);
+		fsrealloc(0);
+		if (fsplitter.n.info == TI_REGEXP || (char)fsplitter.n.info == '\0') {
+			n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings);
+			fsrealloc(n);
+			s = fstrings;
+			for (i = 0; i < n; i++) {
+				Fields[i].string = nextword(&s);
+				Fields[i].type |= (VF_FSTR | VF_USER | VF_DIRTY);
+			}
+			goto done;
+		}
+		/* Same rules as in awk_split() */
+		delim[0] = delim[1] = (char)fsplitter.n.info;
+		delim[2] = delim[3] = '\0';
+		if (delim[0] != ' ') {
+			if (*getvar_s(intvar[RS]) == '\0')
+				delim[2] = '\n';
+			if (icase) {
+				delim[0] = toupper(delim[0]);
+				delim[1] = tolower(delim[1]);
+			}
+		}
+		rest = fstrings = xstrdup(getvar_s(intvar[F0]));
+		if (!*rest) /* "": zero fields */
+			rest = NULL;
+		lazy = TRUE;
 	}
 
+	while (rest && (upto == 0 || num_fields < upto)) {
+		s = rest;
+		if (delim[0] == ' ') {
+			/* fields are separated by runs of spaces, tabs and newlines */
+			while (*s == ' ' || *s == '\t' || *s == '\n')
+				s++;
+			if (!*s) {
+				rest = NULL;
+				break;
+			}
+			rest = s + strcspn(s, " \t\n");
+			if (*rest)
+				*rest++ = '\0';
+		} else {
+			rest = strpbrk(s, delim);
+			if (rest)
+				*rest++ = '\0';
+		}
+		n = num_fields;
+		fsrealloc(n + 1);
+		Fields[n].string = s;
+		Fields[n].type |= (VF_FSTR | VF_USER | VF_DIRTY);
+	}
+	if (rest)
+		return;
+ done:
+	is_f0_split = TRUE;
+	lazy = FALSE;
+
 	/* set NF manually to avoid side effects */
 	clrvar(intvar[NF]);
 	intvar[NF]->type = VF_NUMBER | VF_SPECIAL;
 	intvar[NF]->number = num_fields;
 #undef fstrings
+#undef rest
+#undef delim
+#undef lazy
+}
+
+static void split_f0(void)
+{
+	split_f0_upto(0);
 }
 
 /* perform additional actions when some internal variables changed */
-static void handle_special(var *v)
+static var *handle_special(var *v)
 {
 	int n;
 	char *b;
@@ -2193,7 +2292,7 @@ static void handle_special(var *v)
 	int sl, l, len, i, bsize;
 
 	if (!(v->type & VF_SPECIAL))
-		return;
+		return v;
 
 	if (v == intvar[NF]) {
 		n = (int)getvar_i(v);
@@ -2223,6 +2322,9 @@ static void handle_special(var *v)
 		is_f0_split = TRUE;
 
 	} else if (v == intvar[F0]) {
+		/* old fields (and NF) stay valid until new $0 is split */
+		if (G.split_f0__lazy)
+			split_f0();
 		is_f0_split = FALSE;
 
 	} else if (v == intvar[FS]) {
@@ -2244,10 +2346,16 @@ static void handle_special(var *v)
 	} else if (v == intvar[IGNORECASE]) {
 		icase = istrue(v);
 	} else {				/* $n */
+		i = v - Fields;
+		/* need NF: finish splitting (may move Fields[]) */
+		if (G.split_f0__lazy)
+			split_f0();
 		n = getvar_i(intvar[NF]);
-		setvar_i(intvar[NF], n > v-Fields ? n : v-Fields+1);
-		/* right here v is invalid. Just to note... */
+		setvar_i(intvar[NF], n > i ? n : i + 1);
+		/* Fields[] may have moved */
+		v = &Fields[i];
 	}
+	return v;
 }
 
 /* step through func/builtin/etc arguments */
@@ -2400,7 +2508,10 @@ static int awk_getline(rstream *rsm, var *v)
 	if (p == 0) {
 		retval--;
 	} else {
-		setvar_sn(v, b+rp, so-rp);
+		/* new record: no need to finish splitting the old one */
+		if (v == intvar[F0])
+			G.split_f0__lazy = FALSE;
+		v = setvar_sn(v, b+rp, so-rp);
 		v->type |= VF_USER;
 		setvar_sn(intvar[RT], b+so, eo-so);
 	}
@@ -2698,7 +2809,7 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest /*,in
 	int match_no, residx, replen, resbufsize;
 	int regexec_flags;
 	regmatch_t pmatch[10];
-	regex_t sreg, *regex;
+	regex_t *regex;
 	/* True only if called to implement gensub(): */
 	int subexp = (src != dest);
 #if defined(REG_STARTEND)
@@ -2711,7 +2822,7 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest /*,in
 	resbuf = NULL;
 	residx = 0;
 	match_no = 0;
-	regex = as_regex(rn, &sreg);
+	regex = as_regex(rn);
 	sp = getvar_s(src ? src : intvar[F0]);
 #if defined(REG_STARTEND)
 	src_string = sp;
@@ -2799,8 +2910,6 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest /*,in
  ret:
 	//bb_error_msg("end sp:'%s'%p", sp,sp);
 	setvar_p(dest ? dest : intvar[F0], resbuf);
-	if (regex == &sreg)
-		regfree(regex);
 	return match_no;
 }
 
@@ -2836,13 +2945,11 @@ static NOINLINE int do_mktime(const char *ds)
 static NOINLINE var *do_match(node *an1, const char *as0)
 {
 	regmatch_t pmatch[1];
-	regex_t sreg, *re;
+	regex_t *re;
 	int n, start, len;
 
-	re = as_regex(an1, &sreg);
+	re = as_regex(an1);
 	n = regexec(re, as0, 1, pmatch, 0);
-	if (re == &sreg)
-		regfree(re);
 	start = 0;
 	len = -1;
 	if (n == 0) {
@@ -2857,6 +2964,7 @@ static NOINLINE var *do_match(node *an1, const char *as0)
 static NOINLINE var *exec_builtin(node *op, var *res)
 {
 #define tspl (G.exec_builtin__tspl)
+#define tspl_str (G.exec_builtin__tspl_str)
 
 	var *tmpvars;
 	node *an[4];
@@ -2906,8 +3014,17 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 		char *s, *s1;
 
 		if (nargs > 2) {
-			spl = (an[2]->info == TI_REGEXP) ? an[2]
-				: mk_splitter(getvar_s(evaluate(an[2], TMPVAR2)), &tspl);
+			spl = an[2];
+			if (spl->info != TI_REGEXP) {
+				const char *sep = getvar_s(evaluate(an[2], TMPVAR2));
+				spl = &tspl.n;
+				/* Usually it is the same every time, don't recompile */
+				if (!tspl_str || strcmp(tspl_str, sep) != 0) {
+					free(tspl_str);
+					tspl_str = xstrdup(sep);
+					mk_splitter(sep, &tspl);
+				}
+			}
 		} else {
 			spl = &fsplitter.n;
 		}
@@ -3041,6 +3158,7 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 
 	return res;
 #undef tspl
+#undef tspl_str
 }
 
 /* if expr looks like "var=value", perform assignment and return 1,
@@ -3152,7 +3270,6 @@ static var *evaluate(node *op, var *res)
 #define fnargs (G.evaluate__fnargs)
 /* seed is initialized to 1 */
 #define seed   (G.evaluate__seed)
-#define sreg   (G.evaluate__sreg)
 
 	var *tmpvars;
 
@@ -3425,10 +3542,8 @@ static var *evaluate(node *op, var *res)
 			op1 = op->r.n;
  re_cont:
 			{
-				regex_t *re = as_regex(op1, &sreg);
+				regex_t *re = as_regex(op1);
 				int i = regexec(re, L.s, 0, NULL, 0);
-				if (re == &sreg)
-					regfree(re);
 				setvar_i(res, (i == 0) ^ (opn == '!'));
 			}
 			break;
@@ -3750,7 +3865,7 @@ static var *evaluate(node *op, var *res)
 			if (i == 0) {
 				res = intvar[F0];
 			} else {
-				split_f0();
+				split_f0_upto(i);
 				if (i > num_fields)
 					fsrealloc(i);
 				res = &Fields[i - 1];
@@ -3867,7 +3982,6 @@ static var *evaluate(node *op, var *res)
 	return res;
 #undef fnargs
 #undef seed
-#undef sreg
 }
 
 static int awk_exit(void)
@@ -180,6 +180,16 @@
 //config:	Without this option, -exec + is a synonym for -exec ;
 //config:	(IOW: it works correctly, but without expected speedup)
 //config:
+//config:config FEATURE_FIND_EXEC_PARALLEL
+//config:	bool "Enable -parallel N: run -exec + commands concurrently"
+//config:	default y
+//config:	depends on FEATURE_FIND_EXEC_PLUS && PLATFORM_POSIX
+//config:	help
+//config:	Support the 'find -parallel N' option: up to N '-exec ... {} +'
+//config:	commands run while find keeps traversing, as with 'xargs -P'.
+//config:	'-keep-order' buffers their output in temporary files and
+//config:	prints it in the order the commands were started.
+//config:
 //config:config FEATURE_FIND_EXEC_OK
 //config:	bool "Enable -ok: execute confirmed commands"
 //config:	default y
@@ -308,6 +318,10 @@
 //usage:	IF_FEATURE_FIND_DEPTH(
 //usage:     "\n	-depth		Act on directory *after* traversing it"
 //usage:	)
+//usage:	IF_FEATURE_FIND_EXEC_PARALLEL(
+//usage:     "\n	-parallel N	Run up to N -exec + commands at once"
+//usage:     "\n	-keep-order	...and print their output in start order"
+//usage:	)
 //usage:     "\n"
 //usage:     "\nActions:"
 //usage:	IF_FEATURE_FIND_PAREN(
@@ -444,8 +458,44 @@ typedef struct {
 #if ENABLE_FEATURE_FIND_NOT
 	bool invert;
 #endif
+	unsigned char rank;
 } action;
 
+/* Cost of evaluating an action. Within an AND group, tests are
+ * reordered cheapest first, see plan_actions() */
+enum {
+	RANK_TYPE,    /* needs only file type, readdir usually knows it */
+	RANK_NAME,    /* string match on the name */
+	RANK_REGEX,
+	RANK_STAT,    /* needs full stat(), see exec_actions() */
+	RANK_SYSCALL, /* access(), getfilecon(), or a () with stat tests */
+	RANK_ACTION,  /* has side effects: never moved, nothing moves across */
+};
+#define RANK_print      RANK_ACTION
+#define RANK_print0     RANK_ACTION
+#define RANK_prune      RANK_ACTION
+#define RANK_quit       RANK_ACTION
+#define RANK_delete     RANK_ACTION
+#define RANK_exec       RANK_ACTION
+#define RANK_paren      RANK_ACTION /* until plan_actions() looks inside */
+#define RANK_type       RANK_TYPE
+#define RANK_name       RANK_NAME
+#define RANK_path       RANK_NAME
+#define RANK_regex      RANK_REGEX
+#define RANK_perm       RANK_STAT
+#define RANK_mtime      RANK_STAT
+#define RANK_mmin       RANK_STAT
+#define RANK_newer      RANK_STAT
+#define RANK_inum       RANK_STAT
+#define RANK_samefile   RANK_STAT
+#define RANK_user       RANK_STAT
+#define RANK_group      RANK_STAT
+#define RANK_size       RANK_STAT
+#define RANK_links      RANK_STAT
+#define RANK_empty      RANK_STAT
+#define RANK_executable RANK_SYSCALL
+#define RANK_context    RANK_SYSCALL
+
 #define ACTS(name, ...) typedef struct { action a; __VA_ARGS__ } action_##name;
 #define ACTF(name) \
 	static int FAST_FUNC func_##name(const char *fileName UNUSED_PARAM, \
@@ -500,11 +550,25 @@ struct globals {
 	int minmaxdepth[2];
 #endif
 	action ***actions;
+	/* Walker passed only the file type, stat() on first RANK_STAT test */
+	struct stat *stat_pending;
+	smallint stat_failed;
 	smallint need_print;
 	smallint xdev_on;
 	smalluint exitstatus;
 	recurse_flags_t recurse_flags;
 	IF_FEATURE_FIND_EXEC_PLUS(unsigned max_argv_len;)
+#if ENABLE_FEATURE_FIND_EXEC_PARALLEL
+	/* Running "-exec +" commands, a ring in start order */
+	struct exec_job {
+		pid_t pid; /* 0: exited */
+		int outfd; /* -keep-order: temp file with its output */
+	} *jobs;
+	unsigned max_jobs;
+	unsigned job_head;
+	unsigned job_cnt;
+	smallint keep_order;
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -514,6 +578,7 @@ struct globals {
 	memset(&G, 0, sizeof(G)); \
 	IF_FEATURE_FIND_MAXDEPTH(G.minmaxdepth[1] = INT_MAX;) \
 	IF_FEATURE_FIND_EXEC_PLUS(G.max_argv_len = bb_arg_max() - 2048;) \
+	IF_FEATURE_FIND_EXEC_PARALLEL(G.max_jobs = 1;) \
 	G.need_print = 1; \
 	G.recurse_flags = ACTION_RECURSE; \
 } while (0)
@@ -555,7 +620,23 @@ static int exec_actions(action ***appp, const char *fileName, const struct stat
 			ap = app[++cur_action];
 			if (!ap) /* all actions in group were successful */
 				return rc ^ TRUE; /* restore TRUE bit */
+			if (ap->rank == RANK_STAT && G.stat_pending) {
+				if (lstat(fileName, G.stat_pending) != 0) {
+					/* Report it like recursive_action() would,
+					 * and treat the file as not matching */
+					bb_simple_perror_msg(fileName);
+					G.exitstatus |= EXIT_FAILURE;
+					G.stat_failed = 1;
+				}
+				G.stat_pending = NULL;
+				if (G.stat_failed)
+					return 0;
+			}
 			rc |= TRUE ^ ap->f(fileName, statbuf, ap);
+			/* lstat failed inside (): no match, not even if
+			 * inverted or ORed with more groups, here or outside */
+			if (G.stat_failed)
+				return 0;
 #if ENABLE_FEATURE_FIND_NOT
 			if (ap->invert) rc ^= TRUE;
 #endif
@@ -568,6 +649,51 @@ static int exec_actions(action ***appp, const char *fileName, const struct stat
 	return rc ^ TRUE; /* restore TRUE bit */
 }
 
+#if ENABLE_FEATURE_FIND_PAREN
+ACTF(paren)
+{
+	return exec_actions(ap->subexpr, fileName, statbuf);
+}
+#endif
+
+/* Sort tests in each AND group by rank, so that "-size +1M -name '*.c'"
+ * stats only *.c files. Tests are side-effect free, so this doesn't
+ * change the result as long as they don't cross a RANK_ACTION
+ * (e.g. "-name x -prune"). Returns max rank of the whole expression.
+ */
+static int plan_actions(action ***appp)
+{
+	action **app, *ap;
+	int max_rank = RANK_TYPE;
+
+	while ((app = *appp++) != NULL) {
+		int i, j;
+
+		for (i = 0; (ap = app[i]) != NULL; i++) {
+#if ENABLE_FEATURE_FIND_PAREN
+			if (ap->f == (action_fp) func_paren) {
+				ap->rank = plan_actions(((action_paren*)ap)->subexpr);
+				/* exec_actions() stats only for RANK_STAT itself */
+				if (ap->rank == RANK_STAT)
+					ap->rank = RANK_SYSCALL;
+			}
+#endif
+			if (max_rank < ap->rank)
+				max_rank = ap->rank;
+			if (ap->rank == RANK_ACTION)
+				continue;
+			/* Insertion sort, stable, stops at previous RANK_ACTION */
+			for (j = i; j > 0 && app[j-1]->rank > ap->rank
+			    && app[j-1]->rank != RANK_ACTION; j--
+			) {
+				app[j] = app[j-1];
+			}
+			app[j] = ap;
+		}
+	}
+	return max_rank;
+}
+
 #if !FNM_CASEFOLD
 static char *strcpy_upcase(char *dst, const char *src)
 {
@@ -763,6 +889,104 @@ ACTF(samefile)
 }
 #endif
 #if ENABLE_FEATURE_FIND_EXEC
+# if ENABLE_FEATURE_FIND_EXEC_PARALLEL
+/* With -parallel, a batch is not allowed to grow above this many
+ * files, otherwise small trees would give only one command to run */
+#  define PARALLEL_BATCH 128
+
+/* Reap one "-exec +" command (wait for one if block is set) and
+ * retire finished jobs. Returns 0 if there was nothing to reap */
+static int exec_wait(int block)
+{
+	struct exec_job *jp;
+	int wstat;
+	unsigned i;
+	pid_t pid;
+
+	pid = block ? safe_waitpid(-1, &wstat, 0) : wait_any_nohang(&wstat);
+	if (pid <= 0)
+		return 0;
+	for (i = 0; i < G.job_cnt; i++) {
+		jp = &G.jobs[(G.job_head + i) % G.max_jobs];
+		if (jp->pid == pid)
+			goto found;
+	}
+	return 1; /* not ours */
+ found:
+	jp->pid = 0;
+	if (!WIFEXITED(wstat) || WEXITSTATUS(wstat) != 0)
+		G.exitstatus |= EXIT_FAILURE;
+	if (!G.keep_order) {
+		/* Order doesn't matter: fill the hole with the head job */
+		*jp = G.jobs[G.job_head];
+		G.job_head = (G.job_head + 1) % G.max_jobs;
+		G.job_cnt--;
+		return 1;
+	}
+	/* Print output of finished jobs up to the first still running one */
+	while (G.job_cnt && G.jobs[G.job_head].pid == 0) {
+		jp = &G.jobs[G.job_head];
+		xlseek(jp->outfd, 0, SEEK_SET);
+		bb_copyfd_eof(jp->outfd, STDOUT_FILENO);
+		close(jp->outfd);
+		G.job_head = (G.job_head + 1) % G.max_jobs;
+		G.job_cnt--;
+	}
+	return 1;
+}
+
+static void exec_wait_all(void)
+{
+	while (G.job_cnt)
+		if (!exec_wait(1))
+			break;
+}
+
+/* Start argv without waiting for it, returns 1 if started */
+static int exec_start(char **argv)
+{
+	struct exec_job *jp;
+	int saved_stdout = -1;
+	int outfd = -1;
+	pid_t pid;
+
+	/* Retire what has finished meanwhile: -keep-order output
+	 * goes out as we go, not all at the end */
+	while (G.job_cnt && exec_wait(0))
+		continue;
+	while (G.job_cnt >= G.max_jobs)
+		if (!exec_wait(1))
+			break;
+
+	/* Our own -print output must come before theirs */
+	fflush_all();
+	if (G.keep_order) {
+		char *tmpl = concat_path_file(getenv("TMPDIR") ? : "/tmp", "find.XXXXXX");
+		outfd = xmkstemp(tmpl);
+		unlink(tmpl);
+		free(tmpl);
+		close_on_exec_on(outfd);
+		saved_stdout = dup(STDOUT_FILENO);
+		if (saved_stdout < 0)
+			bb_simple_perror_msg_and_die("dup");
+		close_on_exec_on(saved_stdout);
+		xdup2(outfd, STDOUT_FILENO);
+	}
+	pid = spawn(argv);
+	if (saved_stdout >= 0)
+		xmove_fd(saved_stdout, STDOUT_FILENO);
+	if (pid < 0) {
+		bb_simple_perror_msg(argv[0]);
+		if (outfd >= 0)
+			close(outfd);
+		return 0;
+	}
+	jp = &G.jobs[(G.job_head + G.job_cnt++) % G.max_jobs];
+	jp->pid = pid;
+	jp->outfd = outfd;
+	return 1;
+}
+# endif
 static int do_exec(action_exec *ap, const char *fileName)
 {
 	int i, rc;
@@ -826,9 +1050,18 @@ static int do_exec(action_exec *ap, const char *fileName)
 		}
 	}
 # endif
-	rc = spawn_and_wait(argv);
-	if (rc < 0)
-		bb_simple_perror_msg(argv[0]);
+# if ENABLE_FEATURE_FIND_EXEC_PARALLEL
+	if (G.jobs && !fileName) {
+		/* "-exec +" with -parallel: its exit code is collected
+		 * by exec_wait() into G.exitstatus */
+		rc = !exec_start(argv);
+	} else
+# endif
+	{
+		rc = spawn_and_wait(argv);
+		if (rc < 0)
+			bb_simple_perror_msg(argv[0]);
+	}
 
 # if ENABLE_FEATURE_FIND_EXEC_OK
     not_ok:
@@ -849,8 +1082,13 @@ ACTF(exec)
 		ap->file_len += strlen(fileName) + sizeof(char*) + 1;
 		/* If we have lots of files already, exec the command */
 		rc = 1;
-		if (ap->file_len >= G.max_argv_len)
+		if (ap->file_len >= G.max_argv_len
+# if ENABLE_FEATURE_FIND_EXEC_PARALLEL
+		 || (G.jobs && ap->filelist_idx >= PARALLEL_BATCH)
+# endif
+		) {
 			rc = do_exec(ap, NULL);
+		}
 		return rc;
 	}
 # endif
@@ -871,12 +1109,15 @@ static int flush_exec_plus(void)
 #  if ENABLE_FEATURE_FIND_NOT
 					if (ap->invert) rc = !rc;
 #  endif
-					if (rc == 0)
+					if (rc == 0) {
+						IF_FEATURE_FIND_EXEC_PARALLEL(exec_wait_all();)
 						return 1;
+					}
 				}
 			}
 		}
 	}
+	IF_FEATURE_FIND_EXEC_PARALLEL(exec_wait_all();)
 	return 0;
 }
 # endif
@@ -905,12 +1146,6 @@ ACTF(print)
 	puts(fileName);
 	return TRUE;
 }
-#if ENABLE_FEATURE_FIND_PAREN
-ACTF(paren)
-{
-	return exec_actions(ap->subexpr, fileName, statbuf);
-}
-#endif
 #if ENABLE_FEATURE_FIND_SIZE
 ACTF(size)
 {
@@ -936,6 +1171,7 @@ ACTF(prune)
 #if ENABLE_FEATURE_FIND_QUIT
 ACTF(quit)
 {
+	IF_FEATURE_FIND_EXEC_PARALLEL(exec_wait_all();)
 	exit(G.exitstatus);
 }
 #endif
@@ -1010,7 +1246,7 @@ ACTF(links)
 #endif
 
 static int FAST_FUNC fileAction(
-		struct recursive_state *state IF_NOT_FEATURE_FIND_MAXDEPTH(UNUSED_PARAM),
+		struct recursive_state *state,
 		const char *fileName,
 		struct stat *statbuf)
 {
@@ -1040,6 +1276,8 @@ static int FAST_FUNC fileAction(
 		return SKIP; /* stop recursing */
 #endif
 
+	G.stat_pending = state->partial_stat ? statbuf : NULL;
+	G.stat_failed = 0;
 	r = exec_actions(G.actions, fileName, statbuf);
 	/* Had no explicit -print[0] or -exec? then print */
 	if ((r & TRUE) && G.need_print)
@@ -1111,7 +1349,7 @@ struct pp_locals {
 	unsigned cur_action;
 	IF_FEATURE_FIND_NOT( bool invert_flag; )
 };
-static action* alloc_action(struct pp_locals *ppl, int sizeof_struct, action_fp f)
+static action* alloc_action(struct pp_locals *ppl, int sizeof_struct, action_fp f, int rank)
 {
 	action *ap = xzalloc(sizeof_struct);
 	action **app;
@@ -1120,6 +1358,7 @@ static action* alloc_action(struct pp_locals *ppl, int sizeof_struct, action_fp
 	app[ppl->cur_action++] = ap;
 	app[ppl->cur_action] = NULL;
 	ap->f = f;
+	ap->rank = rank;
 	IF_FEATURE_FIND_NOT( ap->invert = ppl->invert_flag; )
 	IF_FEATURE_FIND_NOT( ppl->invert_flag = 0; )
 	return ap;
@@ -1132,6 +1371,7 @@ static action*** parse_params(char **argv)
 	                        OPT_FOLLOW     ,
 	IF_FEATURE_FIND_XDEV(   OPT_XDEV       ,)
 	IF_FEATURE_FIND_DEPTH(  OPT_DEPTH      ,)
+	IF_FEATURE_FIND_EXEC_PARALLEL(OPT_KEEP_ORDER,)
 	                        PARM_a         ,
 	                        PARM_o         ,
 	IF_FEATURE_FIND_NOT(	PARM_char_not  ,)
@@ -1178,12 +1418,14 @@ static action*** parse_params(char **argv)
 	IF_FEATURE_FIND_CONTEXT(PARM_context   ,)
 	IF_FEATURE_FIND_LINKS(  PARM_links     ,)
 	IF_FEATURE_FIND_MAXDEPTH(OPT_MINDEPTH,OPT_MAXDEPTH,)
+	IF_FEATURE_FIND_EXEC_PARALLEL(OPT_PARALLEL,)
 	};
 
 	static const char params[] ALIGN1 =
 	                        "-follow\0"
 	IF_FEATURE_FIND_XDEV(   "-xdev\0"                 )
 	IF_FEATURE_FIND_DEPTH(  "-depth\0"                )
+	IF_FEATURE_FIND_EXEC_PARALLEL("-keep-order\0"    )
 	                        "-a\0"
 	                        "-o\0"
 	IF_FEATURE_FIND_NOT(    "!\0"       )
@@ -1228,6 +1470,7 @@ static action*** parse_params(char **argv)
 	IF_FEATURE_FIND_CONTEXT("-context\0")
 	IF_FEATURE_FIND_LINKS(  "-links\0"  )
 	IF_FEATURE_FIND_MAXDEPTH("-mindepth\0""-maxdepth\0")
+	IF_FEATURE_FIND_EXEC_PARALLEL("-parallel\0")
 	;
 
 #if !USE_NESTED_FUNCTION
@@ -1236,7 +1479,7 @@ static action*** parse_params(char **argv)
 #define cur_group   (ppl.cur_group  )
 #define cur_action  (ppl.cur_action )
 #define invert_flag (ppl.invert_flag)
-#define ALLOC_ACTION(name) (action_##name*)alloc_action(&ppl, sizeof(action_##name), (action_fp) func_##name)
+#define ALLOC_ACTION(name) (action_##name*)alloc_action(&ppl, sizeof(action_##name), (action_fp) func_##name, RANK_##name)
 #else
 	action*** appp;
 	unsigned cur_group;
@@ -1246,19 +1489,20 @@ static action*** parse_params(char **argv)
 	/* This is the only place in busybox where we use nested function.
 	 * So far more standard alternatives were bigger. */
 	/* Auto decl suppresses "func without a prototype" warning: */
-	auto action* alloc_action(int sizeof_struct, action_fp f);
-	action* alloc_action(int sizeof_struct, action_fp f)
+	auto action* alloc_action(int sizeof_struct, action_fp f, int rank);
+	action* alloc_action(int sizeof_struct, action_fp f, int rank)
 	{
 		action *ap;
 		appp[cur_group] = xrealloc(appp[cur_group], (cur_action+2) * sizeof(appp[0][0]));
 		appp[cur_group][cur_action++] = ap = xzalloc(sizeof_struct);
 		appp[cur_group][cur_action] = NULL;
 		ap->f = f;
+		ap->rank = rank;
 		IF_FEATURE_FIND_NOT( ap->invert = invert_flag; )
 		IF_FEATURE_FIND_NOT( invert_flag = 0; )
 		return ap;
 	}
-#define ALLOC_ACTION(name) (action_##name*)alloc_action(sizeof(action_##name), (action_fp) func_##name)
+#define ALLOC_ACTION(name) (action_##name*)alloc_action(sizeof(action_##name), (action_fp) func_##name, RANK_##name)
 #endif
 
 	cur_group = 0;
@@ -1310,6 +1554,16 @@ static action*** parse_params(char **argv)
 			G.recurse_flags |= ACTION_DEPTHFIRST;
 		}
 #endif
+#if ENABLE_FEATURE_FIND_EXEC_PARALLEL
+		else if (parm == OPT_KEEP_ORDER) {
+			dbg("%d", __LINE__);
+			G.keep_order = 1;
+		}
+		else if (parm == OPT_PARALLEL) {
+			dbg("%d", __LINE__);
+			G.max_jobs = xatou_range(arg1, 1, 1024);
+		}
+#endif
 /* Actions are grouped by operators
  * ( expr )              Force precedence
  * ! expr                True if expr is false
@@ -1724,6 +1978,15 @@ int find_main(int argc UNUSED_PARAM, char **argv)
 
 	G.actions = parse_params(&argv[firstopt]);
 	argv[firstopt] = NULL;
+	plan_actions(G.actions);
+	/* Tests can do with d_type instead of stat(), fileAction() needs
+	 * st_dev of dirs for -xdev though */
+	if (!G.xdev_on)
+		G.recurse_flags |= ACTION_DTYPE_OK;
+#if ENABLE_FEATURE_FIND_EXEC_PARALLEL
+	if (G.max_jobs > 1)
+		G.jobs = xzalloc(G.max_jobs * sizeof(G.jobs[0]));
+#endif
 
 #if ENABLE_FEATURE_FIND_XDEV
 	if (G.xdev_on) {
@@ -584,11 +584,16 @@ enum {
 	ACTION_DEPTHFIRST     = (1 << 3),
 	ACTION_QUIET          = (1 << 4),
 	ACTION_DANGLING_OK    = (1 << 5),
+	/* Callbacks can make do with just the file type (from readdir's d_type)
+	 * in statbuf->st_mode, the rest of statbuf is zeroed then and
+	 * state->partial_stat is set */
+	ACTION_DTYPE_OK       = (1 << 6),
 };
 typedef uint8_t recurse_flags_t;
 typedef struct recursive_state {
 	unsigned flags;
 	unsigned depth;
+	smallint partial_stat;
 	void *userData;
 	int FAST_FUNC (*fileAction)(struct recursive_state *state, const char *fileName, struct stat* statbuf);
 	int FAST_FUNC  (*dirAction)(struct recursive_state *state, const char *fileName, struct stat* statbuf);
@@ -1036,7 +1041,7 @@ struct tls_aes {
 };
 #define TLS_MAX_MAC_SIZE 32
 #define TLS_MAX_KEY_SIZE 32
-#define TLS_MAX_IV_SIZE   4
+#define TLS_MAX_IV_SIZE  12 /* ChaCha20: 12, AES-GCM: 4 */
 struct tls_handshake_data; /* opaque */
 typedef struct tls_state {
 	unsigned flags;
@@ -1060,6 +1065,9 @@ typedef struct tls_state {
 	int     ofs_to_buffered;
 	int     buffered_size;
 	uint8_t *inbuf;
+	/* Decrypted data in inbuf not yet consumed by tls_read_data() */
+	int     ofs_to_plaintext;
+	int     plaintext_size;
 
 	struct tls_handshake_data *hsd;
 
@@ -1070,7 +1078,7 @@ typedef struct tls_state {
 	//   number MUST be set to zero whenever a connection state is made the
 	//   active state.  Sequence numbers are of type uint64 and may not
 	//   exceed 2^64-1.
-	/*uint64_t read_seq64_be;*/
+	uint64_t read_seq64_be; /* used only by ChaCha20 */
 	uint64_t write_seq64_be;
 
 	uint8_t *our_write_MAC_key;
@@ -1108,6 +1116,11 @@ void FAST_FUNC tls_handshake_as_server(tls_state_t *tls,
 #define TLSLOOP_EXIT_ON_LOCAL_EOF (1 << 0)
 #define TLS_NO_CHECK_CERTIFICATE (1 << 1)
 void tls_run_copy_loop(tls_state_t *tls, unsigned flags) FAST_FUNC;
+/* For applets which talk over TLS themselves (internal TLS only) */
+int tls_read_data(tls_state_t *tls, void *buf, int len) FAST_FUNC;
+void tls_write_data(tls_state_t *tls, const void *buf, int len) FAST_FUNC;
+int tls_has_buffered_data(tls_state_t *tls) FAST_FUNC;
+void tls_free(tls_state_t *tls) FAST_FUNC;
 
 
 void socket_want_pktinfo(int fd) FAST_FUNC;
@@ -1346,6 +1359,11 @@ void FAST_FUNC xorbuf64_3_aligned64(void *dst, const void *src1, const void *src
 void FAST_FUNC xorbuf16(void* buf, const void* mask);
 #endif
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+/* In: leaf in *eax, subleaf in *ecx */
+void FAST_FUNC cpuid_eax_ebx_ecx(unsigned *eax, unsigned *ebx, unsigned *ecx, unsigned *edx);
+#endif
+
 /* Generate a UUID */
 void generate_uuid(uint8_t *buf) FAST_FUNC;
 void FAST_FUNC format_uuid_DCE_37_chars(char *dst37, const uint8_t *buf16);
@@ -2435,6 +2453,8 @@ enum {
 	PSSCAN_NICE     = (1 << 20) * ENABLE_FEATURE_PS_ADDITIONAL_COLUMNS,
 	PSSCAN_RUIDGID  = (1 << 21) * ENABLE_FEATURE_PS_ADDITIONAL_COLUMNS,
 	PSSCAN_TASKS	= (1 << 22) * ENABLE_FEATURE_SHOW_THREADS,
+	/* Keep /proc/PID/stat open for the next scan */
+	PSSCAN_KEEP_FD  = (1 << 23) * ENABLE_FEATURE_FAST_TOP,
 };
 //procps_status_t* alloc_procps_scan(void) FAST_FUNC;
 void free_procps_scan(procps_status_t* sp) FAST_FUNC;
@@ -2442,6 +2462,11 @@ procps_status_t* procps_scan(procps_status_t* sp, int flags) FAST_FUNC;
 /* Format cmdline (up to col chars) into char buf[size] */
 /* Puts [comm] if cmdline is empty (-> process is a kernel thread) */
 int read_cmdline(char *buf, int size, unsigned pid, const char *comm) FAST_FUNC;
+/* JSON line for one process, see libbb/procps_json.c */
+void json_proc_start(unsigned long long now,
+		unsigned pid, unsigned ppid, unsigned uid,
+		const char *state, unsigned long rss) FAST_FUNC;
+void json_proc_end(const char *comm) FAST_FUNC;
 pid_t *find_pid_by_name(const char* procName) FAST_FUNC;
 pid_t *pidlist_reverse(pid_t *pidList) FAST_FUNC;
 int starts_with_cpu(const char *str) FAST_FUNC;
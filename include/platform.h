@@ -456,9 +456,13 @@ typedef unsigned smalluint;
 #define HAVE_PRINTF_PERCENTM 1
 #define HAVE_WAIT3 1
 #define HAVE_DEV_FD 1
+#define HAVE_FOPENCOOKIE 1
 #define DEV_FD_PREFIX "/dev/fd/"
 
 #if defined(__UCLIBC__)
+# ifndef __UCLIBC_HAS_GLIBC_CUSTOM_STREAMS__
+#  undef HAVE_FOPENCOOKIE
+# endif
 # if UCLIBC_VERSION < KERNEL_VERSION(0, 9, 32)
 #  undef HAVE_STRVERSCMP
 # endif
@@ -489,6 +493,7 @@ typedef unsigned smalluint;
 # undef HAVE_UNLOCKED_STDIO
 # undef HAVE_UNLOCKED_LINE_OPS
 # undef HAVE_PRINTF_PERCENTM
+# undef HAVE_FOPENCOOKIE
 #endif
 
 #if defined(__WATCOMC__)
@@ -508,6 +513,7 @@ typedef unsigned smalluint;
 # undef HAVE_UNLOCKED_STDIO
 # undef HAVE_UNLOCKED_LINE_OPS
 # undef HAVE_NET_ETHERNET_H
+# undef HAVE_FOPENCOOKIE
 #endif
 
 #if defined(__CYGWIN__)
@@ -536,10 +542,12 @@ typedef unsigned smalluint;
 # undef HAVE_UNLOCKED_STDIO
 # undef HAVE_UNLOCKED_LINE_OPS
 # undef HAVE_PRINTF_PERCENTM
+# undef HAVE_FOPENCOOKIE
 #endif
 
 #if defined(__dietlibc__)
 # undef HAVE_STRCHRNUL
+# undef HAVE_FOPENCOOKIE
 #endif
 
 #if defined(__APPLE__)
@@ -559,6 +567,7 @@ typedef unsigned smalluint;
 # undef HAVE_XTABS
 # undef HAVE_UNLOCKED_LINE_OPS
 # undef HAVE_PRINTF_PERCENTM
+# undef HAVE_FOPENCOOKIE
 # include <osreldate.h>
 # if __FreeBSD_version < 1000029
 #  undef HAVE_STRCHRNUL /* FreeBSD added strchrnul() between 1000028 and 1000029 */
@@ -593,6 +602,9 @@ typedef unsigned smalluint;
 # if __ANDROID_API__ >= 21
 #  undef HAVE_WAIT3
 # endif
+# if __ANDROID_API__ < 28
+#  undef HAVE_FOPENCOOKIE
+# endif
 # undef HAVE_MEMPCPY
 # undef HAVE_STRCHRNUL
 # undef HAVE_STRVERSCMP
@@ -0,0 +1,18 @@
+/*
+ * Utility routines.
+ *
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ */
+//kbuild:lib-y += cpuid.o
+
+#include "libbb.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+void FAST_FUNC cpuid_eax_ebx_ecx(unsigned *eax, unsigned *ebx, unsigned *ecx, unsigned *edx)
+{
+	asm ("cpuid"
+		: "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		: "0" (*eax), "1" (*ebx), "2" (*ecx)
+	);
+}
+#endif
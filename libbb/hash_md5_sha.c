@@ -137,13 +137,6 @@ unsigned FAST_FUNC generic_end(bcrypt_hash_ctx_t *ctx, void *resbuf)
 
 #if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL
 # if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
-static void cpuid_eax_ebx_ecx(unsigned *eax, unsigned *ebx, unsigned *ecx, unsigned *edx)
-{
-	asm ("cpuid"
-		: "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
-		: "0" (*eax), "1" (*ebx), "2" (*ecx)
-	);
-}
 static smallint shaNI;
 static NOINLINE int get_shaNI(void)
 {
@@ -82,6 +82,121 @@ static int read_to_buf(const char *filename, void *buf)
 	return ret;
 }
 
+#if ENABLE_FEATURE_FAST_TOP
+/* PSSCAN_KEEP_FD: /proc/PID/stat files of the last complete scan
+ * (sorted by pid) and of the current one */
+typedef struct kept_fd_t {
+	unsigned pid;
+	int fd;
+} kept_fd_t;
+
+typedef struct kept_fds_t {
+	kept_fd_t *old, *new;
+	unsigned old_cnt, new_cnt;
+	unsigned max; /* leave enough fds to the rest of the program */
+} kept_fds_t;
+
+static kept_fds_t *kept_fds;
+
+static int cmp_kept_fd(const void *a, const void *b)
+{
+	unsigned pid_a = ((const kept_fd_t *)a)->pid;
+	unsigned pid_b = ((const kept_fd_t *)b)->pid;
+	return (pid_a > pid_b) - (pid_a < pid_b);
+}
+
+/* Like read_to_buf(filename) for /proc/PID/stat, but reuse the fd
+ * from the last scan. Also fstat() it for PSSCAN_UIDGID if sp != NULL */
+static int read_kept_stat(unsigned pid, const char *filename, char *buf, procps_status_t *sp)
+{
+	kept_fds_t *k = kept_fds;
+	kept_fd_t *e;
+	struct stat sb;
+	ssize_t ret;
+	int fd;
+
+	if (!k) {
+		struct rlimit rl;
+
+		k = kept_fds = xzalloc(sizeof(*k));
+		/* We want to keep as many as there are processes */
+		getrlimit(RLIMIT_NOFILE, &rl);
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+		k->max = MIN(rl.rlim_cur, INT_MAX) / 2;
+	}
+
+	e = NULL;
+	if (k->old_cnt) {
+		kept_fd_t key;
+		key.pid = pid;
+		e = bsearch(&key, k->old, k->old_cnt, sizeof(key), cmp_kept_fd);
+	}
+	if (e && e->fd >= 0) {
+		fd = e->fd;
+		e->fd = -1;
+		/* Fails if process exited (even if its PID is reused) */
+		ret = pread(fd, buf, PROCPS_BUFSIZE-1, 0);
+		if (ret > 0)
+			goto got_it;
+		close(fd);
+	}
+	ret = -1;
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		goto ret;
+	ret = read(fd, buf, PROCPS_BUFSIZE-1);
+	if (ret <= 0)
+		goto close_ret;
+ got_it:
+	if (sp) {
+		/* Effective UID/GID, not real (same as of /proc/PID) */
+		if (fstat(fd, &sb) != 0) {
+			ret = -1;
+			goto close_ret;
+		}
+		sp->uid = sb.st_uid;
+		sp->gid = sb.st_gid;
+	}
+	if (k->new_cnt < k->max) {
+		k->new = xrealloc_vector(k->new, 6, k->new_cnt);
+		k->new[k->new_cnt].pid = pid;
+		k->new[k->new_cnt].fd = fd;
+		k->new_cnt++;
+		goto ret;
+	}
+ close_ret:
+	close(fd);
+ ret:
+	buf[ret > 0 ? ret : 0] = '\0';
+	return ret;
+}
+
+/* Scan is complete: files not reused belong to exited processes */
+static void rotate_kept_fds(void)
+{
+	kept_fds_t *k = kept_fds;
+	unsigned i;
+
+	if (!k)
+		return;
+	for (i = 0; i < k->old_cnt; i++) {
+		if (k->old[i].fd >= 0)
+			close(k->old[i].fd);
+	}
+	free(k->old);
+	qsort(k->new, k->new_cnt, sizeof(k->new[0]), cmp_kept_fd);
+	k->old = k->new;
+	k->old_cnt = k->new_cnt;
+	k->new = NULL;
+	k->new_cnt = 0;
+}
+#else
+# define read_kept_stat(pid, filename, buf, sp) read_to_buf(filename, buf)
+# define rotate_kept_fds() ((void)0)
+#endif
+
 static procps_status_t* FAST_FUNC alloc_procps_scan(void)
 {
 	procps_status_t* sp = xzalloc(sizeof(procps_status_t));
@@ -268,6 +383,16 @@ if (memcmp(buf+4, S, sizeof(S)-1) == 0) { \
 }
 #endif
 
+/* These are all retrieved from proc/NN/stat in one go: */
+#define PSSCAN_STAT_FIELDS (0 \
+	| PSSCAN_PPID | PSSCAN_PGID | PSSCAN_SID \
+	| PSSCAN_COMM | PSSCAN_STATE \
+	| PSSCAN_VSZ | PSSCAN_RSS \
+	| PSSCAN_STIME | PSSCAN_UTIME | PSSCAN_START_TIME \
+	| PSSCAN_TTY | PSSCAN_NICE \
+	| PSSCAN_CPU \
+)
+
 procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 {
 	if (!sp)
@@ -293,6 +418,8 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 #endif
 		entry = readdir(sp->dir);
 		if (entry == NULL) {
+			if (flags & PSSCAN_KEEP_FD)
+				rotate_kept_fds();
 			free_procps_scan(sp);
 			return NULL;
 		}
@@ -338,7 +465,10 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 #endif
 			filename_tail = filename + sprintf(filename, "/proc/%u/", pid);
 
-		if (flags & PSSCAN_UIDGID) {
+		/* With PSSCAN_KEEP_FD, fstat of kept /proc/PID/stat does it */
+		if ((flags & PSSCAN_UIDGID)
+		 && !((flags & PSSCAN_KEEP_FD) && (flags & PSSCAN_STAT_FIELDS))
+		) {
 			struct stat sb;
 			if (stat(filename, &sb))
 				continue; /* process probably exited */
@@ -347,14 +477,7 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 			sp->gid = sb.st_gid;
 		}
 
-		/* These are all retrieved from proc/NN/stat in one go: */
-		if (flags & (PSSCAN_PPID | PSSCAN_PGID | PSSCAN_SID
-			| PSSCAN_COMM | PSSCAN_STATE
-			| PSSCAN_VSZ | PSSCAN_RSS
-			| PSSCAN_STIME | PSSCAN_UTIME | PSSCAN_START_TIME
-			| PSSCAN_TTY | PSSCAN_NICE
-			| PSSCAN_CPU)
-		) {
+		if (flags & PSSCAN_STAT_FIELDS) {
 			int s_idx;
 			char *cp, *comm1;
 			int tty;
@@ -364,7 +487,11 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 #endif
 			/* see proc(5) for some details on this */
 			strcpy(filename_tail, "stat");
-			n = read_to_buf(filename, buf);
+			if (flags & PSSCAN_KEEP_FD)
+				n = read_kept_stat(pid, filename, buf,
+					(flags & PSSCAN_UIDGID) ? sp : NULL);
+			else
+				n = read_to_buf(filename, buf);
 			if (n < 0)
 				continue; /* process probably exited */
 			cp = strrchr(buf, ')'); /* split into "PID (cmd" and "<rest>" */
@@ -0,0 +1,40 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ */
+//kbuild:lib-$(CONFIG_FEATURE_TOP_JSON) += procps_json.o
+//kbuild:lib-$(CONFIG_FEATURE_PS_JSON) += procps_json.o
+
+#include "libbb.h"
+
+/* "top -j" and "ps -J" print the same one-line records:
+ * {"time":T,"type":"proc","pid":N,...,"comm":"NAME"}
+ * Applet-specific fields go between the two calls.
+ */
+void FAST_FUNC json_proc_start(unsigned long long now,
+		unsigned pid, unsigned ppid, unsigned uid,
+		const char *state, unsigned long rss)
+{
+	printf("{\"time\":%llu,\"type\":\"proc\",\"pid\":%u,\"ppid\":%u"
+		",\"uid\":%u,\"state\":\"%.*s\",\"rss\":%lu",
+		now, pid, ppid,
+		uid, (int)strcspn(state, " "), state, rss
+	);
+}
+
+void FAST_FUNC json_proc_end(const char *comm)
+{
+	fputs_stdout(",\"comm\":\"");
+	for (; *comm; comm++) {
+		unsigned char c = *comm;
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < ' ' || c == 0x7f)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	fputs_stdout("\"}\n");
+}
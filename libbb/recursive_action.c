@@ -62,9 +62,32 @@ static int FAST_FUNC true_action(struct recursive_state *state UNUSED_PARAM,
  * ACTION_FOLLOWLINKS mainly controls handling of links to dirs.
  * 0: lstat(statbuf). Calls fileAction on link name even if points to dir.
  * 1: stat(statbuf). Calls dirAction and optionally recurse on link to dir.
+ *
+ * ACTION_DTYPE_OK: for directory entries whose type readdir reports,
+ * don't stat() at all, callbacks get only the type in st_mode
+ * (and state->partial_stat = 1). Links are still stat'ed if followed.
  */
 
-static int recursive_action1(recursive_state_t *state, const char *fileName)
+#if ENABLE_PLATFORM_POSIX
+static mode_t dtype_to_mode(unsigned d_type)
+{
+	switch (d_type) {
+	case DT_REG:  return S_IFREG;
+	case DT_DIR:  return S_IFDIR;
+	case DT_LNK:  return S_IFLNK;
+	case DT_CHR:  return S_IFCHR;
+	case DT_BLK:  return S_IFBLK;
+	case DT_FIFO: return S_IFIFO;
+	case DT_SOCK: return S_IFSOCK;
+	}
+	return 0; /* DT_UNKNOWN: filesystem doesn't tell, stat() it */
+}
+#else
+# define dtype_to_mode(d_type) ((mode_t)0)
+#endif
+
+/* mode: file type from readdir, or 0 if unknown */
+static int recursive_action1(recursive_state_t *state, const char *fileName, mode_t mode)
 {
 	struct stat statbuf;
 	unsigned follow;
@@ -76,6 +99,14 @@ static int recursive_action1(recursive_state_t *state, const char *fileName)
 	if (state->depth == 0)
 		follow = ACTION_FOLLOWLINKS | ACTION_FOLLOWLINKS_L0;
 	follow &= state->flags;
+	if (follow && S_ISLNK(mode))
+		mode = 0;
+	state->partial_stat = (mode != 0);
+	if (mode) {
+		memset(&statbuf, 0, sizeof(statbuf));
+		statbuf.st_mode = mode;
+		goto got_type;
+	}
 	status = (follow ? stat : lstat)(fileName, &statbuf);
 	if (status < 0) {
 #ifdef DEBUG_RECURS_ACTION
@@ -90,6 +121,7 @@ static int recursive_action1(recursive_state_t *state, const char *fileName)
 		}
 		goto done_nak_warn;
 	}
+ got_type:
 
 	/* If S_ISLNK(m), then we know that !S_ISDIR(m).
 	 * Then we can skip checking first part: if it is true, then
@@ -124,15 +156,19 @@ static int recursive_action1(recursive_state_t *state, const char *fileName)
 	status = TRUE;
 	while ((next = readdir(dir)) != NULL) {
 		char *nextFile;
+		mode_t next_mode;
 		int s;
 
 		nextFile = concat_subpath_file(fileName, next->d_name);
 		if (nextFile == NULL)
 			continue;
 
+		next_mode = 0;
+		if (state->flags & ACTION_DTYPE_OK)
+			next_mode = dtype_to_mode(next->d_type);
 		/* process every file (NB: ACTION_RECURSE is set in flags) */
 		state->depth++;
-		s = recursive_action1(state, nextFile);
+		s = recursive_action1(state, nextFile, next_mode);
 		if (s == FALSE)
 			status = FALSE;
 		free(nextFile);
@@ -147,6 +183,7 @@ static int recursive_action1(recursive_state_t *state, const char *fileName)
 	closedir(dir);
 
 	if (state->flags & ACTION_DEPTHFIRST) {
+		state->partial_stat = (mode != 0);
 		if (!state->dirAction(state, fileName, &statbuf))
 			goto done_nak_warn;
 	}
@@ -177,5 +214,5 @@ int FAST_FUNC recursive_action(const char *fileName,
 	state.fileAction = fileAction ? fileAction : true_action;
 	state.dirAction  =  dirAction ?  dirAction : true_action;
 
-	return recursive_action1(&state, fileName);
+	return recursive_action1(&state, fileName, 0);
 }
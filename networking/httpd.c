@@ -117,6 +117,28 @@
 //config:	"Range: bytes=NNN-[MMM]" header. Allows for resuming interrupted
 //config:	downloads, seeking in multimedia players etc.
 //config:
+//config:config FEATURE_HTTPD_KEEPALIVE
+//config:	bool "Support persistent connections (keep-alive)"
+//config:	default y
+//config:	depends on HTTPD
+//config:	help
+//config:	Serve further requests on the same connection after a file
+//config:	was sent, instead of closing it after every response.
+//config:	Pages with many small assets load faster, and the server
+//config:	does not fork a process per asset.
+//config:	CGI, proxy and error responses still close the connection.
+//config:
+//config:config FEATURE_HTTPD_EVENT
+//config:	bool "Enable -E NUM option (serve files without forking)"
+//config:	default y
+//config:	depends on HTTPD && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	With -E NUM, NUM server processes wait for all their
+//config:	connections in one poll() loop, and send ordinary files
+//config:	themselves. A process is forked only for requests which
+//config:	need more (CGI, proxy, authentication, ranges, errors...).
+//config:	Each server process handles up to MAXCONN connections.
+//config:
 //config:config FEATURE_HTTPD_SETUID
 //config:	bool "Enable -u <user> option"
 //config:	default y
@@ -221,6 +243,18 @@
 //config:	Makes httpd send files using GZIP content encoding if the
 //config:	client supports it and a pre-compressed <file>.gz exists.
 //config:
+//config:config FEATURE_HTTPD_GZIP_CACHE
+//config:	bool "Enable -z DIR option (compress text files on demand)"
+//config:	default y
+//config:	depends on FEATURE_HTTPD_GZIP && PLATFORM_POSIX
+//config:	help
+//config:	With -z DIR, text files (HTML, CSS, JS, JSON, XML, SVG...)
+//config:	without a pre-compressed <file>.gz are gzipped on the first
+//config:	request which accepts gzip encoding. The result is kept
+//config:	as DIR/<file>.gz and sent to later requests until the file's
+//config:	modification time or size changes. Compression is done
+//config:	by running gzip (the applet, if it is enabled).
+//config:
 //config:config FEATURE_HTTPD_ETAG
 //config:	bool "Support caching via ETag header"
 //config:	default y
@@ -275,8 +309,10 @@
 //usage:	IF_NOT_PLATFORM_MINGW32(
 //usage:       " [-M MAXCONN]"
 //usage:	IF_FEATURE_HTTPD_CGI(" [-K KILLSEC]")
+//usage:	IF_FEATURE_HTTPD_EVENT(" [-E NUM]")
 //usage:	)
 //usage:	IF_FEATURE_HTTPD_SETUID(" [-u USER[:GRP]]")
+//usage:	IF_FEATURE_HTTPD_GZIP_CACHE(" [-z DIR]")
 //usage:	IF_FEATURE_HTTPD_BASIC_AUTH(" [-r REALM]")
 //usage:       " [-h HOME]\n"
 //usage:       "or httpd -d/-e" IF_FEATURE_HTTPD_AUTH_MD5("/-m") " STRING"
@@ -292,9 +328,13 @@
 //usage:     "\n	-M NUM		Pause if NUM connections are open (default 256)"
 //usage:	IF_FEATURE_HTTPD_CGI(
 //usage:     "\n	-K NUM		Kill CGIs after NUM seconds")
+//usage:	IF_FEATURE_HTTPD_EVENT(
+//usage:     "\n	-E NUM		Serve files from NUM processes, fork only for CGI etc")
 //usage:	)
 //usage:	IF_FEATURE_HTTPD_SETUID(
 //usage:     "\n	-u USER[:GRP]	Set uid/gid after binding to port")
+//usage:	IF_FEATURE_HTTPD_GZIP_CACHE(
+//usage:     "\n	-z DIR		Keep gzipped copies of text files in DIR")
 //usage:	IF_FEATURE_HTTPD_BASIC_AUTH(
 //usage:     "\n	-r REALM	Authentication Realm for Basic Authentication")
 //usage:     "\n	-h HOME		Home directory (default .)"
@@ -315,6 +355,8 @@
  *   the server will drop the connection (DATA_WRITE_TIMEOUT)
  * - POSTDATA for POST method to CGI must arrive at least once
  *   per DATA_READ_TIMEOUT
+ * - idle persistent connection is closed after KEEPALIVE_TIMEOUT,
+ *   and any one after KEEPALIVE_MAX_REQUESTS requests
  * - killing CGIs which are obviously stuck if -K 60:
  *   "if CGI isn't done in 1 minute, it's fishy. SIGTERM+SIGKILL"
  *
@@ -337,6 +379,8 @@
 #define HEADER_READ_TIMEOUT 30
 #define DATA_WRITE_TIMEOUT  60
 #define DATA_READ_TIMEOUT   60
+#define KEEPALIVE_TIMEOUT   15
+#define KEEPALIVE_MAX_REQUESTS 100
 
 
 #include "libbb.h"
@@ -507,9 +551,22 @@ struct globals {
 	smallint accept_gzip;
 	smallint content_gzip;
 #endif
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+	const char *gzip_cache_dir; /* -z DIR */
+#endif
 #if ENABLE_FEATURE_HTTPD_CGI
 	smallint cgi_output;
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	smallint keep_alive;    /* read next request after this response */
+	unsigned requests_left;
+	jmp_buf next_request;
+	char *urlcopy;          /* of the current request */
+	int file_fd;            /* file being sent, or -1 */
+# if ENABLE_FEATURE_HTTPD_CONFIG_WITH_SCRIPT_INTERPR
+	Htaccess *script_i_conf; /* request handling modifies script_i */
+# endif
+#endif
 #if ENABLE_PLATFORM_MINGW32
 	smallint foreground;
 # if ENABLE_FEATURE_HTTPD_CGI
@@ -541,6 +598,12 @@ struct globals {
 	int children_fd;
 	int conn_limit;
 #endif
+#if ENABLE_FEATURE_HTTPD_EVENT
+	int workers;            /* -E NUM, must be int (used by getopt32) */
+	unsigned ev_cnt;
+	struct ev_conn **ev_conns;
+	struct ev_file **ev_files;
+#endif
 
 	off_t file_size;        /* -1 - unknown */
 #if ENABLE_FEATURE_HTTPD_RANGES
@@ -584,7 +647,13 @@ struct globals {
 #define        hdr_buf bb_common_bufsiz1
 #define sizeof_hdr_buf COMMON_BUFSIZE
 #if ENABLE_FEATURE_HTTPD_ETAG
-#define        etag    bb_common_bufsiz1
+# if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* common buffer may hold next request which was already read */
+	char etag[sizeof("\"%llx-%llx\"") + 2 * sizeof(long long) * 2];
+#  define etag (G.etag)
+# else
+#  define etag bb_common_bufsiz1
+# endif
 #endif
 };
 #define G (*OFFSET_PTR_TO_GLOBALS)
@@ -1175,19 +1244,22 @@ static void log_and_exit(void)
 static void send_EOF_and_exit(void) NORETURN;
 static void send_EOF_and_exit(void)
 {
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* Response is complete, go read the next request */
+	if (G.keep_alive)
+		longjmp(G.next_request, 1);
+#endif
 	/* This makes sure on TCP level, the connection is closed with FIN, not RST */
 	shutdown(STDOUT_FILENO, SHUT_WR);
 	log_and_exit();
 }
 
 /*
- * Create and send HTTP response headers.
- * The arguments are combined and sent as one write operation.  Note that
- * IE will puke big-time if the headers are not sent in one packet and the
- * second packet is delayed for any reason.
+ * Create HTTP response headers in iobuf[], return their length.
+ * Error responses without a custom error_page get a short HTML body.
  * responseNum - the result code to send.
  */
-static void send_headers(unsigned responseNum)
+static unsigned format_headers(unsigned responseNum IF_FEATURE_HTTPD_ERROR_PAGES(, const char *error_page))
 {
 #if ENABLE_FEATURE_HTTPD_DATE || ENABLE_FEATURE_HTTPD_LAST_MODIFIED
 	static const char RFC1123FMT[] ALIGN1 = "%a, %d %b %Y %H:%M:%S GMT";
@@ -1197,9 +1269,6 @@ static void send_headers(unsigned responseNum)
 #endif
 	const char *responseString = "";
 	const char *infoString = NULL;
-#if ENABLE_FEATURE_HTTPD_ERROR_PAGES
-	const char *error_page = NULL;
-#endif
 	unsigned len;
 	unsigned i;
 
@@ -1207,9 +1276,6 @@ static void send_headers(unsigned responseNum)
 		if (http_response_type[i] == responseNum) {
 			responseString = http_response[i].name;
 			infoString = http_response[i].info;
-#if ENABLE_FEATURE_HTTPD_ERROR_PAGES
-			error_page = http_error_page[i];
-#endif
 			break;
 		}
 	}
@@ -1217,6 +1283,12 @@ static void send_headers(unsigned responseNum)
 	if (verbose)
 		bb_error_msg("response:%u", responseNum);
 
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* Error messages have no Content-Length: end them by closing */
+	if (infoString IF_FEATURE_HTTPD_ERROR_PAGES(|| error_page))
+		G.keep_alive = 0;
+#endif
+
 	/* We use sprintf, not snprintf (it's less code).
 	 * iobuf[] is several kbytes long and all headers we generate
 	 * always fit into those kbytes.
@@ -1233,10 +1305,15 @@ static void send_headers(unsigned responseNum)
 #if ENABLE_FEATURE_HTTPD_DATE
 			"Date: %s\r\n"
 #endif
-			"Connection: close\r\n",
+			"Connection: %s\r\n",
 			responseNum, responseString
 #if ENABLE_FEATURE_HTTPD_DATE
 			, date_str
+#endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+			, G.keep_alive ? "keep-alive" : "close"
+#else
+			, "close"
 #endif
 		);
 	}
@@ -1276,17 +1353,8 @@ static void send_headers(unsigned responseNum)
 	}
 
 #if ENABLE_FEATURE_HTTPD_ERROR_PAGES
-	if (error_page && access(error_page, R_OK) == 0) {
-		iobuf[len++] = '\r';
-		iobuf[len++] = '\n';
-		if (DEBUG) {
-			iobuf[len] = '\0';
-			fprintf(stderr, "headers: '%s'\n", iobuf);
-		}
-		full_write(STDOUT_FILENO, iobuf, len);
-		dbg("writing error page: '%s'\n", error_page);
-		return send_file_and_exit(error_page, SEND_BODY);
-	}
+	if (error_page) /* page itself will follow */
+		goto end_headers;
 #endif
 
 	if (file_size != -1) {    /* file */
@@ -1372,10 +1440,18 @@ static void send_headers(unsigned responseNum)
 	 */
 	if (content_gzip)
 		len += sprintf(iobuf + len, "Content-Encoding: gzip\r\n");
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* "302 Found" has no body. Say so, or client waits for EOF */
+	else if (G.keep_alive && file_size == -1 && responseNum != HTTP_NOT_MODIFIED)
+		len += sprintf(iobuf + len, "Content-Length: 0\r\n");
+#endif
 
+#if ENABLE_FEATURE_HTTPD_ERROR_PAGES
+ end_headers:
+#endif
 	iobuf[len++] = '\r';
 	iobuf[len++] = '\n';
-	if (infoString) {
+	if (infoString IF_FEATURE_HTTPD_ERROR_PAGES(&& !error_page)) {
 		len += sprintf(iobuf + len,
 				"<HTML><HEAD><TITLE>%u %s</TITLE></HEAD>\n"
 				"<BODY><H1>%u %s</H1>\n"
@@ -1390,11 +1466,44 @@ static void send_headers(unsigned responseNum)
 		iobuf[len] = '\0';
 		fprintf(stderr, "headers: '%s'\n", iobuf);
 	}
+	return len;
+}
+
+/*
+ * Create and send HTTP response headers.
+ * The arguments are combined and sent as one write operation.  Note that
+ * IE will puke big-time if the headers are not sent in one packet and the
+ * second packet is delayed for any reason.
+ */
+static void send_headers(unsigned responseNum)
+{
+	unsigned len;
+#if ENABLE_FEATURE_HTTPD_ERROR_PAGES
+	const char *error_page = NULL;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(http_response_type); i++) {
+		if (http_response_type[i] == responseNum) {
+			error_page = http_error_page[i];
+			break;
+		}
+	}
+	if (error_page && access(error_page, R_OK) != 0)
+		error_page = NULL;
+#endif
+	len = format_headers(responseNum IF_FEATURE_HTTPD_ERROR_PAGES(, error_page));
+
 	if (full_write(STDOUT_FILENO, iobuf, len) != len) {
 		if (VERBOSE_1)
 			bb_simple_perror_msg("write error");
 		log_and_exit();
 	}
+#if ENABLE_FEATURE_HTTPD_ERROR_PAGES
+	if (error_page) {
+		dbg("writing error page: '%s'\n", error_page);
+		send_file_and_exit(error_page, SEND_BODY);
+	}
+#endif
 }
 
 static void send_headers_and_exit(int responseNum) NORETURN;
@@ -1779,6 +1888,11 @@ static void send_cgi_and_exit(
 	char **argv;
 #endif
 
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* CGI output has no Content-Length we know of: end it by closing */
+	G.keep_alive = 0;
+#endif
+
 	/* Make a copy. NB: caller guarantees:
 	 * url[0] == '/', url[1] != '/' */
 	url = xstrdup(url);
@@ -1998,64 +2112,11 @@ static void send_cgi_and_exit(
 #endif          /* FEATURE_HTTPD_CGI */
 
 /*
- * Send a file response to a HTTP request, and exit
- *
- * Parameters:
- * const char *url  The requested URL (with leading /).
- * what             What to send (headers/body/both).
+ * Set found_mime_type by url's suffix: built-in table, then config's.
  */
-static NOINLINE void send_file_and_exit(const char *url, int what)
+static void find_mime_type(const char *url)
 {
-	const char *suffix;
-	int fd;
-	ssize_t count;
-
-#if ENABLE_FEATURE_HTTPD_GZIP
-	if (accept_gzip) {
-		/* does <url>.gz exist? Then use it instead */
-		char *gzurl = xasprintf("%s.gz", url);
-		fd = open(gzurl, O_RDONLY);
-		free(gzurl);
-		if (fd != -1) {
-			struct stat sb;
-			fstat(fd, &sb);
-			file_size = sb.st_size;
-			last_mod = sb.st_mtime;
-			content_gzip = 1;
-		} else {
-			fd = open(url, O_RDONLY);
-		}
-	} else
-#endif
-	{
-		fd = open(url, O_RDONLY);
-		/* file_size and last_mod are already populated */
-	}
-	if (fd < 0) {
-		dbg("can't open '%s'\n", url);
-		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
-		 * IOW: it is unsafe to call send_headers_and_exit
-		 * if "what" is SEND_BODY! Can recurse! */
-		if (what != SEND_BODY)
-			send_headers_and_exit(HTTP_NOT_FOUND);
-		send_EOF_and_exit();
-	}
-#if ENABLE_FEATURE_HTTPD_ETAG
-	/* ETag is "hex(last_mod)-hex(file_size)" e.g. "5e132e20-417" */
-	sprintf(etag, "\"%"LL_FMT"x-%"LL_FMT"x\"", (unsigned long long)last_mod, (unsigned long long)file_size);
-
-	if (G.if_none_match) {
-		dbg("If-None-Match:'%s' file's ETag:'%s'\n", G.if_none_match, etag);
-		/* Weak ETag comparision.
-		 * If-None-Match may have many ETags but they are quoted so we can use simple substring search */
-		if (strstr(G.if_none_match, etag))
-			send_headers_and_exit(HTTP_NOT_MODIFIED);
-	}
-#endif
-
-	/* If not found, default is to not send "Content-type:" */
-	/*found_mime_type = NULL; - already is */
-	suffix = strrchr(url, '.');
+	const char *suffix = strrchr(url, '.');
 	if (suffix) {
 		static const char suffixTable[] ALIGN1 =
 			/* Shorter suffix must be first:
@@ -2117,6 +2178,205 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 			}
 		}
 	}
+}
+
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+/* Smaller files gain too little from compression */
+#define GZIP_CACHE_MIN_SIZE 1024
+
+/* Is file of found_mime_type worth compressing? */
+static int is_compressible(void)
+{
+	const char *m = found_mime_type;
+
+	return m && (is_prefixed_with(m, "text/")
+		|| strstr(m, "javascript")
+		|| strstr(m, "json")
+		|| strstr(m, "xml") /* also catches "image/svg+xml" */
+	);
+}
+
+/* Gzip src_fd into cache file name. Returns it opened for reading, or -1 */
+static int gzip_to_cache(const char *name, int src_fd, const struct timespec *mtim)
+{
+	void (*old_handler)(int);
+	struct timespec ts[2];
+	char *tmp, *slash;
+	pid_t pid;
+	int fd, r;
+
+	/* Other processes may compress it too: do it in a temp file, then rename */
+	tmp = xasprintf("%s.%u", name, (unsigned)getpid());
+	slash = strrchr(tmp, '/');
+	*slash = '\0';
+	bb_make_directory(tmp, -1, FILEUTILS_RECUR);
+	*slash = '/';
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		goto ret;
+
+	/* We need gzip's exit status, SIG_IGN would reap it */
+	old_handler = signal(SIGCHLD, SIG_DFL);
+	pid = xvfork();
+	if (pid == 0) {
+		/* child */
+		xmove_fd(src_fd, 0);
+		xmove_fd(fd, 1);
+		BB_EXECLP("gzip", "gzip", (char *)0);
+		_exit_FAILURE();
+	}
+	r = wait4pid(pid);
+	signal(SIGCHLD, old_handler);
+	close(fd);
+	fd = -1;
+	/* gzip read it to EOF: if we fail, caller sends it uncompressed */
+	lseek(src_fd, 0, SEEK_SET);
+
+	/* Cached copy has file's mtime (to the nanosecond):
+	 * this is how we know it's still valid */
+	ts[0] = ts[1] = *mtim;
+	if (r != 0
+	 || utimensat(AT_FDCWD, tmp, ts, 0) != 0
+	 || rename(tmp, name) != 0
+	) {
+		unlink(tmp);
+		goto ret;
+	}
+	fd = open(name, O_RDONLY);
+ ret:
+	free(tmp);
+	return fd;
+}
+
+/*
+ * Open url's gzipped copy in -z DIR if it is up to date.
+ * If not, and src_fd >= 0, create it from src_fd first.
+ * Returns -1 if there is no usable copy.
+ */
+static int open_gzip_cache(const char *url, const struct timespec *mtim, off_t size, int src_fd)
+{
+	struct stat sb;
+	uint32_t isize;
+	char *name;
+	int fd;
+
+	/* Not xasprintf: the -E event loop calls us too */
+	name = malloc(strlen(G.gzip_cache_dir) + strlen(url) + sizeof("/.gz"));
+	if (!name)
+		return -1;
+	sprintf(name, "%s/%s.gz", G.gzip_cache_dir, url);
+	fd = open(name, O_RDONLY);
+	if (fd >= 0) {
+		/* Same mtime, and same size (gzip trailer ends with it)?
+		 * Seconds alone would miss a rewrite within the same second
+		 */
+		if (fstat(fd, &sb) == 0
+		 && sb.st_mtim.tv_sec == mtim->tv_sec
+		 && sb.st_mtim.tv_nsec == mtim->tv_nsec
+		 && pread(fd, &isize, 4, sb.st_size - 4) == 4
+		 && SWAP_LE32(isize) == (uint32_t)size
+		) {
+			goto ret;
+		}
+		close(fd);
+		fd = -1;
+	}
+	if (src_fd >= 0)
+		fd = gzip_to_cache(name, src_fd, mtim);
+ ret:
+	free(name);
+	return fd;
+}
+#endif
+
+/*
+ * Send a file response to a HTTP request, and exit
+ *
+ * Parameters:
+ * const char *url  The requested URL (with leading /).
+ * what             What to send (headers/body/both).
+ */
+static NOINLINE void send_file_and_exit(const char *url, int what)
+{
+	int fd;
+	ssize_t count;
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	off_t sent = 0;
+	off_t body_len;
+#endif
+
+#if ENABLE_FEATURE_HTTPD_GZIP
+	if (accept_gzip) {
+		/* does <url>.gz exist? Then use it instead */
+		char *gzurl = xasprintf("%s.gz", url);
+		fd = open(gzurl, O_RDONLY);
+		free(gzurl);
+		if (fd != -1) {
+			struct stat sb;
+			fstat(fd, &sb);
+			file_size = sb.st_size;
+			last_mod = sb.st_mtime;
+			content_gzip = 1;
+		} else {
+			fd = open(url, O_RDONLY);
+# if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+			/* (ranges and gzip don't mix, prefer ranges) */
+			if (fd >= 0 && G.gzip_cache_dir && range_start < 0
+			 && (what & SEND_HEADERS) /* not for error pages */
+			 && file_size >= GZIP_CACHE_MIN_SIZE
+			) {
+				struct stat sb;
+
+				find_mime_type(url);
+				if (is_compressible() && fstat(fd, &sb) == 0) {
+					int gz_fd = open_gzip_cache(url, &sb.st_mtim, sb.st_size, fd);
+					if (gz_fd >= 0) {
+						close(fd);
+						fd = gz_fd;
+						fstat(fd, &sb);
+						file_size = sb.st_size;
+						content_gzip = 1;
+					}
+				}
+			}
+# endif
+		}
+	} else
+#endif
+	{
+		fd = open(url, O_RDONLY);
+		/* file_size and last_mod are already populated */
+	}
+	if (fd < 0) {
+		dbg("can't open '%s'\n", url);
+		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
+		 * IOW: it is unsafe to call send_headers_and_exit
+		 * if "what" is SEND_BODY! Can recurse! */
+		if (what != SEND_BODY)
+			send_headers_and_exit(HTTP_NOT_FOUND);
+		send_EOF_and_exit();
+	}
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* Closed before the next request on this connection */
+	G.file_fd = fd;
+	body_len = file_size;
+#endif
+#if ENABLE_FEATURE_HTTPD_ETAG
+	/* ETag is "hex(last_mod)-hex(file_size)" e.g. "5e132e20-417" */
+	sprintf(etag, "\"%"LL_FMT"x-%"LL_FMT"x\"", (unsigned long long)last_mod, (unsigned long long)file_size);
+
+	if (G.if_none_match) {
+		dbg("If-None-Match:'%s' file's ETag:'%s'\n", G.if_none_match, etag);
+		/* Weak ETag comparision.
+		 * If-None-Match may have many ETags but they are quoted so we can use simple substring search */
+		if (strstr(G.if_none_match, etag))
+			send_headers_and_exit(HTTP_NOT_MODIFIED);
+	}
+#endif
+
+	/* If not found, default is to not send "Content-type:" */
+	/*found_mime_type = NULL; - already is */
+	find_mime_type(url);
 
 	dbg("sending file '%s' content-type:%s\n", url, found_mime_type);
 
@@ -2138,6 +2398,7 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 			range_start = -1;
 		} else {
 			range_len = range_end - range_start + 1;
+			IF_FEATURE_HTTPD_KEEPALIVE(body_len = range_len;)
 			send_headers(HTTP_PARTIAL_CONTENT);
 			what = SEND_BODY;
 		}
@@ -2145,6 +2406,8 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 #endif
 	if (what & SEND_HEADERS)
 		send_headers(HTTP_OK);
+	if (!(what & SEND_BODY)) /* HEAD */
+		send_EOF_and_exit();
 
 	/* Sending BODY */
 #if ENABLE_FEATURE_USE_SENDFILE
@@ -2175,8 +2438,9 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 				log_and_exit();
 			}
 			IF_FEATURE_HTTPD_RANGES(range_len -= count;)
+			IF_FEATURE_HTTPD_KEEPALIVE(sent += count;)
 			if (count == 0 || range_len == 0)
-				send_EOF_and_exit();
+				goto done;
 		}
 	}
 #endif
@@ -2194,6 +2458,7 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 			break;
 		}
 		IF_FEATURE_HTTPD_RANGES(range_len -= count;)
+		IF_FEATURE_HTTPD_KEEPALIVE(sent += count;)
 		if (range_len == 0)
 			break;
 	}
@@ -2201,11 +2466,46 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 		if (VERBOSE_1)
 			bb_simple_perror_msg("read error");
 	}
+#if ENABLE_FEATURE_USE_SENDFILE
+ done:
+#endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* File shrank while we were sending it? Client waits for the rest */
+	if (sent != body_len)
+		G.keep_alive = 0;
+#endif
 	send_EOF_and_exit();
 }
 
 #if ENABLE_FEATURE_HTTPD_ACL_IP
-static void if_ip_denied_send_HTTP_FORBIDDEN_and_exit(unsigned remote_ip)
+static unsigned get_remote_ip(const len_and_sockaddr *fromAddr)
+{
+	unsigned remote_ip = 0;
+
+	if (fromAddr->u.sa.sa_family == AF_INET) {
+		remote_ip = ntohl(fromAddr->u.sin.sin_addr.s_addr);
+	}
+# if ENABLE_FEATURE_IPV6
+#  if !ENABLE_PLATFORM_MINGW32
+	if (fromAddr->u.sa.sa_family == AF_INET6
+	 && fromAddr->u.sin6.sin6_addr.s6_addr32[0] == 0
+	 && fromAddr->u.sin6.sin6_addr.s6_addr32[1] == 0
+	 && ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[2]) == 0xffff)
+		remote_ip = ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[3]);
+#  else
+	if (fromAddr->u.sa.sa_family == AF_INET6
+	 && fromAddr->u.sin6.sin6_addr.s6_words[0] == 0
+	 && fromAddr->u.sin6.sin6_addr.s6_words[1] == 0
+	 && fromAddr->u.sin6.sin6_addr.s6_words[2] == 0
+	 && fromAddr->u.sin6.sin6_addr.s6_words[3] == 0
+	 && ntohl(*(uint32_t *)(fromAddr->u.sin6.sin6_addr.s6_words+4)) == 0xffff)
+		remote_ip = ntohl(*(uint32_t *)(fromAddr->u.sin6.sin6_addr.s6_words+6));
+#  endif
+# endif
+	return remote_ip;
+}
+
+static int ip_denied(unsigned remote_ip)
 {
 	Htaccess_IP *cur;
 
@@ -2221,14 +2521,16 @@ static void if_ip_denied_send_HTTP_FORBIDDEN_and_exit(unsigned remote_ip)
 			(unsigned char)(cur->mask >> 8),
 			(unsigned char)(cur->mask)
 		);
-		if ((remote_ip & cur->mask) == cur->ip) {
-			if (cur->allow_deny == 'A')
-				return;
-			send_headers_and_exit(HTTP_FORBIDDEN);
-		}
+		if ((remote_ip & cur->mask) == cur->ip)
+			return (cur->allow_deny != 'A');
 	}
 
-	if (flg_deny_all) /* depends on whether we saw "D:*" */
+	return flg_deny_all; /* depends on whether we saw "D:*" */
+}
+
+static void if_ip_denied_send_HTTP_FORBIDDEN_and_exit(unsigned remote_ip)
+{
+	if (ip_denied(remote_ip))
 		send_headers_and_exit(HTTP_FORBIDDEN);
 }
 #else
@@ -2295,14 +2597,43 @@ static int pam_talker(int num_msg,
  *
  * Returns 1 if user_and_passwd is OK.
  */
-static int check_user_passwd(const char *path, char *user_and_passwd)
+/* Is path in the directory dir_prefix of an auth rule? */
+static int auth_dir_matches(const char *dir_prefix, const char *path)
 {
-	Htaccess *cur;
-	const char *prev = NULL;
+	size_t len = strlen(dir_prefix);
 
-	for (cur = g_auth; cur; cur = cur->next) {
+	if (len == 1) /* dir_prefix "/" matches all, don't need to check */
+		return 1;
+#if !ENABLE_PLATFORM_MINGW32
+	if (strncmp(dir_prefix, path, len) != 0)
+#else
+	if (strncasecmp(dir_prefix, path, len) != 0)
+#endif
+		return 0;
+	return (path[len] == '/' || path[len] == '\0');
+}
+
+#if ENABLE_FEATURE_HTTPD_EVENT
+/* Does path need a password? Does not allocate, for the event loop */
+static int auth_required(const char *path)
+{
+	Htaccess *cur;
+
+	for (cur = g_auth; cur; cur = cur->next) {
+		if (auth_dir_matches(cur->before_colon, path))
+			return 1;
+	}
+	return 0;
+}
+#endif
+
+static int check_user_passwd(const char *path, char *user_and_passwd)
+{
+	Htaccess *cur;
+	const char *prev = NULL;
+
+	for (cur = g_auth; cur; cur = cur->next) {
 		const char *dir_prefix;
-		size_t len;
 		int r;
 
 		dir_prefix = cur->before_colon;
@@ -2319,18 +2650,8 @@ static int check_user_passwd(const char *path, char *user_and_passwd)
 		dbg("checkPerm: '%s' ? '%s'\n", dir_prefix, user_and_passwd);
 
 		/* If it's not a prefix match, continue searching */
-		len = strlen(dir_prefix);
-		if (len != 1 /* dir_prefix "/" matches all, don't need to check */
-#if !ENABLE_PLATFORM_MINGW32
-		 && (strncmp(dir_prefix, path, len) != 0
-#else
-		 && (strncasecmp(dir_prefix, path, len) != 0
-#endif
-		    || (path[len] != '/' && path[len] != '\0')
-		    )
-		) {
+		if (!auth_dir_matches(dir_prefix, path))
 			continue;
-		}
 
 		/* Path match found */
 		prev = dir_prefix;
@@ -2467,6 +2788,50 @@ static Htaccess_Proxy *find_proxy_entry(const char *url)
 }
 #endif
 
+/*
+ * Canonicalize decoded URL path in place.
+ * Algorithm stolen from libbb bb_simplify_path(),
+ * but don't strdup, retain trailing slash, protect root.
+ * Returns pointer to the terminating NUL, or NULL if ".." goes above root.
+ */
+static char *canonicalize_url(char *urlcopy)
+{
+	char *urlp, *tptr;
+
+	urlp = tptr = urlcopy;
+	while (1) {
+		if (*urlp == '/') {
+			/* skip duplicate (or initial) slash */
+			if (*tptr == '/') {
+				goto next_char;
+			}
+			if (*tptr == '.') {
+				if (tptr[1] == '.' && (tptr[2] == '/' || tptr[2] == '\0')) {
+					/* "..": be careful */
+					/* protect root */
+					if (urlp == urlcopy)
+						return NULL;
+					/* omit previous dir */
+					while (*--urlp != '/')
+						continue;
+					/* skip to "./" or ".<NUL>" */
+					tptr++;
+				}
+				if (tptr[1] == '/' || tptr[1] == '\0') {
+					/* skip extra "/./" */
+					goto next_char;
+				}
+			}
+		}
+		*++urlp = *tptr;
+		if (*tptr == '\0')
+			break;
+ next_char:
+		tptr++;
+	}
+	return urlp;
+}
+
 /*
  * Handle timeouts
  */
@@ -2514,16 +2879,13 @@ static void prepare_write_timeout(void)
 /*
  * Handle an incoming http request and exit.
  */
-static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr) NORETURN;
-static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
+static void handle_request_and_exit(IF_FEATURE_HTTPD_ACL_IP(unsigned remote_ip) IF_NOT_FEATURE_HTTPD_ACL_IP(void)) NORETURN;
+static void handle_request_and_exit(IF_FEATURE_HTTPD_ACL_IP(unsigned remote_ip) IF_NOT_FEATURE_HTTPD_ACL_IP(void))
 {
 	struct stat sb;
 	char *urlcopy;
 	char *urlp;
 	char *tptr;
-#if ENABLE_FEATURE_HTTPD_ACL_IP
-	unsigned remote_ip;
-#endif
 #if ENABLE_FEATURE_HTTPD_CGI
 	unsigned total_headers_len;
 	unsigned un;
@@ -2548,42 +2910,6 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 	char *HTTP_slash;
 
-	if (ENABLE_FEATURE_HTTPD_CGI || DEBUG || verbose) {
-		/* NB: can be NULL (user runs httpd -i by hand?) */
-		rmt_ip_str = xmalloc_sockaddr2dotted(&fromAddr->u.sa);
-	}
-	if (verbose) {
-		/* this trick makes -v logging much simpler */
-		if (rmt_ip_str)
-			applet_name = rmt_ip_str;
-		if (VERBOSE_3)
-			bb_simple_error_msg("connected");
-	}
-#if ENABLE_FEATURE_HTTPD_ACL_IP
-	remote_ip = 0;
-	if (fromAddr->u.sa.sa_family == AF_INET) {
-		remote_ip = ntohl(fromAddr->u.sin.sin_addr.s_addr);
-	}
-# if ENABLE_FEATURE_IPV6
-#  if !ENABLE_PLATFORM_MINGW32
-	if (fromAddr->u.sa.sa_family == AF_INET6
-	 && fromAddr->u.sin6.sin6_addr.s6_addr32[0] == 0
-	 && fromAddr->u.sin6.sin6_addr.s6_addr32[1] == 0
-	 && ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[2]) == 0xffff)
-		remote_ip = ntohl(fromAddr->u.sin6.sin6_addr.s6_addr32[3]);
-#  else
-	if (fromAddr->u.sa.sa_family == AF_INET6
-	 && fromAddr->u.sin6.sin6_addr.s6_words[0] == 0
-	 && fromAddr->u.sin6.sin6_addr.s6_words[1] == 0
-	 && fromAddr->u.sin6.sin6_addr.s6_words[2] == 0
-	 && fromAddr->u.sin6.sin6_addr.s6_words[3] == 0
-	 && ntohl(*(uint32_t *)(fromAddr->u.sin6.sin6_addr.s6_words+4)) == 0xffff)
-		remote_ip = ntohl(*(uint32_t *)(fromAddr->u.sin6.sin6_addr.s6_words+6));
-#  endif
-# endif
-	if_ip_denied_send_HTTP_FORBIDDEN_and_exit(remote_ip);
-#endif
-
 #if !ENABLE_PLATFORM_MINGW32
 	/* Limit how long we expect clients to be sending headers */
 	alarm(HEADER_READ_TIMEOUT);
@@ -2620,6 +2946,10 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	if (!HTTP_slash || strncmp(HTTP_slash + 1, HTTP_200, 5) != 0)
 		send_headers_and_exit(HTTP_BAD_REQUEST);
 	*HTTP_slash++ = '\0';
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* HTTP/1.1 connections are persistent unless client says otherwise */
+	G.keep_alive = (strcmp(HTTP_slash, "HTTP/1.1") >= 0);
+#endif
 
 #if ENABLE_FEATURE_HTTPD_PROXY
 	proxy_entry = find_proxy_entry(urlp);
@@ -2629,6 +2959,10 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 
 		if (VERBOSE_2)
 			bb_error_msg("proxy:%s", urlp);
+# if ENABLE_FEATURE_HTTPD_KEEPALIVE
+		/* Response is relayed until backend closes, then we close too */
+		G.keep_alive = 0;
+# endif
 		lsa = host2sockaddr(proxy_entry->host_port, 80);
 		if (!lsa)
 			send_headers_and_exit(HTTP_INTERNAL_SERVER_ERROR);
@@ -2683,8 +3017,9 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		send_headers_and_exit(HTTP_BAD_REQUEST);
 #endif
  found:
-	/* Copy URL to stack-allocated char[] */
-	urlcopy = alloca((HTTP_slash - urlp) + 2 + strlen(index_page));
+	/* Copy URL. With keep-alive, freed when the next request starts */
+	urlcopy = xmalloc((HTTP_slash - urlp) + 2 + strlen(index_page));
+	IF_FEATURE_HTTPD_KEEPALIVE(G.urlcopy = urlcopy;)
 	strcpy(urlcopy, urlp);
 	/* NB: urlcopy ptr is never changed after this */
 
@@ -2702,40 +3037,9 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		send_headers_and_exit(HTTP_NOT_FOUND);
 	}
 
-	/* Canonicalize path */
-	/* Algorithm stolen from libbb bb_simplify_path(),
-	 * but don't strdup, retain trailing slash, protect root */
-	urlp = tptr = urlcopy;
-	while (1) {
-		if (*urlp == '/') {
-			/* skip duplicate (or initial) slash */
-			if (*tptr == '/') {
-				goto next_char;
-			}
-			if (*tptr == '.') {
-				if (tptr[1] == '.' && (tptr[2] == '/' || tptr[2] == '\0')) {
-					/* "..": be careful */
-					/* protect root */
-					if (urlp == urlcopy)
-						send_headers_and_exit(HTTP_BAD_REQUEST);
-					/* omit previous dir */
-					while (*--urlp != '/')
-						continue;
-					/* skip to "./" or ".<NUL>" */
-					tptr++;
-				}
-				if (tptr[1] == '/' || tptr[1] == '\0') {
-					/* skip extra "/./" */
-					goto next_char;
-				}
-			}
-		}
-		*++urlp = *tptr;
-		if (*tptr == '\0')
-			break;
- next_char:
-		tptr++;
-	}
+	urlp = canonicalize_url(urlcopy);
+	if (!urlp)
+		send_headers_and_exit(HTTP_BAD_REQUEST);
 
 	/* Log it */
 	if (VERBOSE_2)
@@ -2746,8 +3050,13 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		/* have path1/path2 */
 		*tptr = '\0';
 		/* may have subdir config */
-		if (parse_conf(urlcopy + 1, SUBDIR_PARSE) == 0)
+		if (parse_conf(urlcopy + 1, SUBDIR_PARSE) == 0) {
 			if_ip_denied_send_HTTP_FORBIDDEN_and_exit(remote_ip);
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+			/* Subdir config stays merged, next request must not see it */
+			G.requests_left = 1;
+#endif
+		}
 		*tptr = '/';
 	}
 
@@ -2905,6 +3214,21 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 			continue;
 		}
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+		if (STRNCASECMP(iobuf, "Connection:") == 0) {
+			tptr = skip_whitespace(iobuf + sizeof("Connection:") - 1);
+			if (STRNCASECMP(tptr, "close") == 0)
+				G.keep_alive = 0;
+			if (STRNCASECMP(tptr, "keep-alive") == 0)
+				G.keep_alive = 1;
+		}
+		/* Request has a body we won't read: can't find next request */
+		if (STRNCASECMP(iobuf, "Content-Length:") == 0
+		 || STRNCASECMP(iobuf, "Transfer-Encoding:") == 0
+		) {
+			G.requests_left = 1;
+		}
+#endif
 #if ENABLE_FEATURE_HTTPD_ETAG
 		if (STRNCASECMP(iobuf, "If-None-Match:") == 0) {
 			free(G.if_none_match);
@@ -2944,6 +3268,10 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 
 	/* We are done reading headers, disable header timeout */
 	prepare_write_timeout();
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	if (--G.requests_left == 0)
+		G.keep_alive = 0;
+#endif
 
 #if !ENABLE_PLATFORM_MINGW32
 	if (strcmp(bb_basename(urlcopy), HTTPD_CONF) == 0) {
@@ -2995,6 +3323,80 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	);
 }
 
+/*
+ * Handle an incoming http connection and exit.
+ */
+static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr) NORETURN;
+static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
+{
+#if ENABLE_FEATURE_HTTPD_ACL_IP
+	unsigned remote_ip;
+#endif
+
+	if (ENABLE_FEATURE_HTTPD_CGI || DEBUG || verbose) {
+		/* NB: can be NULL (user runs httpd -i by hand?) */
+		rmt_ip_str = xmalloc_sockaddr2dotted(&fromAddr->u.sa);
+	}
+	if (verbose) {
+		/* this trick makes -v logging much simpler */
+		if (rmt_ip_str)
+			applet_name = rmt_ip_str;
+		if (VERBOSE_3)
+			bb_simple_error_msg("connected");
+	}
+#if ENABLE_FEATURE_HTTPD_ACL_IP
+	remote_ip = get_remote_ip(fromAddr);
+	if_ip_denied_send_HTTP_FORBIDDEN_and_exit(remote_ip);
+#endif
+
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	G.requests_left = KEEPALIVE_MAX_REQUESTS;
+	G.file_fd = -1;
+	IF_FEATURE_HTTPD_CONFIG_WITH_SCRIPT_INTERPR(G.script_i_conf = script_i;)
+	if (setjmp(G.next_request) != 0) {
+		/* We sent a complete response, and client did not ask to close */
+		found_mime_type = NULL;
+		found_moved_temporarily = NULL;
+		free(G.urlcopy);
+		G.urlcopy = NULL;
+		if (G.file_fd >= 0) {
+			close(G.file_fd);
+			G.file_fd = -1;
+		}
+		g_query = NULL;
+		file_size = -1;
+		IF_FEATURE_HTTPD_RANGES(range_start = -1;)
+		IF_FEATURE_HTTPD_RANGES(range_end = 0;)
+		IF_FEATURE_HTTPD_GZIP(accept_gzip = 0;)
+		IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
+# if ENABLE_FEATURE_HTTPD_ETAG
+		free(G.if_none_match);
+		G.if_none_match = NULL;
+# endif
+# if ENABLE_FEATURE_HTTPD_BASIC_AUTH
+		free(remoteuser);
+		remoteuser = NULL;
+# endif
+		IF_FEATURE_HTTPD_CONFIG_WITH_SCRIPT_INTERPR(script_i = G.script_i_conf;)
+		G.keep_alive = 0;
+
+		/* Wait for the next request, unless it's already buffered */
+		if (hdr_cnt <= 0) {
+			struct pollfd pfd;
+
+			pfd.fd = STDIN_FILENO;
+			pfd.events = POLLIN;
+			if (safe_poll(&pfd, 1, KEEPALIVE_TIMEOUT * 1000) <= 0) {
+				if (VERBOSE_3)
+					bb_simple_error_msg("idle, closing");
+				send_EOF_and_exit();
+			}
+		}
+	}
+#endif
+	handle_request_and_exit(IF_FEATURE_HTTPD_ACL_IP(remote_ip));
+}
+
 #if !ENABLE_PLATFORM_MINGW32
 static int count_children(void)
 {
@@ -3048,6 +3450,667 @@ static int throttle_if_conn_limit(void)
 }
 #endif
 
+#if ENABLE_FEATURE_HTTPD_EVENT
+/* Connection handled by the poll() loop of "httpd -E" */
+/*
+ * What we found out about an url: its open file, or that we can't send it.
+ * Kept for the next requests, trusted for EV_FILE_VALID seconds.
+ */
+#define EV_FILE_CACHE_SIZE 32
+#define EV_FILE_VALID      1
+typedef struct ev_file {
+	char *url;              /* canonical, as requested */
+	char *path;             /* relative to home, index_page appended */
+	int fd;                 /* -1: child must handle requests for it */
+	unsigned refs;          /* cache table and connections sending it */
+	unsigned expires;       /* monotonic_sec() when we look at it again */
+	unsigned used;          /* for LRU eviction */
+	const char *mime;       /* found_mime_type */
+	off_t size;
+	struct timespec mtim;
+#if ENABLE_FEATURE_HTTPD_GZIP
+	smallint has_gz;        /* <path>.gz exists, child sends it */
+#endif
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+	smallint gz_cacheable;  /* copy in -z DIR can be made */
+	int gz_fd;              /* up to date copy in -z DIR, or -1 */
+	off_t gz_size;
+#endif
+} ev_file;
+
+typedef struct ev_conn {
+	int fd;
+	int file_fd;            /* file we are sending, or -1 */
+	ev_file *file;          /* file_fd belongs to it */
+	char *out;              /* response headers we are sending, or NULL */
+	unsigned out_pos;
+	unsigned out_len;
+	off_t offset;           /* not yet sent part of the file */
+	off_t left;
+	unsigned deadline;      /* monotonic_sec() when we give up on it */
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	unsigned requests_left;
+	smallint keep_alive;
+#endif
+	char *ip_str;           /* for -v logging */
+	len_and_sockaddr peer;
+	unsigned in_len;        /* request bytes in buf[] */
+	char buf[1];            /* really sizeof_hdr_buf, must be last */
+} ev_conn;
+
+static void ev_file_put(ev_file *f)
+{
+	if (--f->refs != 0)
+		return;
+	if (f->fd >= 0)
+		close(f->fd);
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+	if (f->gz_fd >= 0)
+		close(f->gz_fd);
+#endif
+	free(f->url);
+	free(f->path);
+	free(f);
+}
+
+/* Config is reread: its mime types and auth rules may be gone */
+static void ev_file_flush(void)
+{
+	unsigned i;
+
+	for (i = 0; i < EV_FILE_CACHE_SIZE; i++) {
+		if (G.ev_files[i]) {
+			ev_file_put(G.ev_files[i]);
+			G.ev_files[i] = NULL;
+		}
+	}
+}
+
+/*
+ * Can url be sent from the event loop? Then open it.
+ * Whatever is not simple (subdir config, auth, scripts...), the child does.
+ */
+static ev_file *ev_file_new(const char *url)
+{
+	struct stat sb;
+	ev_file *f;
+	char *path, *tptr, *buf;
+
+	/* Nothing here may die on transient out-of-memory (no xmalloc &co),
+	 * if something can't be allocated the child serves the url */
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->url = strdup(url);
+	f->path = path = malloc(strlen(url) + strlen(index_page));
+	if (!f->url || !path) {
+		free(path);
+		free(f->url);
+		free(f);
+		return NULL;
+	}
+	strcpy(stpcpy(path, url + 1), last_char_is(url, '/') ? index_page : "");
+	f->refs = 1;
+	f->fd = -1;
+	IF_FEATURE_HTTPD_GZIP_CACHE(f->gz_fd = -1;)
+	/* For "DIR/httpd.conf" and "FILE.gz" */
+	buf = malloc(strlen(path) + sizeof(HTTPD_CONF) + 1);
+	if (!buf)
+		return f;
+
+	/* Subdir config is merged only by forked child, see it there */
+	tptr = path;
+	while ((tptr = strchr(tptr, '/')) != NULL) {
+		tptr++;
+		strcpy(mempcpy(buf, path, tptr - path), HTTPD_CONF);
+		if (access(buf, F_OK) == 0)
+			goto ret;
+	}
+	if (is_prefixed_with(path, "cgi-bin/")
+	 || strcmp(bb_basename(path), HTTPD_CONF) == 0
+	) {
+		goto ret;
+	}
+#if ENABLE_FEATURE_HTTPD_BASIC_AUTH
+	/* Does the page require passwd? */
+	if (auth_required(url))
+		goto ret;
+#endif
+	if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode))
+		goto ret;
+#if ENABLE_FEATURE_HTTPD_CONFIG_WITH_SCRIPT_INTERPR
+	tptr = strrchr(path, '.');
+	if (tptr) {
+		Htaccess *cur;
+		for (cur = script_i; cur; cur = cur->next) {
+			if (strcmp(cur->before_colon + 1, tptr) == 0)
+				goto ret;
+		}
+	}
+#endif
+#if ENABLE_FEATURE_HTTPD_GZIP
+	strcpy(stpcpy(buf, path), ".gz");
+	f->has_gz = (access(buf, R_OK) == 0);
+#endif
+	f->size = sb.st_size;
+	f->mtim = sb.st_mtim;
+	find_mime_type(path);
+	f->mime = found_mime_type;
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+	f->gz_cacheable = (G.gzip_cache_dir
+			&& f->size >= GZIP_CACHE_MIN_SIZE
+			&& is_compressible()
+	);
+#endif
+	found_mime_type = NULL;
+	f->fd = open(path, O_RDONLY);
+ ret:
+	free(buf);
+	return f;
+}
+
+/* Find url in the cache, or add it (evicting the least recently used).
+ * NULL if out of memory: the connection goes to a child then */
+static ev_file *ev_file_get(const char *url, unsigned now)
+{
+	ev_file *f;
+	unsigned i, slot = 0;
+
+	for (i = 0; i < EV_FILE_CACHE_SIZE; i++) {
+		f = G.ev_files[i];
+		if (!f) {
+			slot = i;
+			continue;
+		}
+		if (strcmp(f->url, url) == 0) {
+			slot = i;
+			if ((int)(now - f->expires) < 0)
+				goto ret;
+			break; /* too old, look again */
+		}
+		if (G.ev_files[slot] && G.ev_files[slot]->used > f->used)
+			slot = i;
+	}
+	if (G.ev_files[slot])
+		ev_file_put(G.ev_files[slot]);
+	G.ev_files[slot] = f = ev_file_new(url);
+	if (!f)
+		return f;
+	f->expires = now + EV_FILE_VALID;
+ ret:
+	f->used = now;
+	return f;
+}
+
+/* We are done sending c->file */
+static void ev_file_release(ev_conn *c)
+{
+	if (c->file) {
+		ev_file_put(c->file);
+		c->file = NULL;
+	}
+	c->file_fd = -1;
+}
+
+static void ev_close(ev_conn *c)
+{
+	close(c->fd);
+	ev_file_release(c);
+	free(c->out);
+	free(c->ip_str);
+	free(c);
+}
+
+/*
+ * Let a forked child do the complex work. It gets the connection
+ * and request bytes we already read, as if it read them itself.
+ */
+static void ev_handoff(ev_conn *c, int server_socket)
+{
+	if (fork() == 0) {
+		/* child */
+		unsigned i;
+
+		close(server_socket);
+		for (i = 0; i < G.ev_cnt; i++) {
+			ev_conn *other = G.ev_conns[i];
+			/* must not keep other connections open */
+			if (other && other != c) {
+				close(other->fd);
+				if (other->file_fd >= 0)
+					close(other->file_fd);
+			}
+		}
+		/* nor files, CGIs would inherit them */
+		for (i = 0; i < EV_FILE_CACHE_SIZE; i++) {
+			ev_file *f = G.ev_files[i];
+			if (f && f->fd >= 0) {
+				close(f->fd);
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+				if (f->gz_fd >= 0)
+					close(f->gz_fd);
+#endif
+			}
+		}
+		ndelay_off(c->fd);
+		xmove_fd(c->fd, 0);
+		xdup2(0, 1);
+		memcpy(hdr_buf, c->buf, c->in_len);
+		hdr_ptr = hdr_buf;
+		hdr_cnt = c->in_len;
+		handle_incoming_and_exit(&c->peer);
+	}
+	/* parent, or fork failed */
+}
+
+/* Length of request headers in buf[] including the empty line, 0 if incomplete */
+static unsigned ev_headers_len(ev_conn *c)
+{
+	char *p = c->buf;
+	char *end = c->buf + c->in_len;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		if (++p < end && *p == '\r')
+			p++;
+		if (p < end && *p == '\n')
+			return p + 1 - c->buf;
+	}
+	return 0;
+}
+
+/*
+ * If request is a GET or HEAD of an ordinary file and needs nothing
+ * which only handle_request_and_exit() knows how to do,
+ * prepare the response and return 1.
+ */
+static int ev_prepare_response(ev_conn *c, unsigned hdr_len, unsigned now)
+{
+	char *url, *tptr, *line, *next;
+#if ENABLE_FEATURE_HTTPD_ETAG
+	const char *if_none_match = NULL;
+#endif
+	unsigned len, responseNum;
+	smallint head;
+	IF_FEATURE_HTTPD_KEEPALIVE(smallint keep_alive;)
+	IF_FEATURE_HTTPD_GZIP(smallint gzip = 0;)
+	ev_file *f;
+	off_t size;
+	int fd;
+
+	/* Parse a copy: buf[] must stay intact for ev_handoff() */
+	for (len = 0; len < hdr_len; len++) {
+		unsigned char ch = c->buf[len];
+		/* let child respond "400 Bad Request" */
+		if ((ch < ' ' && ch != '\r' && ch != '\n' && ch != '\t') || ch == 0x7f)
+			return 0;
+		iobuf[len] = ch;
+	}
+	iobuf[len] = '\0';
+
+	head = (strncmp(iobuf, "HEAD ", 5) == 0);
+	if (!head && strncmp(iobuf, "GET ", 4) != 0)
+		return 0;
+	url = strchr(iobuf, ' ') + 1;
+	next = strchr(url, '\n');
+	*next++ = '\0';
+	if (next[-2] == '\r')
+		next[-2] = '\0';
+	tptr = strchr(url, ' ');
+	/* Is it " HTTP/"? */
+	if (!tptr || strncmp(tptr + 1, HTTP_200, 5) != 0)
+		return 0;
+	*tptr++ = '\0';
+	IF_FEATURE_HTTPD_KEEPALIVE(keep_alive = (strcmp(tptr, "HTTP/1.1") >= 0);)
+	if (url[0] != '/' IF_FEATURE_HTTPD_PROXY(|| find_proxy_entry(url)))
+		return 0;
+
+	/* Query does not matter for files */
+	tptr = strchr(url, '?');
+	if (tptr)
+		*tptr = '\0';
+	tptr = percent_decode_in_place(url, /*strict:*/ 1);
+	if (tptr == NULL || tptr == url + 1)
+		return 0;
+	if (!canonicalize_url(url))
+		return 0;
+	/* Checks which depend only on url are done (and remembered) here */
+	f = ev_file_get(url, now);
+	if (!f || f->fd < 0)
+		return 0;
+
+	/* Headers. get_line() would have stripped '\r' */
+	for (line = next; *line != '\r' && *line != '\n'; line = next) {
+		next = strchr(line, '\n');
+		*next++ = '\0';
+		if (next[-2] == '\r')
+			next[-2] = '\0';
+		if (STRNCASECMP(line, "Range:") == 0
+		/* Request has a body, child will know what to do */
+		 || STRNCASECMP(line, "Content-Length:") == 0
+		 || STRNCASECMP(line, "Transfer-Encoding:") == 0
+		) {
+			return 0;
+		}
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+		if (STRNCASECMP(line, "Connection:") == 0) {
+			char *s = skip_whitespace(line + sizeof("Connection:") - 1);
+			if (STRNCASECMP(s, "close") == 0)
+				keep_alive = 0;
+			if (STRNCASECMP(s, "keep-alive") == 0)
+				keep_alive = 1;
+		}
+#endif
+#if ENABLE_FEATURE_HTTPD_GZIP
+		if (STRNCASECMP(line, "Accept-Encoding:") == 0 && strstr(line, "gzip"))
+			gzip = 1;
+#endif
+#if ENABLE_FEATURE_HTTPD_ETAG
+		if (STRNCASECMP(line, "If-None-Match:") == 0)
+			if_none_match = skip_whitespace(line + sizeof("If-None-Match:") - 1);
+#endif
+	}
+	fd = f->fd;
+	size = f->size;
+#if ENABLE_FEATURE_HTTPD_GZIP
+	if (gzip) {
+		/* <url>.gz exists? child sends it */
+		if (f->has_gz)
+			return 0;
+# if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+		if (f->gz_cacheable) {
+			if (f->gz_fd < 0) {
+				struct stat sb;
+				/* Not compressed yet (or stale)? Child will do it */
+				f->gz_fd = open_gzip_cache(f->path, &f->mtim, f->size, -1);
+				if (f->gz_fd < 0)
+					return 0;
+				fstat(f->gz_fd, &sb);
+				f->gz_size = sb.st_size;
+			}
+			fd = f->gz_fd;
+			size = f->gz_size;
+			content_gzip = 1;
+		}
+# endif
+	}
+#endif
+	if (VERBOSE_2)
+		bb_error_msg("%s %s", head ? "HEAD" : "GET", url);
+
+	/* Set up what format_headers() needs */
+	responseNum = HTTP_OK;
+	file_size = size;
+	last_mod = f->mtim.tv_sec;
+#if ENABLE_FEATURE_HTTPD_ETAG
+	sprintf(etag, "\"%"LL_FMT"x-%"LL_FMT"x\"", (unsigned long long)last_mod, (unsigned long long)file_size);
+	if (if_none_match && strstr(if_none_match, etag)) {
+		responseNum = HTTP_NOT_MODIFIED;
+		file_size = -1;
+		head = 1;
+	} else
+#endif
+		found_mime_type = f->mime;
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	G.keep_alive = (keep_alive && --c->requests_left != 0);
+#endif
+	len = format_headers(responseNum IF_FEATURE_HTTPD_ERROR_PAGES(, NULL));
+	IF_FEATURE_HTTPD_KEEPALIVE(c->keep_alive = G.keep_alive;)
+	found_mime_type = NULL;
+	file_size = -1;
+	IF_FEATURE_HTTPD_GZIP_CACHE(content_gzip = 0;)
+
+	c->out = malloc(len);
+	if (!c->out)
+		return 0; /* out of memory: let child respond */
+	memcpy(c->out, iobuf, len);
+	c->out_len = len;
+	c->out_pos = 0;
+	if (!head) {
+		c->file = f;
+		f->refs++;
+		c->file_fd = fd;
+		c->offset = 0;
+		c->left = size;
+	}
+
+	/* Remove the request, pipelined next one may follow it */
+	c->in_len -= hdr_len;
+	memmove(c->buf, c->buf + hdr_len, c->in_len);
+	return 1;
+}
+
+/*
+ * Send as much of the response as socket takes.
+ * Returns 1 when all is sent, 0 if there is more to send, -1 on error.
+ */
+static int ev_send(ev_conn *c)
+{
+	ssize_t n;
+
+	if (c->out) {
+		n = safe_write(c->fd, c->out + c->out_pos, c->out_len - c->out_pos);
+		if (n < 0)
+			goto err;
+		c->out_pos += n;
+		if (c->out_pos < c->out_len)
+			return 0;
+		free(c->out);
+		c->out = NULL;
+	}
+	if (c->file_fd >= 0) {
+		while (c->left != 0) {
+			/* sz is rounded down to 64k */
+			ssize_t sz = MAXINT(ssize_t) - 0xffff;
+			if (sz > c->left)
+				sz = c->left;
+#if ENABLE_FEATURE_USE_SENDFILE
+			n = sendfile(c->fd, c->file_fd, &c->offset, sz);
+			if (n < 0 && errno != EAGAIN)
+#endif
+			{
+				/* fall back to read/write */
+				if (sz > IOBUF_SIZE)
+					sz = IOBUF_SIZE;
+				n = pread(c->file_fd, iobuf, sz, c->offset);
+				if (n > 0) {
+					n = safe_write(c->fd, iobuf, n);
+					if (n > 0)
+						c->offset += n;
+				}
+			}
+			if (n < 0)
+				goto err;
+			/* File shrank? Client waits for the rest */
+			if (n == 0)
+				return -1;
+			c->left -= n;
+		}
+		ev_file_release(c);
+	}
+	return 1;
+ err:
+	if (errno == EAGAIN)
+		return 0;
+	if (VERBOSE_1)
+		bb_simple_perror_msg("write error");
+	return -1;
+}
+
+/*
+ * Connection c is readable or writable (whichever we waited for).
+ * Returns 0 if it is to be closed.
+ */
+static int ev_process(ev_conn *c, int server_socket, unsigned now)
+{
+	int r;
+
+	if (c->out || c->file_fd >= 0)
+		goto send;
+	r = safe_read(c->fd, c->buf + c->in_len, sizeof_hdr_buf - c->in_len);
+	if (r <= 0)
+		return (r < 0 && errno == EAGAIN);
+	c->in_len += r;
+	while (1) {
+		const char *name = applet_name;
+		unsigned hdr_len = ev_headers_len(c);
+
+		if (hdr_len == 0 && c->in_len < sizeof_hdr_buf)
+			return 1; /* wait for the rest of headers */
+		/* this trick makes -v logging much simpler */
+		if (c->ip_str)
+			applet_name = c->ip_str;
+		r = (hdr_len != 0 && ev_prepare_response(c, hdr_len, now));
+		applet_name = name;
+		if (!r) {
+			ev_handoff(c, server_socket);
+			return 0;
+		}
+ send:
+		r = ev_send(c);
+		if (r < 0)
+			return 0;
+		c->deadline = now + DATA_WRITE_TIMEOUT;
+		if (r == 0)
+			return 1;
+		/* Response is complete */
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+		if (!c->keep_alive)
+#endif
+		{
+			/* close with FIN, not RST */
+			shutdown(c->fd, SHUT_WR);
+			return 0;
+		}
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+		c->deadline = now + KEEPALIVE_TIMEOUT;
+		if (c->in_len == 0)
+			return 1;
+		/* else: next request is already here */
+#endif
+	}
+}
+
+static void ev_accept(int server_socket, unsigned max, unsigned now)
+{
+	while (G.ev_cnt < max) {
+		ev_conn *c;
+		len_and_sockaddr fromAddr;
+		int n;
+
+		fromAddr.len = LSA_SIZEOF_SA;
+		n = accept(server_socket, &fromAddr.u.sa, &fromAddr.len);
+		if (n < 0)
+			break; /* none left, or other process took it */
+
+		/* set the KEEPALIVE option to cull dead connections */
+		setsockopt_keepalive(n);
+		/* not xzalloc: do not die on transient out-of-memory */
+		c = calloc(1, sizeof(*c) + sizeof_hdr_buf);
+		if (!c) {
+			close(n);
+			break;
+		}
+		ndelay_on(n);
+		c->fd = n;
+		c->file_fd = -1;
+		c->deadline = now + HEADER_READ_TIMEOUT;
+		IF_FEATURE_HTTPD_KEEPALIVE(c->requests_left = KEEPALIVE_MAX_REQUESTS;)
+		c->peer = fromAddr;
+		if (verbose)
+			c->ip_str = xmalloc_sockaddr2dotted(&fromAddr.u.sa);
+#if ENABLE_FEATURE_HTTPD_ACL_IP
+		if (ip_denied(get_remote_ip(&fromAddr))) {
+			/* child says "403 Forbidden" */
+			ev_handoff(c, server_socket);
+			ev_close(c);
+			continue;
+		}
+#endif
+		G.ev_conns[G.ev_cnt++] = c;
+	}
+}
+
+/*
+ * The main loop of "httpd -E NUM": NUM processes, each waits for
+ * all its connections in one poll(). Ordinary files are sent from here,
+ * other requests are served by forked children, see ev_handoff().
+ * Never returns.
+ */
+static void mini_httpd_event(int server_socket) NORETURN;
+static void mini_httpd_event(int server_socket)
+{
+	struct pollfd *pfd;
+	struct rlimit rl;
+	unsigned max;
+
+	/* forked children use it */
+	signal(SIGALRM, sigalrm_handler);
+	/* We use the config ourself: reread it between events, not in handler */
+	signal(SIGHUP, record_signo);
+
+	/* Allow as many connections as we can */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	/* All processes accept() on the same listening socket */
+	while (--G.workers > 0 && fork() != 0)
+		continue;
+
+	/* openServer's backlog is too short for a burst of connects */
+	listen(server_socket, SOMAXCONN);
+	ndelay_on(server_socket);
+	max = G.conn_limit ? G.conn_limit : 1;
+	G.ev_conns = xzalloc(max * sizeof(G.ev_conns[0]));
+	G.ev_files = xzalloc(EV_FILE_CACHE_SIZE * sizeof(G.ev_files[0]));
+	pfd = xzalloc((max + 1) * sizeof(pfd[0]));
+	while (1) {
+		unsigned i, j, now;
+
+		if (bb_got_signal) {
+			bb_got_signal = 0;
+			parse_conf(DEFAULT_PATH_HTTPD_CONF, SIGNALED_PARSE);
+			ev_file_flush();
+		}
+
+		pfd[0].fd = (G.ev_cnt < max) ? server_socket : -1;
+		pfd[0].events = POLLIN;
+		for (i = 0; i < G.ev_cnt; i++) {
+			ev_conn *c = G.ev_conns[i];
+			pfd[i + 1].fd = c->fd;
+			pfd[i + 1].events = (c->out || c->file_fd >= 0) ? POLLOUT : POLLIN;
+		}
+		if (poll(pfd, G.ev_cnt + 1, 1000) < 0)
+			continue; /* EINTR */
+		now = monotonic_sec();
+
+		for (i = 0; i < G.ev_cnt; i++) {
+			ev_conn *c = G.ev_conns[i];
+
+			if (pfd[i + 1].revents) {
+				if (ev_process(c, server_socket, now))
+					continue;
+			} else if ((int)(now - c->deadline) < 0) {
+				continue;
+			}
+			/* error, EOF, done or timed out */
+			ev_close(c);
+			G.ev_conns[i] = NULL;
+		}
+		for (i = j = 0; i < G.ev_cnt; i++) {
+			if (G.ev_conns[i])
+				G.ev_conns[j++] = G.ev_conns[i];
+		}
+		G.ev_cnt = j;
+
+		if (pfd[0].revents)
+			ev_accept(server_socket, max, now);
+	}
+	/* never reached */
+}
+#endif
+
 /*
  * The main http server function.
  * Given a socket, listen for new connections and farm out
@@ -3257,9 +4320,11 @@ enum {
 	IF_FEATURE_HTTPD_BASIC_AUTH(    r_opt_realm     ,)
 	IF_FEATURE_HTTPD_AUTH_MD5(      m_opt_md5       ,)
 	IF_FEATURE_HTTPD_SETUID(        u_opt_setuid    ,)
+	IF_FEATURE_HTTPD_GZIP_CACHE(    z_opt_gzip_cache,)
 	p_opt_port      ,
 	IF_NOT_PLATFORM_MINGW32(        M_opt_maxconn   ,)
 	IF_NOT_PLATFORM_MINGW32(        K_opt_killcgi   ,)
+	IF_FEATURE_HTTPD_EVENT(         E_opt_event     ,)
 	i_opt_inetd     ,
 	f_opt_foreground,
 	v_opt_verbose   ,
@@ -3314,7 +4379,8 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_BASIC_AUTH("r:")
 			IF_FEATURE_HTTPD_AUTH_MD5("m:")
 			IF_FEATURE_HTTPD_SETUID("u:")
-			IF_NOT_PLATFORM_MINGW32("p:M:+K:+ifv")
+			IF_FEATURE_HTTPD_GZIP_CACHE("z:")
+			IF_NOT_PLATFORM_MINGW32("p:M:+K:+" IF_FEATURE_HTTPD_EVENT("E:+") "ifv")
 			IF_PLATFORM_MINGW32("p:I:+fv")
 			"\0"
 			/* -v counts, -i implies -f */
@@ -3325,12 +4391,14 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_BASIC_AUTH(, &g_realm)
 			IF_FEATURE_HTTPD_AUTH_MD5(, &pass)
 			IF_FEATURE_HTTPD_SETUID(, &s_ugid)
+			IF_FEATURE_HTTPD_GZIP_CACHE(, &G.gzip_cache_dir)
 			, &bind_addr_or_port
 			IF_PLATFORM_MINGW32(, &fd)
 			IF_NOT_PLATFORM_MINGW32(, &G.conn_limit)
 			IF_NOT_PLATFORM_MINGW32(
 			, IF_FEATURE_HTTPD_CGI(&G.cgi_kill_timeout) IF_NOT_FEATURE_HTTPD_CGI(NULL)
 			)
+			IF_FEATURE_HTTPD_EVENT(, &G.workers)
 			, &verbose
 		);
 	if (opt & OPT_DECODE_URL) {
@@ -3465,6 +4533,10 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 #if BB_MMU
 	if (!(opt & OPT_FOREGROUND))
 		bb_daemonize(0); /* don't change current directory */
+# if ENABLE_FEATURE_HTTPD_EVENT
+	if (G.workers)
+		mini_httpd_event(server_socket); /* never returns */
+# endif
 	mini_httpd(server_socket); /* never returns */
 #else
 	mini_httpd_nommu(server_socket, argc, argv); /* never returns */
@@ -16,6 +16,7 @@
 //kbuild:lib-$(CONFIG_FEATURE_TLS_INTERNAL) += tls_pstm_sqr_comba.o
 //kbuild:lib-$(CONFIG_FEATURE_TLS_INTERNAL) += tls_aes.o
 //kbuild:lib-$(CONFIG_FEATURE_TLS_INTERNAL) += tls_aesgcm.o
+//kbuild:lib-$(CONFIG_FEATURE_TLS_INTERNAL) += tls_chacha20poly1305.o
 //kbuild:lib-$(CONFIG_FEATURE_TLS_INTERNAL) += tls_rsa.o
 //kbuild:lib-$(CONFIG_FEATURE_TLS_INTERNAL) += tls_fe.o
 //kbuild:lib-$(CONFIG_FEATURE_TLS_INTERNAL) += tls_sp_c32.o
@@ -33,6 +34,8 @@
 #define ALLOW_RSA_WITH_AES_128_CBC_SHA256       1
 #define ALLOW_RSA_WITH_AES_256_CBC_SHA256       1
 #define ALLOW_RSA_WITH_AES_128_GCM_SHA256       1
+#define ALLOW_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 1
+#define ALLOW_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256   1
 #define ALLOW_CURVE_P256        1
 #define ALLOW_CURVE_X25519      1
 
@@ -191,7 +194,12 @@
 #define TLS_MAX_OUTBUF          (1 << 14)
 
 /* Cipher suites we support, in preference order (best first) */
+#define NUM_CHACHA_CIPHERS (0 \
+	+ ALLOW_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 \
+	+ ALLOW_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 \
+	)
 #define NUM_CIPHERS (0 \
+	+ NUM_CHACHA_CIPHERS \
 	+ 4 * ENABLE_FEATURE_TLS_SHA1 \
 	+ ALLOW_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256 \
 	+ ALLOW_ECDHE_RSA_WITH_AES_128_CBC_SHA256 \
@@ -207,6 +215,13 @@ static const uint8_t client_hello_ciphers[] = {
 	0x00,2 * (1 + NUM_CIPHERS), //len16_be
 	0x00,0xFF, //not a cipher - TLS_EMPTY_RENEGOTIATION_INFO_SCSV
 	/* ^^^^^^ RFC 5746 Renegotiation Indication Extension - some servers will refuse to work with us otherwise */
+	/* ChaCha20 ciphers must be first, see cipher_list_prefer_aes() */
+#if ALLOW_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+	0xCC,0xA9, //   TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+#endif
+#if ALLOW_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+	0xCC,0xA8, //   TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 - ok: openssl s_server ... -cipher ECDHE-RSA-CHACHA20-POLY1305
+#endif
 #if ENABLE_FEATURE_TLS_SHA1
 	0xC0,0x09, // 1 TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA - ok: wget https://is.gd/
 	0xC0,0x0A, // 2 TLS_ECDHE_ECDSA_WITH_AES_256_CBC_SHA - ok: wget https://is.gd/
@@ -317,13 +332,40 @@ enum {
 	 * Server: we chose x25519 based on client's supported_groups (else P256) */
 	USE_EC_CURVE_X25519    = 1 << 4,
 	ENCRYPTION_AESGCM      = 1 << 5, // else AES-SHA (or NULL-SHA if ALLOW_RSA_NULL_SHA256=1)
+	ENCRYPTION_CHACHA20    = 1 << 6, // ChaCha20-Poly1305
+	/* Peer closed (the TCP connection may stay open): EOF is sticky */
+	GOT_EOF                = 1 << 7,
 };
 
+/* Without hardware AES, ChaCha20 is a lot faster than AES
+ * and is preferred. With it, move ChaCha20 ciphers to the end
+ * of cipher list (they are first in client_hello_ciphers[]).
+ */
+static int aes_is_fast(void)
+{
+#if TLS_X86_HWACCEL
+	return x86_cpuid1_ecx_has(CPUID1_ECX_AES | CPUID1_ECX_PCLMUL | CPUID1_ECX_SSSE3);
+#else
+	return 0;
+#endif
+}
+static void cipher_list_prefer_aes(uint8_t *list)
+{
+	if (NUM_CHACHA_CIPHERS != 0 && aes_is_fast()) {
+		uint8_t chacha[2 * NUM_CHACHA_CIPHERS + 1]; /* +1: avoid 0-sized array */
+		memcpy(chacha, list, 2 * NUM_CHACHA_CIPHERS);
+		memmove(list, list + 2 * NUM_CHACHA_CIPHERS, 2 * (NUM_CIPHERS - NUM_CHACHA_CIPHERS));
+		memcpy(list + 2 * (NUM_CIPHERS - NUM_CHACHA_CIPHERS), chacha, 2 * NUM_CHACHA_CIPHERS);
+	}
+}
+
 #if ENABLE_SSL_SERVER // || ENABLE_FEATURE_HTTPD_SSL
 /* Note: return value matches KEY_RSA (0) / KEY_ECDSA (1) enum values */
 static int is_cipher_ECDSA(const uint8_t *cipherid)
 {
 	uint8_t cipher_lo;
+	if (cipherid[0] == 0xCC)
+		return cipherid[1] == 0xA9;
 	if (cipherid[0] != 0xC0)
 		return 0;
 	/* ECDHE cipher - check if ECDSA or RSA */
@@ -346,6 +388,12 @@ static void set_cipher_parameters(tls_state_t *tls, const uint8_t *cipherid)
 	tls->MAC_size = SHA256_OUTSIZE;
 	tls->IV_size = 0;
 
+	if (cipherid[0] == 0xCC) {
+		/* CCA8,A9 are ECDHE ChaCha20-Poly1305 */
+		tls->flags |= NEED_EC_KEY | ENCRYPTION_CHACHA20;
+		tls->MAC_size = 0;
+		tls->IV_size = 12;
+	} else
 	if (cipherid[0] == 0xC0) {
 		/* All C0xx are ECDHE */
 		tls->flags |= NEED_EC_KEY;
@@ -408,6 +456,11 @@ struct tls_handshake_data {
 	//unsigned saved_client_hello_size;
 	//uint8_t saved_client_hello[1];
 
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	/* Session we offer in CLIENT_HELLO; updated as the handshake goes */
+	struct tls_session *session;
+#endif
+
 #if ENABLE_SSL_SERVER // || ENABLE_FEATURE_HTTPD_SSL
 	smallint reneg_info_requested;
 	/* Server certificate and key data */
@@ -427,6 +480,129 @@ enum {
 	KEY_ECDSA,
 };
 
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+/* RFC 5246 session id and RFC 5077 session ticket resumption.
+ * Only the client side implements it: the server never issues
+ * session ids or tickets.
+ */
+#define TLS_MAX_TICKET_SIZE 2048
+struct tls_session {
+	char *host;                     /* "host@PORT", not saved to disk */
+	/* On-disk image starts here */
+	uint8_t cipherid[2];
+	uint8_t session_id_len;
+	uint8_t session_id[32];
+	uint8_t master_secret[48];
+	uint16_t ticket_len;
+	uint8_t ticket[TLS_MAX_TICKET_SIZE];
+};
+#define SESSION_IMAGE(sess) ((uint8_t*)(sess) + offsetof(struct tls_session, cipherid))
+#define SESSION_IMAGE_SIZE(ticket_len) (offsetof(struct tls_session, ticket) - offsetof(struct tls_session, cipherid) + (ticket_len))
+
+/* host:443 and host:8443 may be different servers: key is "host@PORT".
+ * Just "host" if peer's port is unknown (e.g. ssl_client -s FD is a pipe)
+ */
+static char *session_key(tls_state_t *tls, const char *host)
+{
+	len_and_sockaddr lsa;
+	int port = -1;
+
+	lsa.len = LSA_SIZEOF_SA;
+	if (getpeername(tls->ofd, &lsa.u.sa, &lsa.len) == 0)
+		port = get_nport(&lsa.u.sa);
+	if (port == -1)
+		return xstrdup(host);
+	return xasprintf("%s@%u", host, (unsigned)ntohs(port));
+}
+
+/* Sessions of the last host are kept in memory: wget redirects
+ * and repeated connections in one process need no disk cache
+ */
+static struct tls_session *last_session;
+
+/* The key becomes a file name: accept only [A-Za-z0-9._-@] */
+static char *session_cache_file(const char *host)
+{
+	const char *dir = getenv("TLS_SESSION_CACHE");
+	const char *p;
+
+	if (!dir || !dir[0] || host[0] == '.')
+		return NULL;
+	for (p = host; *p; p++) {
+		if (!isalnum((unsigned char)*p) && !strchr(".-_@", *p))
+			return NULL;
+	}
+	return concat_path_file(dir, host);
+}
+
+static struct tls_session *load_session(const char *host)
+{
+	struct tls_session *sess;
+	char *fname;
+	int fd, sz;
+
+	if (last_session && strcmp(last_session->host, host) == 0) {
+		sess = xmemdup(last_session, sizeof(*sess));
+		sess->host = xstrdup(host);
+		return sess;
+	}
+
+	fname = session_cache_file(host);
+	if (!fname)
+		return NULL;
+	sess = xzalloc(sizeof(*sess));
+	fd = open(fname, O_RDONLY);
+	free(fname);
+	if (fd < 0)
+		goto bad;
+	sz = full_read(fd, SESSION_IMAGE(sess), SESSION_IMAGE_SIZE(TLS_MAX_TICKET_SIZE));
+	close(fd);
+	if (sz < (int)SESSION_IMAGE_SIZE(0)
+	 || sess->session_id_len > 32
+	 || sess->ticket_len > TLS_MAX_TICKET_SIZE
+	 || sz != (int)SESSION_IMAGE_SIZE(sess->ticket_len)
+	) {
+ bad:
+		free(sess);
+		return NULL;
+	}
+	dbg("loaded session for '%s': id len:%u ticket len:%u",
+		host, sess->session_id_len, sess->ticket_len);
+	sess->host = xstrdup(host);
+	return sess;
+}
+
+/* Best effort: failure to save a session is not an error */
+static void save_session(struct tls_session *sess)
+{
+	char *fname, *tmpname;
+	int fd;
+
+	if (last_session) {
+		free(last_session->host);
+		free(last_session);
+	}
+	last_session = sess;
+
+	fname = session_cache_file(sess->host);
+	if (!fname)
+		return;
+	tmpname = xasprintf("%s.%u", fname, (unsigned)getpid());
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd >= 0) {
+		unsigned sz = SESSION_IMAGE_SIZE(sess->ticket_len);
+		int ok = (full_write(fd, SESSION_IMAGE(sess), sz) == sz);
+		if (close(fd) != 0 || !ok
+		 || rename(tmpname, fname) != 0
+		) {
+			unlink(tmpname);
+		}
+	}
+	free(tmpname);
+	free(fname);
+}
+#endif
+
 static unsigned get24be(const uint8_t *p)
 {
 	return 0x100*(0x100*p[0] + p[1]) + p[2];
@@ -940,8 +1116,59 @@ static void xwrite_encrypted_aesgcm(tls_state_t *tls, unsigned size, unsigned ty
 #undef COUNTER
 }
 
+/* RFC 7905: nonce is client/server_write_IV xored with 64-bit seq number
+ * (padded on the left with zeros), aad is the same as in GCM.
+ * Unlike GCM, there is no explicit nonce in the record.
+ */
+static void chacha20_nonce_and_aad(uint8_t nonce[12], uint8_t aad[13],
+		const uint8_t *fixed_iv, uint64_t seq64_be, unsigned type, unsigned size)
+{
+	memcpy(nonce, fixed_iv, 12);
+	xorbuf(nonce + 4, &seq64_be, 8);
+	move_to_unaligned64(aad, seq64_be);
+	aad[8] = type;
+	aad[9] = TLS_MAJ;
+	aad[10] = TLS_MIN;
+	aad[11] = size >> 8;
+	aad[12] = size;
+}
+
+static void xwrite_encrypted_chacha20(tls_state_t *tls, unsigned size, unsigned type)
+{
+	uint8_t aad[13];
+	uint8_t nonce[12];
+	uint8_t *buf;
+	struct record_hdr *xhdr;
+
+	buf = tls->outbuf + OUTBUF_PFX;
+	dump_hex("xwrite_encrypted_chacha20 plaintext:%s", buf, size);
+
+	chacha20_nonce_and_aad(nonce, aad, tls->our_write_IV, tls->write_seq64_be, type, size);
+	tls->write_seq64_be = SWAP_BE64(1 + SWAP_BE64(tls->write_seq64_be));
+
+	/* tag goes right after ciphertext, OUTBUF_SFX has space for it */
+	chacha20poly1305_encrypt(tls->our_write_key, nonce, aad, sizeof(aad),
+			buf, size, buf + size);
+	size += 16;
+
+	xhdr = (void*)(buf - RECHDR_LEN);
+	xhdr->type = type;
+	xhdr->proto_maj = TLS_MAJ;
+	xhdr->proto_min = TLS_MIN;
+	xhdr->len16_hi = size >> 8;
+	xhdr->len16_lo = size; // & 0xff implicit
+	size += RECHDR_LEN;
+	dump_raw_out(">> %s", xhdr, size);
+	xwrite(tls->ofd, xhdr, size);
+	dbg("wrote %u bytes", size);
+}
+
 static void xwrite_encrypted(tls_state_t *tls, unsigned size, unsigned type)
 {
+	if (tls->flags & ENCRYPTION_CHACHA20) {
+		xwrite_encrypted_chacha20(tls, size, type);
+		return;
+	}
 	if (!(tls->flags & ENCRYPTION_AESGCM)) {
 		xwrite_encrypted_and_hmac_signed(tls, size, type);
 		return;
@@ -1080,6 +1307,22 @@ static void tls_aesgcm_decrypt(tls_state_t *tls, uint8_t *buf, int size)
 #undef COUNTER
 }
 
+static void tls_chacha20_decrypt(tls_state_t *tls, uint8_t *buf, int size)
+{
+	uint8_t aad[13];
+	uint8_t nonce[12];
+
+	chacha20_nonce_and_aad(nonce, aad, tls->peer_write_IV, tls->read_seq64_be,
+			tls->inbuf[0], size);
+	tls->read_seq64_be = SWAP_BE64(1 + SWAP_BE64(tls->read_seq64_be));
+
+	if (chacha20poly1305_decrypt(tls->peer_write_key, nonce, aad, sizeof(aad),
+			buf, size, buf + size) != 0
+	) {
+		bb_simple_error_msg_and_die("TLS record authentication failed");
+	}
+}
+
 static int tls_xread_record(tls_state_t *tls, const char *expected)
 {
 	struct record_hdr *xhdr;
@@ -1157,6 +1400,12 @@ static int tls_xread_record(tls_state_t *tls, const char *expected)
 		if (sz < (int)tls->min_encrypted_len_on_read)
 			bb_error_msg_and_die("bad encrypted len:%u", sz);
 
+		if (tls->flags & ENCRYPTION_CHACHA20) {
+			/* CHACHA20-POLY1305 */
+			sz -= 16; /* drop tag */
+			tls_chacha20_decrypt(tls, tls->inbuf + RECHDR_LEN, sz);
+			dbg("encrypted size:%u", sz);
+		} else
 		if (tls->flags & ENCRYPTION_AESGCM) {
 			/* AESGCM */
 			uint8_t *p = tls->inbuf + RECHDR_LEN;
@@ -1558,10 +1807,7 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 		uint8_t rand32[32];
 		uint8_t session_id_len;
 		/* uint8_t session_id[]; */
-		uint8_t cipherid_len16_hi, cipherid_len16_lo;
-		uint8_t cipherid[2 * (1 + NUM_CIPHERS)]; /* actually variable */
-		uint8_t comprtypes_len;
-		uint8_t comprtypes[1]; /* actually variable */
+		/* followed by client_hello_ciphers[]: cipher ids, compression types */
 	};
 	// https://www.iana.org/assignments/tls-extensiontype-values/tls-extensiontype-values.xhtml
 	static const uint8_t extensions[] = {
@@ -1582,7 +1828,7 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 		//0x00,0x0b,0x00,0x04,0x03,0x00,0x01,0x02, //extension_type: "ec_point_formats"
 		//0x00,0x16,0x00,0x00, //extension_type: "encrpypt-then-mac"
 		//0x00,0x17,0x00,0x00, //extension_type: "extended_master"
-		//0x00,0x23,0x00,0x00, //extension_type: "session_ticket"
+		//0x00,0x23,0x00,0x00, //extension_type: "session_ticket" (added below)
 
 		// kojipkgs.fedoraproject.org responds with alert code 80 ("internal error")
 		// to our hello without signature_algorithms.
@@ -1619,15 +1865,41 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 	uint8_t *ptr;
 	int len;
 	int ext_len;
+	int sid_len = 0;
 	int sni_len = sni ? strnlen(sni, 127 - 5) : 0;
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	struct tls_session *sess = NULL;
+
+	if (sni_len) {
+		char *key = session_key(tls, sni);
+		sess = load_session(key);
+		free(key);
+	}
+	if (sess) {
+		// RFC 5077: "When presenting a ticket, the client MAY generate
+		// and include a Session ID in the TLS ClientHello. If the server
+		// accepts the ticket and the Session ID is not empty, then it
+		// MUST respond with the same Session ID present in the ClientHello."
+		// Do so: this is how we know whether the ticket was accepted.
+		if (sess->ticket_len != 0 && sess->session_id_len == 0) {
+			sess->session_id_len = 32;
+			tls_get_random(sess->session_id, 32);
+		}
+		sid_len = sess->session_id_len;
+	}
+#endif
 
 	ext_len = 0;
 	ext_len += sizeof(extensions);
 	if (sni_len)
 		ext_len += 9 + sni_len;
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	/* empty "session_ticket" asks the server to issue one */
+	ext_len += 4 + (sess ? sess->ticket_len : 0);
+#endif
 
 	/* +2 is for "len of all extensions" 2-byte field */
-	len = sizeof(*record) + 2 + ext_len;
+	len = sizeof(*record) + sid_len + sizeof(client_hello_ciphers) + 2 + ext_len;
 	record = get_outbuf_fill_handshake_record(tls, HANDSHAKE_CLIENT_HELLO, len);
 
 	record->proto_maj = TLS_MAJ;	/* the "requested" version of the protocol, */
@@ -1635,12 +1907,18 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 	tls_get_random(record->rand32, sizeof(record->rand32));
 	if (TLS_DEBUG_FIXED_SECRETS)
 		memset(record->rand32, 0x11, sizeof(record->rand32));
-	/* record->session_id_len = 0; - already is */
+	record->session_id_len = sid_len;
+	ptr = (void*)(record + 1);
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	if (sid_len)
+		ptr = mempcpy(ptr, sess->session_id, sid_len);
+#endif
 
 	BUILD_BUG_ON(sizeof(client_hello_ciphers) != 2 * (1 + 1 + NUM_CIPHERS + 1));
-	memcpy(&record->cipherid_len16_hi, client_hello_ciphers, sizeof(client_hello_ciphers));
+	memcpy(ptr, client_hello_ciphers, sizeof(client_hello_ciphers));
+	cipher_list_prefer_aes(ptr + 2 + 2); /* skip len16 and SCSV */
+	ptr += sizeof(client_hello_ciphers);
 
-	ptr = (void*)(record + 1);
 	*ptr++ = ext_len >> 8;
 	*ptr++ = ext_len;
 	if (sni_len) {
@@ -1655,9 +1933,24 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 		ptr[8] = sni_len;         //name len
 		ptr = mempcpy(&ptr[9], sni, sni_len);
 	}
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	//ptr[0] = 0x00;
+	ptr[1] = 0x23; //extension_type: "session_ticket"
+	//ptr[2] = 0;   //ext len
+	//ptr[3] = 0;
+	ptr += 4;
+	if (sess) {
+		ptr[-2] = sess->ticket_len >> 8;
+		ptr[-1] = sess->ticket_len;
+		ptr = mempcpy(ptr, sess->ticket, sess->ticket_len);
+	}
+#endif
 	memcpy(ptr, extensions, sizeof(extensions));
 
 	tls->hsd = xzalloc(sizeof(*tls->hsd));
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	tls->hsd->session = sess;
+#endif
 	/* HANDSHAKE HASH: ^^^ + len if need to save saved_client_hello */
 	memcpy(tls->hsd->client_and_server_rand32, record->rand32, sizeof(record->rand32));
 /* HANDSHAKE HASH:
@@ -1676,7 +1969,8 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 	 */
 }
 
-static void get_server_hello(tls_state_t *tls)
+/* Returns 1 if the server agreed to resume our session */
+static int get_server_hello(tls_state_t *tls)
 {
 	struct server_hello {
 		struct record_hdr xhdr;
@@ -1735,6 +2029,35 @@ static void get_server_hello(tls_state_t *tls)
 	dbg("server chose cipher %04x", tls->cipher_id);
 	dbg("key_size:%u MAC_size:%u IV_size:%u", tls->key_size, tls->MAC_size, tls->IV_size);
 
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	{
+		struct tls_session *sess = tls->hsd->session;
+		if (!sess) {
+			sess = tls->hsd->session = xzalloc(sizeof(*sess));
+		} else
+		if (sess->session_id_len != 0
+		 && sess->session_id_len == hp->session_id_len
+		 && memcmp(sess->session_id, hp->session_id, 32) == 0
+		) {
+			// RFC 5246 7.4.1.3: "If the ClientHello.session_id was non-empty,
+			// the server will look in its session cache for a match. If a match
+			// is found and the server is willing to establish the new connection
+			// using the specified session state, the server will respond with
+			// the same value as was supplied by the client."
+			if (memcmp(sess->cipherid, cipherid, 2) != 0)
+				bad_record_die(tls, "'server hello'", len);
+			dbg("resuming session");
+			memcpy(tls->hsd->master_secret, sess->master_secret, sizeof(sess->master_secret));
+			return 1;
+		}
+		/* Full handshake: forget old session, remember the new one */
+		memcpy(sess->cipherid, cipherid, 2);
+		sess->session_id_len = hp->session_id_len;
+		memcpy(sess->session_id, hp->session_id, hp->session_id_len);
+		sess->ticket_len = 0;
+	}
+#endif
+
 	/* Handshake hash eventually destined to FINISHED record
 	 * is sha256 regardless of cipher
 	 * (at least for all ciphers defined by RFC5246).
@@ -1749,6 +2072,7 @@ static void get_server_hello(tls_state_t *tls)
 		tls->inbuf + RECHDR_LEN, len
 	);
  */
+	return 0;
 }
 
 static void get_server_cert(tls_state_t *tls)
@@ -1878,26 +2202,10 @@ static void send_empty_client_cert(tls_state_t *tls)
 	xwrite_and_update_handshake_hash(tls, sizeof(*record));
 }
 
-static void derive_master_secret_and_keys(tls_state_t *tls, uint8_t *premaster, int premaster_size)
+/* Also used on its own when resuming a session: master secret is known */
+static void derive_keys(tls_state_t *tls)
 {
 	uint8_t tmp64[64];
-	// RFC 5246
-	// For all key exchange methods, the same algorithm is used to convert
-	// the pre_master_secret into the master_secret.  The pre_master_secret
-	// should be deleted from memory once the master_secret has been
-	// computed.
-	//      master_secret = PRF(pre_master_secret, "master secret",
-	//                          ClientHello.random + ServerHello.random)
-	//                          [0..47];
-	// The master secret is always exactly 48 bytes in length.  The length
-	// of the premaster secret will vary depending on key exchange method.
-	prf_hmac_sha256(/*tls,*/
-		tls->hsd->master_secret, sizeof(tls->hsd->master_secret),
-		premaster, premaster_size,
-		"master secret",
-		tls->hsd->client_and_server_rand32, sizeof(tls->hsd->client_and_server_rand32)
-	);
-	dump_hex("master secret:%s", tls->hsd->master_secret, sizeof(tls->hsd->master_secret));
 
 	// RFC 5246
 	// 6.3.  Key Calculation
@@ -1945,9 +2253,35 @@ static void derive_master_secret_and_keys(tls_state_t *tls, uint8_t *premaster,
 	);
 }
 
+static void derive_master_secret_and_keys(tls_state_t *tls, uint8_t *premaster, int premaster_size)
+{
+	// RFC 5246
+	// For all key exchange methods, the same algorithm is used to convert
+	// the pre_master_secret into the master_secret.  The pre_master_secret
+	// should be deleted from memory once the master_secret has been
+	// computed.
+	//      master_secret = PRF(pre_master_secret, "master secret",
+	//                          ClientHello.random + ServerHello.random)
+	//                          [0..47];
+	// The master secret is always exactly 48 bytes in length.  The length
+	// of the premaster secret will vary depending on key exchange method.
+	prf_hmac_sha256(/*tls,*/
+		tls->hsd->master_secret, sizeof(tls->hsd->master_secret),
+		premaster, premaster_size,
+		"master secret",
+		tls->hsd->client_and_server_rand32, sizeof(tls->hsd->client_and_server_rand32)
+	);
+	dump_hex("master secret:%s", tls->hsd->master_secret, sizeof(tls->hsd->master_secret));
+
+	derive_keys(tls);
+}
+
 static void initialize_aes_keys(tls_state_t *tls)
 {
 	uint8_t iv[AES_BLOCK_SIZE];
+
+	if (tls->flags & ENCRYPTION_CHACHA20)
+		return; /* ChaCha20 uses keys as is */
 	aes_setkey(&tls->aes_decrypt, tls->peer_write_key, tls->key_size);
 	aes_setkey(&tls->aes_encrypt, tls->our_write_key, tls->key_size);
 	if (1) { //if AESGCM
@@ -1956,6 +2290,25 @@ static void initialize_aes_keys(tls_state_t *tls)
 	}
 }
 
+static void set_client_keys(tls_state_t *tls)
+{
+	// The key_block is partitioned as follows:
+	tls->our_write_MAC_key  = tls->key_block;                          // client_write_MAC_key[]
+	tls->peer_write_MAC_key = tls->key_block          + tls->MAC_size; // server_write_MAC_key[]
+	tls->our_write_key      = tls->peer_write_MAC_key + tls->MAC_size; // client_write_key[]
+	tls->peer_write_key     = tls->our_write_key      + tls->key_size; // server_write_key[]
+	tls->our_write_IV       = tls->peer_write_key     + tls->key_size; // client_write_IV[]
+	tls->peer_write_IV      = tls->our_write_IV       + tls->IV_size;  // server_write_IV[]
+	dump_hex("client write_MAC_key:%s", tls->our_write_MAC_key, tls->MAC_size);
+	dump_hex("client write_key:%s",	tls->our_write_key, tls->key_size);
+	dump_hex("client write_IV:%s", tls->our_write_IV, tls->IV_size);
+	dump_hex("server write_MAC_key:%s", tls->peer_write_MAC_key, tls->MAC_size);
+	dump_hex("server write_key:%s",	tls->peer_write_key, tls->key_size);
+	dump_hex("server write_IV:%s", tls->peer_write_IV, tls->IV_size);
+
+	initialize_aes_keys(tls);
+}
+
 static void send_client_key_exchange(tls_state_t *tls)
 {
 	struct client_key_exchange {
@@ -2038,21 +2391,7 @@ static void send_client_key_exchange(tls_state_t *tls)
 	xwrite_and_update_handshake_hash(tls, len);
 
 	derive_master_secret_and_keys(tls, premaster, premaster_size);
-	// The key_block is partitioned as follows:
-	tls->our_write_MAC_key  = tls->key_block;                          // client_write_MAC_key[]
-	tls->peer_write_MAC_key = tls->key_block          + tls->MAC_size; // server_write_MAC_key[]
-	tls->our_write_key      = tls->peer_write_MAC_key + tls->MAC_size; // client_write_key[]
-	tls->peer_write_key     = tls->our_write_key      + tls->key_size; // server_write_key[]
-	tls->our_write_IV       = tls->peer_write_key     + tls->key_size; // client_write_IV[]
-	tls->peer_write_IV      = tls->our_write_IV       + tls->IV_size;  // server_write_IV[]
-	dump_hex("client write_MAC_key:%s", tls->our_write_MAC_key, tls->MAC_size);
-	dump_hex("client write_key:%s",	tls->our_write_key, tls->key_size);
-	dump_hex("client write_IV:%s", tls->our_write_IV, tls->IV_size);
-	dump_hex("server write_MAC_key:%s", tls->peer_write_MAC_key, tls->MAC_size);
-	dump_hex("server write_key:%s",	tls->peer_write_key, tls->key_size);
-	dump_hex("server write_IV:%s", tls->peer_write_IV, tls->IV_size);
-
-	initialize_aes_keys(tls);
+	set_client_keys(tls);
 }
 
 static const uint8_t rec_CHANGE_CIPHER_SPEC[] ALIGN1 = {
@@ -2133,13 +2472,51 @@ static void send_finished(tls_state_t *tls, const char *msg_to_encrypt)
 	xwrite_encrypted(tls, sizeof(*record), RECORD_TYPE_HANDSHAKE);
 }
 
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+// RFC 5077 3.3.  NewSessionTicket Handshake Message
+// struct {
+//     uint32 ticket_lifetime_hint;
+//     opaque ticket<0..2^16-1>;
+// } NewSessionTicket;
+static void get_new_session_ticket(tls_state_t *tls, int len)
+{
+	struct tls_session *sess = tls->hsd->session;
+	uint8_t *p = tls->inbuf + RECHDR_LEN + 4;
+	unsigned ticket_len;
+
+	ticket_len = 0x100 * p[4] + p[5];
+	if (len < 4 + 6 + (int)ticket_len)
+		bad_record_die(tls, "'new session ticket'", len);
+	dbg("<< NEW_SESSION_TICKET len:%u", ticket_len);
+	/* A ticket too big to remember is as good as none */
+	if (ticket_len > TLS_MAX_TICKET_SIZE)
+		ticket_len = 0;
+	sess->ticket_len = ticket_len;
+	memcpy(sess->ticket, p + 6, ticket_len);
+}
+#endif
+
 /* Receive and process ChangeCipherSpec */
 static void get_change_cipher_spec(tls_state_t *tls)
 {
 	int len;
 
 	/* Get CHANGE_CIPHER_SPEC */
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+ again:
+#endif
 	len = tls_xread_record(tls, "switch to encrypted traffic");
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	/* If we asked for a ticket, it comes right before CHANGE_CIPHER_SPEC */
+	if (tls->hsd->session
+	 && len >= 4 + 6
+	 && tls->inbuf[0] == RECORD_TYPE_HANDSHAKE
+	 && tls->inbuf[RECHDR_LEN] == HANDSHAKE_NEW_SESSION_TICKET
+	) {
+		get_new_session_ticket(tls, len);
+		goto again;
+	}
+#endif
 	if (len != 1 || memcmp(tls->inbuf, rec_CHANGE_CIPHER_SPEC, 6) != 0)
 		bad_record_die(tls, "switch to encrypted traffic", len);
 	dbg("<< CHANGE_CIPHER_SPEC");
@@ -2150,6 +2527,9 @@ static void get_change_cipher_spec(tls_state_t *tls)
 	) {
 		tls->min_encrypted_len_on_read = tls->MAC_size;
 	} else
+	if (tls->flags & ENCRYPTION_CHACHA20) {
+		tls->min_encrypted_len_on_read = 16; /* tag */
+	} else
 	if (!(tls->flags & ENCRYPTION_AESGCM)) {
 		unsigned mac_blocks = (unsigned)(TLS_MAC_SIZE(tls) + AES_BLOCK_SIZE-1) / AES_BLOCK_SIZE;
 		/* all incoming packets now should be encrypted and have
@@ -2197,11 +2577,29 @@ void FAST_FUNC tls_handshake(tls_state_t *tls, const char *sni)
 	//                                 [ChangeCipherSpec]
 	//                      <-------             Finished
 	// Application Data     <------>     Application Data
+	//
+	// Abbreviated handshake, if server resumes the session we offered:
+	// ClientHello          ------->
+	//                                        ServerHello
+	//                                  NewSessionTicket*
+	//                                 [ChangeCipherSpec]
+	//                      <-------             Finished
+	// [ChangeCipherSpec]
+	// Finished             ------->
+	// Application Data     <------>     Application Data
 	int len;
 	int got_cert_req;
 
 	send_client_hello_and_alloc_hsd(tls, sni);
-	get_server_hello(tls);
+	if (get_server_hello(tls)) {
+		derive_keys(tls);
+		set_client_keys(tls);
+		get_change_cipher_spec(tls);
+		get_finished(tls, "'server finished'");
+		send_change_cipher_spec(tls);
+		send_finished(tls, "client finished");
+		goto done;
+	}
 
 	// RFC 5246
 	// The server MUST send a Certificate message whenever the agreed-
@@ -2274,9 +2672,24 @@ void FAST_FUNC tls_handshake(tls_state_t *tls, const char *sni)
 
 	/* Get (encrypted) FINISHED from the server */
 	get_finished(tls, "'server finished'");
-
+ done:
 	/* application data can be sent/received */
 
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+	{
+		struct tls_session *sess = tls->hsd->session;
+		if (sess && sni && (sess->session_id_len | sess->ticket_len)) {
+			memcpy(sess->master_secret, tls->hsd->master_secret, sizeof(sess->master_secret));
+			if (!sess->host)
+				sess->host = session_key(tls, sni);
+			save_session(sess);
+		} else if (sess) {
+			free(sess->host);
+			free(sess);
+		}
+	}
+#endif
+
 	/* free handshake data */
 	psRsaKey_clear(&tls->hsd->server_rsa_pub_key);
 //	if (PARANOIA)
@@ -2291,6 +2704,58 @@ static void tls_xwrite(tls_state_t *tls, int len)
 	xwrite_encrypted(tls, len, RECORD_TYPE_APPLICATION_DATA);
 }
 
+/* Returns 0 on EOF. Blocks only if no decrypted data is buffered */
+int FAST_FUNC tls_read_data(tls_state_t *tls, void *buf, int len)
+{
+	if (tls->plaintext_size == 0) {
+		int nread;
+
+		if (tls->flags & GOT_EOF)
+			return 0;
+		nread = tls_xread_record(tls, "encrypted data");
+		if (nread < 1) {
+			tls->flags |= GOT_EOF;
+			return 0;
+		}
+		if (tls->inbuf[0] != RECORD_TYPE_APPLICATION_DATA)
+			bad_record_die(tls, "encrypted data", nread);
+		tls->ofs_to_plaintext = RECHDR_LEN;
+		tls->plaintext_size = nread;
+	}
+	if (len > tls->plaintext_size)
+		len = tls->plaintext_size;
+	memcpy(buf, tls->inbuf + tls->ofs_to_plaintext, len);
+	tls->ofs_to_plaintext += len;
+	tls->plaintext_size -= len;
+	return len;
+}
+
+void FAST_FUNC tls_write_data(tls_state_t *tls, const void *buf, int len)
+{
+	while (len > 0) {
+		int n = len < TLS_MAX_OUTBUF ? len : TLS_MAX_OUTBUF;
+		memcpy(tls_get_outbuf(tls, n), buf, n);
+		tls_xwrite(tls, n);
+		buf = (const char*)buf + n;
+		len -= n;
+	}
+}
+
+/* Can tls_read_data() return without reading the network? */
+int FAST_FUNC tls_has_buffered_data(tls_state_t *tls)
+{
+	return tls->plaintext_size != 0
+		|| (tls->flags & GOT_EOF)
+		|| tls_has_buffered_record(tls);
+}
+
+void FAST_FUNC tls_free(tls_state_t *tls)
+{
+	free(tls->inbuf);
+	free(tls->outbuf);
+	free(tls);
+}
+
 // To run a test server using openssl:
 // openssl req -x509 -newkey rsa:$((4096/4*3)) -keyout key.pem -out server.pem -nodes -days 99999 -subj '/CN=localhost'
 // openssl s_server -key key.pem -cert server.pem -debug -tls1_2
@@ -2439,6 +2904,7 @@ static void get_client_hello(tls_state_t *tls)
 	unsigned i, j;
 	struct client_hello *hp;
 	uint8_t *p;
+	uint8_t our_ciphers[2 * NUM_CIPHERS];
 	int cipher_list_len;
 	int extensions_len;
 	int len;
@@ -2486,8 +2952,10 @@ static void get_client_hello(tls_state_t *tls)
 	}
 
 	/* Select cipher + cert pair from client's list, preferring our ciphers in order */
+	memcpy(our_ciphers, supported_ciphers, sizeof(our_ciphers));
+	cipher_list_prefer_aes(our_ciphers);
 	for (i = 0; i < NUM_CIPHERS*2; i += 2) {
-		const uint8_t *our_cipher = &supported_ciphers[i];
+		const uint8_t *our_cipher = &our_ciphers[i];
 		int key_type;
 
 		/* Determine required key type for this cipher */
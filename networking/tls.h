@@ -83,6 +83,15 @@ typedef  int16_t  int16;
 
 #define AES_BLOCK_SIZE  16
 
+/* Runtime-detected AES-NI and PCLMULQDQ code (needs target("...") attribute) */
+#if ENABLE_FEATURE_TLS_HWACCEL \
+ && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) \
+ && (__GNUC__ >= 5 || defined(__clang__))
+# define TLS_X86_HWACCEL 1
+#else
+# define TLS_X86_HWACCEL 0
+#endif
+
 void tls_get_random(void *buf, unsigned len) FAST_FUNC;
 
 #define ALIGNED_long ALIGNED(sizeof(long))
@@ -105,6 +114,7 @@ void tls_get_random(void *buf, unsigned len) FAST_FUNC;
 #include "tls_pstm.h"
 #include "tls_aes.h"
 #include "tls_aesgcm.h"
+#include "tls_chacha20poly1305.h"
 #include "tls_rsa.h"
 
 #define EC_CURVE_KEYSIZE   32
@@ -343,9 +343,152 @@ static void aes_encrypt_1(struct tls_aes *aes, unsigned astate[16])
 	AddRoundKey(astate, RoundKey);
 }
 
+#if TLS_X86_HWACCEL
+# include <emmintrin.h>
+# include <wmmintrin.h>
+
+int FAST_FUNC x86_cpuid1_ecx_has(unsigned bits)
+{
+	static unsigned cpuid1_ecx;
+	static smallint cpuid1_done;
+
+	if (!cpuid1_done) {
+		unsigned eax = 1;
+		unsigned ebx = 0;
+		unsigned ecx = 0;
+		unsigned edx;
+		cpuid_eax_ebx_ecx(&eax, &ebx, &ecx, &edx);
+		cpuid1_ecx = ecx;
+		cpuid1_done = 1;
+	}
+	return (cpuid1_ecx & bits) == bits;
+}
+
+/* 1: use AES-NI, -1: do not, 0: not yet known */
+static smallint aesNI;
+static NOINLINE int get_aesNI(void)
+{
+	aesNI = x86_cpuid1_ecx_has(CPUID1_ECX_AES) ? 1 : -1;
+	return aesNI;
+}
+
+/* With AES-NI, aes->key[] holds round keys in memory byte order,
+ * that is, each round key can be loaded into a register as is.
+ */
+#define AESNI_FUNC __attribute__((target("aes,sse2")))
+
+static AESNI_FUNC ALWAYS_INLINE __m128i aesni_encrypt_1(const __m128i *rk, unsigned rounds, __m128i b)
+{
+	unsigned i;
+
+	b = _mm_xor_si128(b, _mm_loadu_si128(rk));
+	for (i = 1; i < rounds; i++)
+		b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + i));
+	return _mm_aesenclast_si128(b, _mm_loadu_si128(rk + rounds));
+}
+
+static AESNI_FUNC void aesni_encrypt_one_block(struct tls_aes *aes, const void *data, void *dst)
+{
+	__m128i b = _mm_loadu_si128(data);
+	b = aesni_encrypt_1((const void*)aes->key, aes->rounds, b);
+	_mm_storeu_si128(dst, b);
+}
+
+static AESNI_FUNC void aesni_cbc_encrypt(struct tls_aes *aes, void *iv, const void *data, size_t len, void *dst)
+{
+	const __m128i *pt = data;
+	__m128i *ct = dst;
+	__m128i b = _mm_loadu_si128(iv);
+
+	/* CBC encryption is inherently serial */
+	while (len > 0) {
+		b = _mm_xor_si128(b, _mm_loadu_si128(pt));
+		b = aesni_encrypt_1((const void*)aes->key, aes->rounds, b);
+		_mm_storeu_si128(ct, b);
+		ct++;
+		pt++;
+		len -= 16;
+	}
+}
+
+static AESNI_FUNC void aesni_cbc_decrypt(struct tls_aes *aes, void *iv, const void *data, size_t len, void *dst)
+{
+	const __m128i *ek = (const void*)aes->key;
+	const __m128i *ct = data;
+	__m128i *pt = dst;
+	__m128i dk[15];
+	__m128i prev;
+	unsigned rounds = aes->rounds;
+	unsigned i;
+
+	/* Decryption round keys for the "equivalent inverse cipher" */
+	dk[0] = _mm_loadu_si128(ek + rounds);
+	for (i = 1; i < rounds; i++)
+		dk[i] = _mm_aesimc_si128(_mm_loadu_si128(ek + rounds - i));
+	dk[rounds] = _mm_loadu_si128(ek);
+
+	prev = _mm_loadu_si128(iv);
+	/* Blocks are independent: decrypt four at once to fill the pipeline.
+	 * Caller may have dst == data - 16: load all four before storing.
+	 */
+	while (len >= 4 * 16) {
+		__m128i c0 = _mm_loadu_si128(ct + 0);
+		__m128i c1 = _mm_loadu_si128(ct + 1);
+		__m128i c2 = _mm_loadu_si128(ct + 2);
+		__m128i c3 = _mm_loadu_si128(ct + 3);
+		__m128i b0 = _mm_xor_si128(c0, dk[0]);
+		__m128i b1 = _mm_xor_si128(c1, dk[0]);
+		__m128i b2 = _mm_xor_si128(c2, dk[0]);
+		__m128i b3 = _mm_xor_si128(c3, dk[0]);
+		for (i = 1; i < rounds; i++) {
+			b0 = _mm_aesdec_si128(b0, dk[i]);
+			b1 = _mm_aesdec_si128(b1, dk[i]);
+			b2 = _mm_aesdec_si128(b2, dk[i]);
+			b3 = _mm_aesdec_si128(b3, dk[i]);
+		}
+		b0 = _mm_aesdeclast_si128(b0, dk[rounds]);
+		b1 = _mm_aesdeclast_si128(b1, dk[rounds]);
+		b2 = _mm_aesdeclast_si128(b2, dk[rounds]);
+		b3 = _mm_aesdeclast_si128(b3, dk[rounds]);
+		_mm_storeu_si128(pt + 0, _mm_xor_si128(b0, prev));
+		_mm_storeu_si128(pt + 1, _mm_xor_si128(b1, c0));
+		_mm_storeu_si128(pt + 2, _mm_xor_si128(b2, c1));
+		_mm_storeu_si128(pt + 3, _mm_xor_si128(b3, c2));
+		prev = c3;
+		ct += 4;
+		pt += 4;
+		len -= 4 * 16;
+	}
+	while (len > 0) {
+		__m128i c = _mm_loadu_si128(ct);
+		__m128i b = _mm_xor_si128(c, dk[0]);
+		for (i = 1; i < rounds; i++)
+			b = _mm_aesdec_si128(b, dk[i]);
+		b = _mm_aesdeclast_si128(b, dk[rounds]);
+		_mm_storeu_si128(pt, _mm_xor_si128(b, prev));
+		prev = c;
+		ct++;
+		pt++;
+		len -= 16;
+	}
+}
+#endif
+
 void FAST_FUNC aes_setkey(struct tls_aes *aes, const void *key, unsigned key_len)
 {
 	aes->rounds = KeyExpansion(aes->key, key, key_len);
+#if TLS_X86_HWACCEL
+	{
+		int ni = aesNI;
+		if (!ni)
+			ni = get_aesNI();
+		if (ni > 0) {
+			unsigned i;
+			for (i = 0; i < (aes->rounds + 1) * 4; i++)
+				aes->key[i] = SWAP_BE32(aes->key[i]);
+		}
+	}
+#endif
 }
 
 void FAST_FUNC aes_encrypt_one_block(struct tls_aes *aes, const void *data, void *dst)
@@ -356,6 +499,12 @@ void FAST_FUNC aes_encrypt_one_block(struct tls_aes *aes, const void *data, void
 	const uint8_t *pt = data;
 	uint8_t *ct = dst;
 
+#if TLS_X86_HWACCEL
+	if (aesNI > 0) {
+		aesni_encrypt_one_block(aes, data, dst);
+		return;
+	}
+#endif
 	for (i = 0; i < 16; i++)
 		astate[i] = pt[i];
 	aes_encrypt_1(aes, astate);
@@ -370,6 +519,12 @@ void FAST_FUNC aes_cbc_encrypt(struct tls_aes *aes, void *iv, const void *data,
 	const uint8_t *pt = data;
 	uint8_t *ct = dst;
 
+#if TLS_X86_HWACCEL
+	if (aesNI > 0) {
+		aesni_cbc_encrypt(aes, iv, data, len, dst);
+		return;
+	}
+#endif
 	memcpy(iv2, iv, 16);
 	while (len > 0) {
 		{
@@ -438,6 +593,12 @@ void FAST_FUNC aes_cbc_decrypt(struct tls_aes *aes, void *iv, const void *data,
 	const uint8_t *ct = data;
 	uint8_t *pt = dst;
 
+#if TLS_X86_HWACCEL
+	if (aesNI > 0) {
+		aesni_cbc_decrypt(aes, iv, data, len, dst);
+		return;
+	}
+#endif
 	ivbuf = memcpy(iv2, iv, 16);
 	while (len) {
 		ivnext = (ivbuf==iv2) ? iv3 : iv2;
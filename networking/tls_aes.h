@@ -12,3 +12,13 @@ void aes_encrypt_one_block(struct tls_aes *aes, const void *data, void *dst) FAS
 
 void aes_cbc_encrypt(struct tls_aes *aes, void *iv, const void *data, size_t len, void *dst) FAST_FUNC;
 void aes_cbc_decrypt(struct tls_aes *aes, void *iv, const void *data, size_t len, void *dst) FAST_FUNC;
+
+#if TLS_X86_HWACCEL
+/* Bits in ECX of CPUID leaf 1 */
+enum {
+	CPUID1_ECX_PCLMUL = 1 << 1,
+	CPUID1_ECX_SSSE3  = 1 << 9,
+	CPUID1_ECX_AES    = 1 << 25,
+};
+int x86_cpuid1_ecx_has(unsigned bits) FAST_FUNC;
+#endif
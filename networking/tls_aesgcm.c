@@ -131,6 +131,112 @@ static void GMULT(byte* X, byte* Y)
 // This allows some simplifications.
 #define aSz 13
 #define sSz AES_BLOCK_SIZE
+#if TLS_X86_HWACCEL
+# include <emmintrin.h>
+# include <tmmintrin.h>
+# include <wmmintrin.h>
+
+/* 1: use PCLMULQDQ, -1: do not, 0: not yet known */
+static smallint pclmulqdq;
+static NOINLINE int get_pclmulqdq(void)
+{
+	pclmulqdq = x86_cpuid1_ecx_has(CPUID1_ECX_PCLMUL | CPUID1_ECX_SSSE3) ? 1 : -1;
+	return pclmulqdq;
+}
+
+#define PCLMUL_FUNC __attribute__((target("pclmul,ssse3")))
+
+/* GF(2^128) multiply of byte-reflected operands, from
+ * "Intel Carry-Less Multiplication Instruction and its Usage
+ * for Computing the GCM Mode", Algorithm 5 (shift-left-by-1 variant)
+ */
+static PCLMUL_FUNC ALWAYS_INLINE __m128i gfmul(__m128i a, __m128i b)
+{
+	__m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+	/* 256-bit carry-less product <t6:t3> = a * b */
+	t3 = _mm_clmulepi64_si128(a, b, 0x00);
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t6 = _mm_clmulepi64_si128(a, b, 0x11);
+	t4 = _mm_xor_si128(t4, t5);
+	t5 = _mm_slli_si128(t4, 8);
+	t4 = _mm_srli_si128(t4, 8);
+	t3 = _mm_xor_si128(t3, t5);
+	t6 = _mm_xor_si128(t6, t4);
+
+	/* shift <t6:t3> left by one bit (operands are bit-reflected) */
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+	return _mm_xor_si128(t6, t3);
+}
+
+static PCLMUL_FUNC void GHASH_pclmul(const byte* h,
+    const byte* a,
+    const byte* c, unsigned cSz,
+    byte* s)
+{
+    const __m128i bswap = _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+    __m128i H, X;
+    unsigned blocks, partial;
+
+    H = _mm_shuffle_epi8(_mm_loadu_si128((const void*)h), bswap);
+
+    /* a[] is 16 bytes long, 13 bytes of AAD and 3 zero bytes */
+    X = _mm_shuffle_epi8(_mm_loadu_si128((const void*)a), bswap);
+    X = gfmul(X, H);
+
+    blocks = cSz / AES_BLOCK_SIZE;
+    partial = cSz % AES_BLOCK_SIZE;
+    while (blocks--) {
+        __m128i C = _mm_shuffle_epi8(_mm_loadu_si128((const void*)c), bswap);
+        X = gfmul(_mm_xor_si128(X, C), H);
+        c += AES_BLOCK_SIZE;
+    }
+    if (partial != 0) {
+        byte scratch[AES_BLOCK_SIZE];
+        __m128i C;
+        memset(scratch, 0, AES_BLOCK_SIZE);
+        memcpy(scratch, c, partial);
+        C = _mm_shuffle_epi8(_mm_loadu_si128((const void*)scratch), bswap);
+        X = gfmul(_mm_xor_si128(X, C), H);
+    }
+
+    /* Lengths of A and C in bits, as two big-endian 64-bit numbers
+     * (byte-reflected: high qword is len(A), low qword is len(C))
+     */
+    X = _mm_xor_si128(X, _mm_set_epi32(0, aSz * 8, 0, cSz * 8));
+    X = gfmul(X, H);
+
+    _mm_storeu_si128((void*)s, _mm_shuffle_epi8(X, bswap));
+}
+#endif
+
 void FAST_FUNC aesgcm_GHASH(byte* h,
     const byte* a, //unsigned aSz,
     const byte* c, unsigned cSz,
@@ -142,6 +248,18 @@ void FAST_FUNC aesgcm_GHASH(byte* h,
     unsigned blocks, partial;
     //was: byte* h = aes->H;
 
+#if TLS_X86_HWACCEL
+    {
+        int ni = pclmulqdq;
+        if (!ni)
+            ni = get_pclmulqdq();
+        if (ni > 0) {
+            GHASH_pclmul(h, a, c, cSz, s);
+            return;
+        }
+    }
+#endif
+
     //XMEMSET(x, 0, AES_BLOCK_SIZE);
 
     /* Hash in A, the Additional Authentication Data */
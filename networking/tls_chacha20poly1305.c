@@ -0,0 +1,290 @@
+/*
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ *
+ * ChaCha20 and Poly1305 as used by TLS AEAD ciphers (RFC 8439, RFC 7905).
+ */
+#include "tls.h"
+
+/* ChaCha20 keystream is generated for CHACHA_LANES consecutive blocks
+ * at once. Each element of the state holds the same word of all blocks,
+ * so that quarter rounds are plain vertical add/xor/rotate operations,
+ * which the compiler maps to SIMD registers where the CPU has them
+ * (SSE2 on x86-64, NEON on arm64), and to scalar ops elsewhere.
+ */
+#if defined(__GNUC__)
+# define CHACHA_LANES 4
+typedef uint32_t chacha_vec __attribute__((vector_size(4 * CHACHA_LANES)));
+# define VEC_BCAST(w)   ((chacha_vec){ (w), (w), (w), (w) })
+# define VEC_LANENUM    ((chacha_vec){ 0, 1, 2, 3 })
+# define VEC_LANE(v, n) ((v)[n])
+#else
+# define CHACHA_LANES 1
+typedef uint32_t chacha_vec;
+# define VEC_BCAST(w)   (w)
+# define VEC_LANENUM    0
+# define VEC_LANE(v, n) (v)
+#endif
+#define CHACHA_BLOCKSIZE 64
+#define CHACHA_CHUNK     (CHACHA_LANES * CHACHA_BLOCKSIZE)
+
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a, b, c, d) do { \
+	x[a] += x[b]; x[d] ^= x[a]; x[d] = ROTL(x[d], 16); \
+	x[c] += x[d]; x[b] ^= x[c]; x[b] = ROTL(x[b], 12); \
+	x[a] += x[b]; x[d] ^= x[a]; x[d] = ROTL(x[d], 8); \
+	x[c] += x[d]; x[b] ^= x[c]; x[b] = ROTL(x[b], 7); \
+} while (0)
+
+/* Keystream for blocks counter..counter+CHACHA_LANES-1 */
+static void chacha20_blocks(const uint32_t state[16], uint32_t counter, uint8_t out[CHACHA_CHUNK])
+{
+	chacha_vec s[16];
+	chacha_vec x[16];
+	int i, b;
+
+	for (i = 0; i < 16; i++)
+		s[i] = VEC_BCAST(state[i]);
+	s[12] = VEC_BCAST(counter) + VEC_LANENUM;
+	memcpy(x, s, sizeof(x));
+
+	for (i = 0; i < 10; i++) {
+		QR(0, 4,  8, 12);
+		QR(1, 5,  9, 13);
+		QR(2, 6, 10, 14);
+		QR(3, 7, 11, 15);
+		QR(0, 5, 10, 15);
+		QR(1, 6, 11, 12);
+		QR(2, 7,  8, 13);
+		QR(3, 4,  9, 14);
+	}
+
+	for (i = 0; i < 16; i++)
+		x[i] += s[i];
+	for (b = 0; b < CHACHA_LANES; b++) {
+		for (i = 0; i < 16; i++) {
+			put_unaligned_le32(VEC_LANE(x[i], b), out);
+			out += 4;
+		}
+	}
+}
+#undef QR
+#undef ROTL
+
+static void chacha20_init(uint32_t state[16], const uint8_t key[32], const uint8_t nonce[12])
+{
+	int i;
+
+	state[0] = 0x61707865; /* "expand 32-byte k" */
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		state[4 + i] = get_unaligned_le32(key + i * 4);
+	/* state[12] is the block counter */
+	for (i = 0; i < 3; i++)
+		state[13 + i] = get_unaligned_le32(nonce + i * 4);
+}
+
+/* XOR buf[] with keystream starting at block 1
+ * (block 0 is used to make Poly1305 key)
+ */
+static void chacha20_xor(const uint32_t state[16], uint8_t *buf, unsigned len)
+{
+	uint8_t ks[CHACHA_CHUNK] ALIGNED_long;
+	uint32_t counter = 1;
+
+	while (len != 0) {
+		unsigned n = len < CHACHA_CHUNK ? len : CHACHA_CHUNK;
+		chacha20_blocks(state, counter, ks);
+		counter += CHACHA_LANES;
+		xorbuf(buf, ks, n);
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Poly1305 with 26-bit limbs (after poly1305-donna, public domain) */
+struct poly1305 {
+	uint32_t r[5];
+	uint32_t h[5];
+	uint32_t pad[4];
+};
+
+static void poly1305_init(struct poly1305 *st, const uint8_t key[32])
+{
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	st->r[0] = (get_unaligned_le32(key +  0)     ) & 0x3ffffff;
+	st->r[1] = (get_unaligned_le32(key +  3) >> 2) & 0x3ffff03;
+	st->r[2] = (get_unaligned_le32(key +  6) >> 4) & 0x3ffc0ff;
+	st->r[3] = (get_unaligned_le32(key +  9) >> 6) & 0x3f03fff;
+	st->r[4] = (get_unaligned_le32(key + 12) >> 8) & 0x00fffff;
+	memset(st->h, 0, sizeof(st->h));
+	st->pad[0] = get_unaligned_le32(key + 16);
+	st->pad[1] = get_unaligned_le32(key + 20);
+	st->pad[2] = get_unaligned_le32(key + 24);
+	st->pad[3] = get_unaligned_le32(key + 28);
+}
+
+/* Hash LEN bytes; a partial last block is zero-padded, as AEAD construction
+ * pads AAD and ciphertext to 16 bytes anyway
+ */
+static void poly1305_blocks(struct poly1305 *st, const uint8_t *m, unsigned len)
+{
+	const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], r3 = st->r[3], r4 = st->r[4];
+	const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+
+	while (len != 0) {
+		uint8_t tmp[16];
+		uint64_t d0, d1, d2, d3, d4;
+		uint32_t c;
+
+		if (len < 16) {
+			memset(tmp, 0, 16);
+			memcpy(tmp, m, len);
+			m = tmp;
+			len = 16;
+		}
+		/* h += m[i] */
+		h0 += (get_unaligned_le32(m +  0)     ) & 0x3ffffff;
+		h1 += (get_unaligned_le32(m +  3) >> 2) & 0x3ffffff;
+		h2 += (get_unaligned_le32(m +  6) >> 4) & 0x3ffffff;
+		h3 += (get_unaligned_le32(m +  9) >> 6) & 0x3ffffff;
+		h4 += (get_unaligned_le32(m + 12) >> 8) | (1 << 24);
+
+		/* h *= r */
+		d0 = ((uint64_t)h0 * r0) + ((uint64_t)h1 * s4) + ((uint64_t)h2 * s3) + ((uint64_t)h3 * s2) + ((uint64_t)h4 * s1);
+		d1 = ((uint64_t)h0 * r1) + ((uint64_t)h1 * r0) + ((uint64_t)h2 * s4) + ((uint64_t)h3 * s3) + ((uint64_t)h4 * s2);
+		d2 = ((uint64_t)h0 * r2) + ((uint64_t)h1 * r1) + ((uint64_t)h2 * r0) + ((uint64_t)h3 * s4) + ((uint64_t)h4 * s3);
+		d3 = ((uint64_t)h0 * r3) + ((uint64_t)h1 * r2) + ((uint64_t)h2 * r1) + ((uint64_t)h3 * r0) + ((uint64_t)h4 * s4);
+		d4 = ((uint64_t)h0 * r4) + ((uint64_t)h1 * r3) + ((uint64_t)h2 * r2) + ((uint64_t)h3 * r1) + ((uint64_t)h4 * r0);
+
+		/* (partial) h %= p */
+		              c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+		d1 += c;      c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+		d2 += c;      c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+		d3 += c;      c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+		d4 += c;      c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+		h0 += c * 5;  c = (h0 >> 26);           h0 = h0 & 0x3ffffff;
+		h1 += c;
+
+		m += 16;
+		len -= 16;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+	st->h[3] = h3;
+	st->h[4] = h4;
+}
+
+static void poly1305_finish(struct poly1305 *st, uint8_t mac[16])
+{
+	uint32_t h0, h1, h2, h3, h4, c;
+	uint32_t g0, g1, g2, g3, g4;
+	uint32_t mask;
+	uint64_t f;
+
+	/* fully carry h */
+	h0 = st->h[0];
+	h1 = st->h[1];
+	h2 = st->h[2];
+	h3 = st->h[3];
+	h4 = st->h[4];
+	             c = h1 >> 26; h1 &= 0x3ffffff;
+	h2 +=     c; c = h2 >> 26; h2 &= 0x3ffffff;
+	h3 +=     c; c = h3 >> 26; h3 &= 0x3ffffff;
+	h4 +=     c; c = h4 >> 26; h4 &= 0x3ffffff;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+	h1 +=     c;
+
+	/* compute h + -p */
+	g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+	g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+	g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+	g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+	g4 = h4 + c - (1 << 26);
+
+	/* select h if h < p, or h + -p if h >= p */
+	mask = (g4 >> 31) - 1;
+	g0 &= mask;
+	g1 &= mask;
+	g2 &= mask;
+	g3 &= mask;
+	g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	/* h = h % (2^128) */
+	h0 = ((h0      ) | (h1 << 26));
+	h1 = ((h1 >>  6) | (h2 << 20));
+	h2 = ((h2 >> 12) | (h3 << 14));
+	h3 = ((h3 >> 18) | (h4 <<  8));
+
+	/* mac = (h + pad) % (2^128) */
+	f = (uint64_t)h0 + st->pad[0]            ; h0 = (uint32_t)f;
+	f = (uint64_t)h1 + st->pad[1] + (f >> 32); h1 = (uint32_t)f;
+	f = (uint64_t)h2 + st->pad[2] + (f >> 32); h2 = (uint32_t)f;
+	f = (uint64_t)h3 + st->pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+	put_unaligned_le32(h0, mac +  0);
+	put_unaligned_le32(h1, mac +  4);
+	put_unaligned_le32(h2, mac +  8);
+	put_unaligned_le32(h3, mac + 12);
+}
+
+/* RFC 8439 2.8: Poly1305 over aad | pad16 | ciphertext | pad16 | lengths */
+static void chacha20poly1305_tag(const uint32_t state[16],
+		const uint8_t *aad, unsigned aad_len,
+		const uint8_t *ct, unsigned ct_len,
+		uint8_t tag[16])
+{
+	uint8_t ks[CHACHA_CHUNK] ALIGNED_long;
+	uint8_t lengths[16];
+	struct poly1305 st;
+
+	/* one-time Poly1305 key is the first 32 bytes of block 0 */
+	chacha20_blocks(state, 0, ks);
+	poly1305_init(&st, ks);
+	poly1305_blocks(&st, aad, aad_len);
+	poly1305_blocks(&st, ct, ct_len);
+	put_unaligned_le32(aad_len, lengths + 0);
+	put_unaligned_le32(0,       lengths + 4);
+	put_unaligned_le32(ct_len,  lengths + 8);
+	put_unaligned_le32(0,       lengths + 12);
+	poly1305_blocks(&st, lengths, 16);
+	poly1305_finish(&st, tag);
+}
+
+void FAST_FUNC chacha20poly1305_encrypt(const uint8_t key[32], const uint8_t nonce[12],
+		const uint8_t *aad, unsigned aad_len,
+		uint8_t *buf, unsigned len,
+		uint8_t tag[16])
+{
+	uint32_t state[16];
+
+	chacha20_init(state, key, nonce);
+	chacha20_xor(state, buf, len);
+	chacha20poly1305_tag(state, aad, aad_len, buf, len, tag);
+}
+
+int FAST_FUNC chacha20poly1305_decrypt(const uint8_t key[32], const uint8_t nonce[12],
+		const uint8_t *aad, unsigned aad_len,
+		uint8_t *buf, unsigned len,
+		const uint8_t tag[16])
+{
+	uint32_t state[16];
+	uint8_t mytag[16];
+
+	chacha20_init(state, key, nonce);
+	chacha20poly1305_tag(state, aad, aad_len, buf, len, mytag);
+	if (memcmpct(mytag, tag, 16) != 0)
+		return -1;
+	chacha20_xor(state, buf, len);
+	return 0;
+}
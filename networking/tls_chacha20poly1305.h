@@ -0,0 +1,15 @@
+/*
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ */
+
+/* Encrypt/decrypt buf[len] in place. Decryption checks the tag first,
+ * returns nonzero (and leaves buf[] unchanged) if it does not match.
+ */
+void chacha20poly1305_encrypt(const uint8_t key[32], const uint8_t nonce[12],
+	const uint8_t *aad, unsigned aad_len,
+	uint8_t *buf, unsigned len,
+	uint8_t tag[16]) FAST_FUNC;
+int chacha20poly1305_decrypt(const uint8_t key[32], const uint8_t nonce[12],
+	const uint8_t *aad, unsigned aad_len,
+	uint8_t *buf, unsigned len,
+	const uint8_t tag[16]) FAST_FUNC;
@@ -39,6 +39,26 @@
 //config:	help
 //config:	Support authenticated HTTP transfers.
 //config:
+//config:config FEATURE_WGET_KEEPALIVE
+//config:	bool "Reuse connection for several URLs (+1k)"
+//config:	default y
+//config:	depends on WGET
+//config:	help
+//config:	When more URLs follow on the command line, ask the server
+//config:	to keep the connection open, and send the next request
+//config:	over it if it goes to the same server. This saves
+//config:	a TCP (and TLS) handshake per file.
+//config:
+//config:config FEATURE_WGET_PARALLEL
+//config:	bool "Enable parallel downloads -j N (+1k)"
+//config:	default y
+//config:	depends on WGET && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	With -j N, a big file is fetched over N connections at once,
+//config:	each one downloading its own byte range (if server supports
+//config:	ranges), and several URLs are fetched concurrently by up to
+//config:	N processes. This helps on links with high latency.
+//config:
 //config:config FEATURE_WGET_TIMEOUT
 //config:	bool "Enable timeout option -T SEC"
 //config:	default y
@@ -144,11 +164,11 @@
 //usage:       "	"IF_FEATURE_TLS_SCHANNEL("[--no-check-certificate] ")"[-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" URL..."
 //usage:	)
 //usage:	IF_PLATFORM_POSIX(
-//usage:       "	"IF_FEATURE_WGET_OPENSSL("[--no-check-certificate] ")"[-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" URL..."
+//usage:       "	"IF_FEATURE_WGET_OPENSSL("[--no-check-certificate] ")"[-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")IF_FEATURE_WGET_PARALLEL(" [-j N]")" URL..."
 //usage:	)
 //usage:	)
 //usage:	IF_NOT_FEATURE_WGET_LONG_OPTIONS(
-//usage:       "[-cqS] [-O FILE] [-o LOGFILE] [-Y on/off] [-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" URL..."
+//usage:       "[-cqS] [-O FILE] [-o LOGFILE] [-Y on/off] [-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")IF_FEATURE_WGET_PARALLEL(" [-j N]")" URL..."
 //usage:	)
 //usage:#define wget_full_usage "\n\n"
 //usage:       "Retrieve files via HTTP or FTP\n"
@@ -171,6 +191,10 @@
 //usage:	IF_FEATURE_WGET_TIMEOUT(
 //usage:     "\n	-T SEC		Network read timeout is SEC seconds"
 //usage:	)
+//usage:	IF_FEATURE_WGET_PARALLEL(
+//usage:     "\n	-j N		Use up to N connections: split big files,"
+//usage:     "\n			fetch several URLs at once"
+//usage:	)
 //usage:     "\n	-O FILE		Save to FILE ('-' for stdout)"
 //usage:     "\n	-o LOGFILE	Log messages to FILE"
 //usage:     "\n	-U STR		Use STR for User-Agent header"
@@ -193,6 +217,14 @@
 
 #define SSL_SUPPORTED (ENABLE_FEATURE_WGET_OPENSSL || ENABLE_FEATURE_WGET_HTTPS)
 #define FTPS_SUPPORTED (ENABLE_FEATURE_WGET_FTP && ENABLE_FEATURE_WGET_HTTPS)
+/* Internal TLS can run in our process, behind a stdio stream,
+ * instead of in a helper process talking to us over a socketpair
+ */
+#if ENABLE_FEATURE_WGET_HTTPS && ENABLE_FEATURE_TLS_INTERNAL && defined(HAVE_FOPENCOOKIE)
+# define TLS_IN_PROCESS 1
+#else
+# define TLS_IN_PROCESS 0
+#endif
 
 struct host_info {
 	char *allocated;
@@ -285,6 +317,25 @@ struct globals {
 #endif
 	smallint chunked;         /* chunked transfer encoding */
 	smallint got_clen;        /* got content-length: from server  */
+#if ENABLE_FEATURE_WGET_PARALLEL
+	unsigned jobs;            /* -j N; 0: we are one of parallel URL downloads */
+	off_t seg_end;            /* segment download process: range end + 1 */
+	pid_t *seg_pids;          /* processes fetching other segments, 0-terminated */
+#endif
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+	smallint ka_want;         /* more URLs follow, try to keep connection */
+	smallint keep_conn;       /* connection can be reused after this response */
+	FILE *ka_fp;              /* idle connection left by previous URL */
+	char *ka_server;          /* "proto://host:port" ka_fp is connected to */
+	len_and_sockaddr *ka_lsa; /* its address, to not resolve it again */
+#endif
+#if TLS_IN_PROCESS
+	smallint tls_nonblock;    /* TLS stream reads give up after a second */
+	/* Socket under the last TLS stream started. FTPS has two (control
+	 * and data), but only an HTTPS connection is kept for reuse, and
+	 * then it is the only TLS stream: reuse_connection() polls this */
+	int tls_fd;
+#endif
 	/* Local downloads do benefit from big buffer.
 	 * With 512 byte buffer, it was measured to be
 	 * an order of magnitude slower than with big one.
@@ -300,6 +351,11 @@ struct globals {
 } while (0)
 
 
+#if ENABLE_FEATURE_WGET_PARALLEL
+/* Don't split files into segments smaller than this */
+# define MIN_SEGMENT_SIZE (256 * 1024)
+#endif
+
 /* Must match option string! */
 enum {
 	WGET_OPT_CONTINUE   = (1 << 0),
@@ -313,11 +369,13 @@ enum {
 	WGET_OPT_NETWORK_READ_TIMEOUT = (1 << 8),
 	WGET_OPT_RETRIES    = (1 << 9),
 	WGET_OPT_nsomething = (1 << 10),
-	WGET_OPT_HEADER     = (1 << 11) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_POST_DATA  = (1 << 12) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_SPIDER     = (1 << 13) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_NO_CHECK_CERT = (1 << 14) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_POST_FILE  = (1 << 15) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_JOBS       = (1 << 11) * ENABLE_FEATURE_WGET_PARALLEL,
+	WGET_OPTBIT_HEADER  = 11 + ENABLE_FEATURE_WGET_PARALLEL,
+	WGET_OPT_HEADER     = (1 << (WGET_OPTBIT_HEADER + 0)) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_POST_DATA  = (1 << (WGET_OPTBIT_HEADER + 1)) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_SPIDER     = (1 << (WGET_OPTBIT_HEADER + 2)) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_NO_CHECK_CERT = (1 << (WGET_OPTBIT_HEADER + 3)) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_POST_FILE  = (1 << (WGET_OPTBIT_HEADER + 4)) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
 	/* hijack this bit for other than opts purposes: */
 	WGET_NO_FTRUNCATE   = (1 << 31)
 };
@@ -337,6 +395,12 @@ static void progress_meter(int flag)
 	if (option_mask32 & WGET_OPT_QUIET)
 		return;
 
+#if ENABLE_FEATURE_WGET_PARALLEL
+	/* Parallel downloads share the terminal */
+	if (G.jobs == 0)
+		return;
+#endif
+
 	/* Don't save progress to log file */
 	if (G.log_fd >= 0)
 		return;
@@ -468,6 +532,42 @@ static FILE *open_socket(len_and_sockaddr *lsa)
 	return fp;
 }
 
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+/* Returns the connection left open by the previous URL
+ * if it goes to the same server, else closes it
+ */
+static FILE *reuse_connection(const char *server_key)
+{
+	FILE *fp = G.ka_fp;
+
+	if (fp) {
+		struct pollfd pfd;
+
+		/* Socket readable (EOF) or hung up while idle:
+		 * server closed it. Find out before writing the request,
+		 * not by a failed write (and SIGPIPE).
+		 */
+		pfd.fd = fileno(fp);
+# if TLS_IN_PROCESS
+		/* In-process TLS stream has no fd of its own */
+		if (pfd.fd < 0)
+			pfd.fd = G.tls_fd;
+# endif
+		pfd.events = POLLIN;
+		if (strcmp(G.ka_server, server_key) != 0
+		 || poll(&pfd, 1, 0) != 0
+		) {
+			fclose(fp);
+			fp = NULL;
+		}
+		G.ka_fp = NULL;
+		free(G.ka_server);
+		G.ka_server = NULL;
+	}
+	return fp;
+}
+#endif
+
 /* We balk at any control chars in other side's messages.
  * This prevents nasty surprises (e.g. ESC sequences) in "Location:" URLs
  * and error messages.
@@ -788,9 +888,87 @@ static int spawn_https_helper_openssl(const char *host, unsigned port)
 #endif
 
 #if ENABLE_FEATURE_WGET_HTTPS
-# if !ENABLE_PLATFORM_MINGW32
-static void spawn_ssl_client(const char *host, int network_fd, int flags)
+# if TLS_IN_PROCESS
+static ssize_t tls_stream_read(void *cookie, char *buf, size_t size)
 {
+	tls_state_t *tls = cookie;
+
+	/* In retrieve_file_data(), act like a nonblocking fd would,
+	 * but wait for data for up to a second (it can't poll us)
+	 */
+	if (G.tls_nonblock && !tls_has_buffered_data(tls)) {
+		struct pollfd pfd;
+
+		pfd.fd = tls->ifd;
+		pfd.events = POLLIN;
+		if (safe_poll(&pfd, 1, 1000) == 0) {
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+	return tls_read_data(tls, buf, size < INT_MAX ? size : INT_MAX);
+}
+
+static ssize_t tls_stream_write(void *cookie, const char *buf, size_t size)
+{
+	tls_write_data(cookie, buf, size);
+	return size;
+}
+
+static int tls_stream_close(void *cookie)
+{
+	tls_state_t *tls = cookie;
+
+	if (G.tls_fd == tls->ifd)
+		G.tls_fd = -1;
+	close(tls->ifd);
+	tls_free(tls);
+	return 0;
+}
+
+/* Returns a stream for plaintext I/O over the connection fp.
+ * No fork, no extra copy of the data through a socketpair.
+ */
+static FILE *start_ssl_client(const char *host, FILE *fp, int flags UNUSED_PARAM)
+{
+	static const cookie_io_functions_t tls_stream_io = {
+		.read  = tls_stream_read,
+		.write = tls_stream_write,
+		.close = tls_stream_close,
+	};
+	tls_state_t *tls;
+	char *servername, *p;
+
+	if (!(option_mask32 & WGET_OPT_NO_CHECK_CERT)) {
+		option_mask32 |= WGET_OPT_NO_CHECK_CERT;
+		bb_simple_error_msg("note: TLS certificate validation not implemented");
+	}
+
+	servername = xstrdup(host);
+	p = strrchr(servername, ':');
+	if (p) *p = '\0';
+
+	tls = new_tls_state();
+	tls->ifd = tls->ofd = dup(fileno(fp));
+	if (tls->ifd < 0)
+		bb_simple_perror_msg_and_die("dup");
+	fclose(fp);
+
+	set_alarm();
+	tls_handshake(tls, servername);
+	clear_alarm();
+	free(servername);
+
+	fp = fopencookie(tls, "r+", tls_stream_io);
+	if (!fp)
+		bb_die_memory_exhausted();
+	G.tls_fd = tls->ifd;
+	return fp;
+}
+# elif !ENABLE_PLATFORM_MINGW32
+static FILE *start_ssl_client(const char *host, FILE *fp, int flags)
+{
+	int network_fd = fileno(fp);
 	int sp[2];
 	int pid;
 	char *servername, *p;
@@ -842,10 +1020,12 @@ static void spawn_ssl_client(const char *host, int network_fd, int flags)
 	free(servername);
 	close(sp[1]);
 	xmove_fd(sp[0], network_fd);
+	return fp;
 }
 # else
-static void spawn_ssl_client(const char *host, int network_fd, int flags)
+static FILE *start_ssl_client(const char *host, FILE *fp, int flags)
 {
+	int network_fd = fileno(fp);
 	int fd1;
 	char *servername, *p, *cmd;
 
@@ -873,6 +1053,7 @@ static void spawn_ssl_client(const char *host, int network_fd, int flags)
 	free(cmd);
 	free(servername);
 	xmove_fd(fd1, network_fd);
+	return fp;
 }
 # endif
 #endif
@@ -887,7 +1068,7 @@ static FILE* prepare_ftp_session(FILE **dfpp, struct host_info *target, len_and_
 	sfp = open_socket(lsa);
 #if FTPS_SUPPORTED
 	if (target->protocol == P_FTPS)
-		spawn_ssl_client(target->host, fileno(sfp), TLSLOOP_EXIT_ON_LOCAL_EOF);
+		sfp = start_ssl_client(target->host, sfp, TLSLOOP_EXIT_ON_LOCAL_EOF);
 #endif
 
 	if (ftpcmd(NULL, NULL, sfp) != 220)
@@ -947,7 +1128,7 @@ static FILE* prepare_ftp_session(FILE **dfpp, struct host_info *target, len_and_
 		 * Without it (or with "PROT C"), data is sent unencrypted.
 		 */
 		if (ftpcmd("PROT P", NULL, sfp) == 200)
-			spawn_ssl_client(target->host, fileno(*dfpp), /*flags*/ 0);
+			*dfpp = start_ssl_client(target->host, *dfpp, /*flags*/ 0);
 	}
 #endif
 
@@ -977,6 +1158,7 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 # endif
 	struct pollfd polldata;
 
+	/* -1 if dfp is an in-process TLS stream */
 	polldata.fd = fileno(dfp);
 	polldata.events = POLLIN | POLLPRI;
 #endif
@@ -1001,8 +1183,13 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 		 * Because of nonblocking I/O, we need to dance
 		 * very carefully around EAGAIN. See explanation at
 		 * clearerr() calls.
+		 * (In-process TLS stream has no fd, it uses tls_nonblock).
 		 */
-		ndelay_on(polldata.fd);
+		if (polldata.fd >= 0)
+			ndelay_on(polldata.fd);
+# if TLS_IN_PROCESS
+		G.tls_nonblock = 1;
+# endif
 #endif
 		while (1) {
 			int n;
@@ -1063,8 +1250,9 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 #if ENABLE_FEATURE_WGET_STATUSBAR || ENABLE_FEATURE_WGET_TIMEOUT
 			/* It was EAGAIN. There is no data. Wait up to one second
 			 * then abort if timed out, or update the bar and try reading again.
+			 * (TLS stream read has done this wait already).
 			 */
-			if (safe_poll(&polldata, 1, 1000) == 0) {
+			if (polldata.fd < 0 || safe_poll(&polldata, 1, 1000) == 0) {
 # if ENABLE_FEATURE_WGET_TIMEOUT
 				if (second_cnt != 0 && --second_cnt == 0) {
 					progress_meter(PROGRESS_END);
@@ -1086,7 +1274,11 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 
 #if ENABLE_FEATURE_WGET_STATUSBAR || ENABLE_FEATURE_WGET_TIMEOUT
 		clearerr(dfp);
-		ndelay_off(polldata.fd); /* else fgets can get very unhappy */
+		if (polldata.fd >= 0)
+			ndelay_off(polldata.fd); /* else fgets can get very unhappy */
+# if TLS_IN_PROCESS
+		G.tls_nonblock = 0;
+# endif
 #endif
 		if (!G.chunked)
 			break;
@@ -1104,8 +1296,15 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 		 */
 		if (G.content_len < 0 || errno)
 			bb_error_msg_and_die("bad chunk length '%s'", G.wget_buf);
-		if (G.content_len == 0)
+		if (G.content_len == 0) {
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+			/* Eat trailer headers, next response follows them */
+			if (G.keep_conn)
+				while (get_sanitized_hdr(dfp) != NULL)
+					continue;
+#endif
 			break; /* all done! */
+		}
 		G.got_clen = 1;
 		/*
 		 * Note that fgets may result in some data being buffered in dfp.
@@ -1125,6 +1324,19 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 		/* GNU wget says "DATE TIME (NN MB/s) - Connection closed at byte NNN. Retrying." */
 	}
 
+#if ENABLE_FEATURE_WGET_PARALLEL
+	if (G.seg_pids) {
+		/* The rest of the file is being written by other processes */
+		pid_t *pp;
+
+		for (pp = G.seg_pids; *pp; pp++) {
+			if (wait4pid(*pp) != 0)
+				bb_error_msg_and_die("can't download '%s'", G.fname_out);
+		}
+		free(G.seg_pids);
+		G.seg_pids = NULL;
+	} else
+#endif
 	/* If -c failed, we restart from the beginning,
 	 * but we do not truncate file then, we do it only now, at the end.
 	 * This lets user to ^C if his 99% complete 10 GB file download
@@ -1158,6 +1370,10 @@ static void download_one_url(const char *url)
 	FILE *dfp;                      /* socket to ftp server (data)      */
 	char *fname_out_alloc;
 	char *redirected_path = NULL;
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+	char *server_key = NULL;
+	FILE *reused = NULL;
+#endif
 	struct host_info server;
 	struct host_info target;
 
@@ -1223,7 +1439,20 @@ static void download_one_url(const char *url)
 
 	redir_limit = 16;
  resolve_lsa:
-	lsa = xhost2sockaddr(server.host, server.port);
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+	free(server_key);
+	server_key = xasprintf("%s://%s:%u",
+		server.protocol, server.host, server.port);
+	/* Server of the kept connection: we know its address */
+	lsa = G.ka_lsa;
+	G.ka_lsa = NULL;
+	if (lsa && strcmp(G.ka_server, server_key) != 0) {
+		free(lsa);
+		lsa = NULL;
+	}
+	if (!lsa)
+#endif
+		lsa = xhost2sockaddr(server.host, server.port);
 	if (!(option_mask32 & WGET_OPT_QUIET)) {
 		char *s = xmalloc_sockaddr2dotted(&lsa->u.sa);
 		fprintf(stderr, "Connecting to %s (%s)\n", server.host, s);
@@ -1241,7 +1470,17 @@ static void download_one_url(const char *url)
 		 */
 		char *str;
 		int status;
+#if ENABLE_FEATURE_WGET_PARALLEL
+		smallint ranges_ok = 0;
+#endif
 
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+		if (G.ka_want || G.ka_fp) {
+			sfp = reused = reuse_connection(server_key);
+			if (sfp)
+				goto socket_reused;
+		}
+#endif
 		/* Open socket to http(s) server */
 #if ENABLE_FEATURE_WGET_OPENSSL
 		/* openssl (and maybe internal TLS) support is configured */
@@ -1253,7 +1492,7 @@ static void download_one_url(const char *url)
 # if ENABLE_FEATURE_WGET_HTTPS
 			if (fd < 0) { /* no openssl? try internal */
 				sfp = open_socket(lsa);
-				spawn_ssl_client(server.host, fileno(sfp), /*flags*/ 0);
+				sfp = start_ssl_client(server.host, sfp, /*flags*/ 0);
 				goto socket_opened;
 			}
 # else
@@ -1270,7 +1509,7 @@ static void download_one_url(const char *url)
 		/* Only internal TLS support is configured */
 		sfp = open_socket(lsa);
 		if (server.protocol == P_HTTPS)
-			spawn_ssl_client(server.host, fileno(sfp), /*flags*/
+			sfp = start_ssl_client(server.host, sfp, /*flags*/
 #  if ENABLE_FEATURE_TLS_SCHANNEL
 				(option_mask32 & WGET_OPT_NO_CHECK_CERT) ?
 					TLS_NO_CHECK_CERTIFICATE :
@@ -1279,6 +1518,15 @@ static void download_one_url(const char *url)
 #else
 		/* ssl (https) support is not configured */
 		sfp = open_socket(lsa);
+#endif
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+ socket_reused:
+		G.keep_conn = G.ka_want;
+# if SSL_SUPPORTED
+		/* SSL helper's end of the connection gets shut down below */
+		if (target.protocol == P_HTTPS && fileno(sfp) >= 0)
+			G.keep_conn = 0;
+# endif
 #endif
 		/* Send HTTP request */
 		if (use_proxy) {
@@ -1295,6 +1543,11 @@ static void download_one_url(const char *url)
 		if (!USR_HEADER_USER_AGENT)
 			SENDFMT(sfp, "User-Agent: %s\r\n", G.user_agent);
 
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+		if (G.keep_conn)
+			SENDFMT(sfp, "Connection: keep-alive\r\n");
+		else
+#endif
 		/* Ask server to close the connection as soon as we are done
 		 * (IOW: we do not intend to send more requests)
 		 */
@@ -1311,6 +1564,12 @@ static void download_one_url(const char *url)
 		}
 #endif
 
+#if ENABLE_FEATURE_WGET_PARALLEL
+		if (G.seg_end != 0)
+			SENDFMT(sfp, "Range: bytes=%"OFF_FMT"u-%"OFF_FMT"u\r\n",
+				G.beg_range, G.seg_end - 1);
+		else
+#endif
 		if (G.beg_range != 0 && !USR_HEADER_RANGE)
 			SENDFMT(sfp, "Range: bytes=%"OFF_FMT"u-\r\n", G.beg_range);
 
@@ -1364,8 +1623,9 @@ static void download_one_url(const char *url)
  * Cloudflare and nginx/1.11.5 are shocked to see SHUT_WR on non-HTTPS.
  */
 #if SSL_SUPPORTED
-		if (target.protocol == P_HTTPS) {
-			/* If we use SSL helper, keeping our end of the socket open for writing
+		if (target.protocol == P_HTTPS && fileno(sfp) >= 0) {
+			/* (In-process TLS stream has no fd, and needs none of this)
+			 * If we use SSL helper, keeping our end of the socket open for writing
 			 * makes our end (i.e. the same fd!) readable (EAGAIN instead of EOF)
 			 * even after child closes its copy of the fd.
 			 * This helps:
@@ -1373,12 +1633,35 @@ static void download_one_url(const char *url)
 			shutdown(fileno(sfp), SHUT_WR);
 		}
 #endif
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+		if (reused) {
+			/* Server could close the idle connection
+			 * before it saw our request. Then, reconnect.
+			 */
+			int c;
+
+			reused = NULL;
+			set_alarm();
+			c = getc(sfp);
+			clear_alarm();
+			if (c == EOF) {
+				fclose(sfp);
+				goto establish_session;
+			}
+			ungetc(c, sfp);
+		}
+#endif
 
 		/*
 		 * Retrieve HTTP response line and check for "200" status code.
 		 */
  read_response:
 		fgets_trim_sanitize(sfp, "  %s\n");
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+		/* HTTP/1.0 servers close the connection by default */
+		if (strncmp(G.wget_buf, "HTTP/1.0", 8) == 0)
+			G.keep_conn = 0;
+#endif
 
 		str = G.wget_buf;
 		str = skip_non_whitespace(str);
@@ -1432,6 +1715,10 @@ However, in real world it was observed that some web servers
 (e.g. Boa/0.94.14rc21) simply use code 204 when file size is zero.
 */
 			if (G.beg_range != 0) {
+#if ENABLE_FEATURE_WGET_PARALLEL
+				if (G.seg_end != 0)
+					bb_error_msg_and_die("server ignored Range: %s", G.wget_buf);
+#endif
 				/* "Range:..." was not honored by the server.
 				 * Restart download from the beginning.
 				 */
@@ -1463,9 +1750,13 @@ However, in real world it was observed that some web servers
 		 */
 		while ((str = get_sanitized_hdr(sfp)) != NULL) {
 			static const char keywords[] ALIGN1 =
-				"content-length\0""transfer-encoding\0""location\0";
+				"content-length\0""transfer-encoding\0""location\0"
+				IF_FEATURE_WGET_KEEPALIVE("connection\0")
+				IF_FEATURE_WGET_PARALLEL("accept-ranges\0");
 			enum {
-				KEY_content_length = 1, KEY_transfer_encoding, KEY_location
+				KEY_content_length = 1, KEY_transfer_encoding, KEY_location,
+				KEY_connection = KEY_location + ENABLE_FEATURE_WGET_KEEPALIVE,
+				KEY_accept_ranges = KEY_connection + ENABLE_FEATURE_WGET_PARALLEL
 			};
 			smalluint key;
 
@@ -1491,6 +1782,14 @@ However, in real world it was observed that some web servers
 					bb_error_msg_and_die("transfer encoding '%s' is not supported", str);
 				G.chunked = 1;
 			}
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+			if (key == KEY_connection && strstr(str_tolower(str), "close"))
+				G.keep_conn = 0;
+#endif
+#if ENABLE_FEATURE_WGET_PARALLEL
+			if (key == KEY_accept_ranges && strcmp(str_tolower(str), "bytes") == 0)
+				ranges_ok = 1;
+#endif
 			if (key == KEY_location && status >= 300) {
 				if (--redir_limit == 0)
 					bb_simple_error_msg_and_die("too many redirections");
@@ -1520,6 +1819,73 @@ However, in real world it was observed that some web servers
 //		if (status >= 300)
 //			bb_error_msg_and_die("bad redirection (no Location: header from server)");
 
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+		/* 204 has no body, even if it has no Content-Length */
+		if (status == 204 && !G.chunked) {
+			G.content_len = 0;
+			G.got_clen = 1;
+		}
+		/* Body must end where next response begins */
+		if ((!G.got_clen && !G.chunked)
+		 || (option_mask32 & WGET_OPT_SPIDER)
+		) {
+			G.keep_conn = 0;
+		}
+#endif
+#if ENABLE_FEATURE_WGET_PARALLEL
+		if (G.jobs > 1 && ranges_ok && status == 200
+		 && G.got_clen && !G.chunked
+		 && !USR_HEADER_RANGE && G.output_fd != 1
+		 && !(option_mask32 & (WGET_OPT_SPIDER | WGET_OPT_POST))
+		) {
+			/* Split it: we read the first segment from sfp,
+			 * other processes request and write the others
+			 */
+			off_t total = G.content_len;
+			off_t seg_len;
+			unsigned nseg = G.jobs;
+
+			if (total / nseg < MIN_SEGMENT_SIZE)
+				nseg = total / MIN_SEGMENT_SIZE;
+			if (nseg > 1) {
+				unsigned i;
+
+				seg_len = total / nseg;
+				if (G.output_fd < 0)
+					G.output_fd = xopen(G.fname_out, G.o_flags);
+				G.seg_pids = xzalloc(nseg * sizeof(G.seg_pids[0]));
+				fflush_all();
+				for (i = 1; i < nseg; i++) {
+					pid_t pid = xfork();
+					if (pid == 0) {
+						/* Child: fetch i'th segment over a new connection */
+						fclose(sfp);
+						G.beg_range = i * seg_len;
+						G.seg_end = (i == nseg - 1) ? total : G.beg_range + seg_len;
+						free(G.seg_pids);
+						G.seg_pids = NULL;
+						G.jobs = 1;
+						/* Own file offset, not shared with the parent */
+						close(G.output_fd);
+						G.output_fd = xopen(G.fname_out, O_WRONLY);
+						xlseek(G.output_fd, G.beg_range, SEEK_SET);
+						option_mask32 |= WGET_OPT_QUIET | WGET_NO_FTRUNCATE;
+# if ENABLE_FEATURE_WGET_KEEPALIVE
+						G.ka_want = 0;
+# endif
+						goto establish_session;
+					}
+					G.seg_pids[i - 1] = pid;
+				}
+				G.content_len = seg_len;
+# if ENABLE_FEATURE_WGET_KEEPALIVE
+				/* Rest of the body is not read */
+				G.keep_conn = 0;
+# endif
+			}
+		}
+#endif
+
 		/* For HTTP, data is pumped over the same connection */
 		dfp = sfp;
 	}
@@ -1532,12 +1898,14 @@ However, in real world it was observed that some web servers
 	}
 #endif
 
-	free(lsa);
-
 	if (!(option_mask32 & WGET_OPT_SPIDER)) {
 		if (G.output_fd < 0)
 			G.output_fd = xopen(G.fname_out, G.o_flags);
 		retrieve_file_data(dfp);
+#if ENABLE_FEATURE_WGET_PARALLEL
+		if (G.seg_end != 0) /* we are a segment download process */
+			exit(EXIT_SUCCESS);
+#endif
 		if (!(option_mask32 & WGET_OPT_OUTNAME)) {
 			xclose(G.output_fd);
 			G.output_fd = -1;
@@ -1555,8 +1923,19 @@ However, in real world it was observed that some web servers
 			bb_error_msg_and_die("ftp error: %s", G.wget_buf);
 		/* ftpcmd("QUIT", NULL, sfp); - why bother? */
 	}
+#endif
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+	if (dfp == sfp && G.keep_conn) {
+		/* Keep it for the next URL */
+		G.ka_fp = sfp;
+		G.ka_server = server_key;
+		server_key = NULL;
+		G.ka_lsa = lsa;
+		lsa = NULL;
+	} else
 #endif
 	fclose(sfp);
+	free(lsa);
 
 	free(server.allocated);
 	free(target.allocated);
@@ -1564,7 +1943,41 @@ However, in real world it was observed that some web servers
 	free(target.user);
 	free(fname_out_alloc);
 	free(redirected_path);
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+	free(server_key);
+#endif
+}
+
+#if ENABLE_FEATURE_WGET_PARALLEL
+/* Download every URL in its own process, up to G.jobs at once */
+static int download_urls_in_parallel(char **argv)
+{
+	unsigned running = 0;
+	int rc = EXIT_SUCCESS;
+
+	while (*argv || running != 0) {
+		int status;
+
+		if (*argv && running < G.jobs) {
+			fflush_all();
+			if (xfork() == 0) {
+				G.jobs = 0;
+				download_one_url(*argv);
+				exit(EXIT_SUCCESS);
+			}
+			running++;
+			argv++;
+			continue;
+		}
+		if (safe_waitpid(-1, &status, 0) < 0)
+			bb_simple_perror_msg_and_die("wait");
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			rc = EXIT_FAILURE;
+	}
+	return rc;
 }
+#endif
 
 int wget_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int wget_main(int argc UNUSED_PARAM, char **argv)
@@ -1608,6 +2021,9 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 #if ENABLE_FEATURE_WGET_LONG_OPTIONS
 	llist_t *headers_llist = NULL;
 #endif
+#if ENABLE_FEATURE_WGET_PARALLEL
+	const char *jobs_str;
+#endif
 
 	INIT_G();
 
@@ -1617,6 +2033,9 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 #endif
 	G.proxy_flag = "on";   /* use proxies if env vars are set */
 	G.user_agent = "Wget"; /* "User-Agent" header field */
+#if ENABLE_FEATURE_WGET_PARALLEL
+	G.jobs = 1;
+#endif
 
 	GETOPT32(argv, "^"
 		"cqSO:o:P:Y:U:T:+"
@@ -1630,6 +2049,7 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 		 * "n::" above says that we accept -n[ARG].
 		 * Specifying "n:" would be a bug: "-n ARG" would eat ARG!
 		 */
+		IF_FEATURE_WGET_PARALLEL("j:")
 		"\0"
 		"-1" /* at least one URL */
 		IF_FEATURE_WGET_LONG_OPTIONS(":\xfe--\xfb")
@@ -1642,6 +2062,7 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 		IF_FEATURE_WGET_TIMEOUT(&G.timeout_seconds) IF_NOT_FEATURE_WGET_TIMEOUT(NULL),
 		NULL, /* -t RETRIES */
 		NULL  /* -n[ARG] */
+		IF_FEATURE_WGET_PARALLEL(, &jobs_str)
 		IF_FEATURE_WGET_LONG_OPTIONS(, &headers_llist)
 		IF_FEATURE_WGET_LONG_OPTIONS(, &G.post_data)
 		IF_FEATURE_WGET_LONG_OPTIONS(, &G.post_file)
@@ -1658,6 +2079,11 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 #endif
 	argv += optind;
 
+#if ENABLE_FEATURE_WGET_PARALLEL
+	/* G.jobs == 0 has a special meaning, don't let -j 0 set it */
+	if (option_mask32 & WGET_OPT_JOBS)
+		G.jobs = xatou_range(jobs_str, 1, 1024);
+#endif
 #if ENABLE_FEATURE_WGET_LONG_OPTIONS
 	if (headers_llist) {
 		int size = 0;
@@ -1711,8 +2137,18 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 		}
 	}
 
-	while (*argv)
+#if ENABLE_FEATURE_WGET_PARALLEL
+	/* With -O FILE, all URLs go into one file, one after another */
+	if (G.jobs > 1 && argv[1] && !(option_mask32 & WGET_OPT_OUTNAME))
+		return download_urls_in_parallel(argv);
+#endif
+
+	while (*argv) {
+#if ENABLE_FEATURE_WGET_KEEPALIVE
+		G.ka_want = (argv[1] != NULL);
+#endif
 		download_one_url(*argv++);
+	}
 
 	if (G.output_fd >= 0)
 		xclose(G.output_fd);
@@ -1722,6 +2158,12 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 
 #if ENABLE_FEATURE_CLEAN_UP && ENABLE_FEATURE_WGET_LONG_OPTIONS
 	free(G.extra_headers);
+#endif
+#if ENABLE_FEATURE_CLEAN_UP && ENABLE_FEATURE_WGET_KEEPALIVE
+	if (G.ka_fp)
+		fclose(G.ka_fp);
+	free(G.ka_server);
+	free(G.ka_lsa);
 #endif
 	FINI_G();
 
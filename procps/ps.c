@@ -48,6 +48,14 @@
 //config:	bool "Enable -o rgroup, -o ruser, -o nice specifiers"
 //config:	default y
 //config:	depends on (PS || MINIPS) && DESKTOP
+//config:
+//config:config FEATURE_PS_JSON
+//config:	bool "Machine-readable output (-J)"
+//config:	default y
+//config:	depends on PS || MINIPS
+//config:	help
+//config:	Enable -J: print one JSON object per process, one per line,
+//config:	with the same fields as 'top -j' (except deltas).
 
 //                 APPLET_NOEXEC:name    main location    suid_type     help
 //applet:IF_PS(    APPLET_NOEXEC(ps,     ps,  BB_DIR_BIN, BB_SUID_DROP, ps))
@@ -59,17 +67,20 @@
 //usage:#if ENABLE_DESKTOP
 //usage:
 //usage:#define ps_trivial_usage
-//usage:       "[-o COL1,COL2=HEADER]" IF_FEATURE_SHOW_THREADS(" [-T]")
+//usage:       "[-o COL1,COL2=HEADER]" IF_FEATURE_SHOW_THREADS(" [-T]") IF_FEATURE_PS_JSON(" [-J]")
 //usage:#define ps_full_usage "\n\n"
 //usage:       "Show list of processes\n"
 //usage:     "\n	-o COL1,COL2=HEADER	Select columns for display"
 //usage:	IF_FEATURE_SHOW_THREADS(
 //usage:     "\n	-T			Show threads"
 //usage:	)
+//usage:	IF_FEATURE_PS_JSON(
+//usage:     "\n	-J			Print processes as JSON lines"
+//usage:	)
 //usage:
 //usage:#else /* !ENABLE_DESKTOP */
 //usage:
-//usage:#if !ENABLE_SELINUX && !ENABLE_FEATURE_PS_WIDE
+//usage:#if !ENABLE_SELINUX && !ENABLE_FEATURE_PS_WIDE && !ENABLE_FEATURE_PS_JSON
 //usage:#define USAGE_PS "\nThis version of ps accepts no options"
 //usage:#else
 //usage:#define USAGE_PS ""
@@ -92,6 +103,9 @@
 //usage:	IF_FEATURE_SHOW_THREADS(
 //usage:     "\n	T	Show threads"
 //usage:	)
+//usage:	IF_FEATURE_PS_JSON(
+//usage:     "\n	J	Print processes as JSON lines"
+//usage:	)
 //usage:
 //usage:#endif /* ENABLE_DESKTOP */
 //usage:
@@ -145,6 +159,28 @@ static unsigned long get_uptime(void)
 }
 #endif
 
+#if ENABLE_FEATURE_PS_JSON
+/* -J: records match "top -j", but a single snapshot has no deltas */
+static int ps_json(int psscan_flags)
+{
+	procps_status_t *p = NULL;
+	unsigned long long now = time(NULL);
+
+	psscan_flags |= PSSCAN_PID | PSSCAN_PPID | PSSCAN_UIDGID
+			| PSSCAN_STATE | PSSCAN_VSZ | PSSCAN_RSS
+			| PSSCAN_STIME | PSSCAN_UTIME | PSSCAN_START_TIME
+			| PSSCAN_COMM;
+	/* Print each record as soon as it is scanned */
+	while ((p = procps_scan(p, psscan_flags)) != NULL) {
+		json_proc_start(now, p->pid, p->ppid, p->uid, p->state, p->rss);
+		printf(",\"vsz\":%lu,\"start\":%lu,\"ticks\":%lu",
+			p->vsz, p->start_time, p->stime + p->utime);
+		json_proc_end(p->comm);
+	}
+	return EXIT_SUCCESS;
+}
+#endif
+
 #if ENABLE_DESKTOP
 /* TODO:
  * http://pubs.opengroup.org/onlinepubs/9699919799/utilities/ps.html
@@ -568,7 +604,7 @@ int ps_main(int argc UNUSED_PARAM, char **argv)
 	procps_status_t *p;
 	llist_t* opt_o = NULL;
 	char default_o[sizeof(DEFAULT_O_STR)];
-#if ENABLE_SELINUX || ENABLE_FEATURE_SHOW_THREADS
+#if ENABLE_SELINUX || ENABLE_FEATURE_SHOW_THREADS || ENABLE_FEATURE_PS_JSON
 	int opt;
 #endif
 	enum {
@@ -581,6 +617,7 @@ int ps_main(int argc UNUSED_PARAM, char **argv)
 		OPT_f = (1 << 6),
 		OPT_l = (1 << 7),
 		OPT_T = (1 << 8) * ENABLE_FEATURE_SHOW_THREADS,
+		OPT_J = (1 << (8 + ENABLE_FEATURE_SHOW_THREADS)) * ENABLE_FEATURE_PS_JSON,
 	};
 
 	INIT_G();
@@ -606,10 +643,14 @@ int ps_main(int argc UNUSED_PARAM, char **argv)
 	 * procps v3.2.7 supports -T and shows tids as SPID column,
 	 * it also supports -L where it shows tids as LWP column.
 	 */
-#if ENABLE_SELINUX || ENABLE_FEATURE_SHOW_THREADS
+#if ENABLE_SELINUX || ENABLE_FEATURE_SHOW_THREADS || ENABLE_FEATURE_PS_JSON
 	opt =
 #endif
-		getopt32(argv, "Zo:*aAdefl"IF_FEATURE_SHOW_THREADS("T"), &opt_o);
+		getopt32(argv, "Zo:*aAdefl"IF_FEATURE_SHOW_THREADS("T")IF_FEATURE_PS_JSON("J"), &opt_o);
+#if ENABLE_FEATURE_PS_JSON
+	if (opt & OPT_J)
+		return ps_json((opt & OPT_T) ? PSSCAN_TASKS : 0);
+#endif
 
 	if (opt_o) {
 		do {
@@ -669,20 +710,22 @@ int ps_main(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 		OPT_Z = (1 << 0) * ENABLE_SELINUX,
 		OPT_T = (1 << ENABLE_SELINUX) * ENABLE_FEATURE_SHOW_THREADS,
 		OPT_l = (1 << ENABLE_SELINUX) * (1 << ENABLE_FEATURE_SHOW_THREADS) * ENABLE_FEATURE_PS_LONG,
+		OPT_J = (1 << ENABLE_SELINUX) * (1 << ENABLE_FEATURE_SHOW_THREADS) * (1 << ENABLE_FEATURE_PS_LONG) * ENABLE_FEATURE_PS_JSON,
 	};
 #if ENABLE_FEATURE_PS_LONG
 	time_t now = now; /* for compiler */
 	unsigned long uptime = uptime;
 #endif
 	/* If we support any options, parse argv */
-#if ENABLE_SELINUX || ENABLE_FEATURE_SHOW_THREADS || ENABLE_FEATURE_PS_WIDE || ENABLE_FEATURE_PS_LONG
+#if ENABLE_SELINUX || ENABLE_FEATURE_SHOW_THREADS || ENABLE_FEATURE_PS_WIDE || ENABLE_FEATURE_PS_LONG \
+ || ENABLE_FEATURE_PS_JSON
 	int opts = 0;
 # if ENABLE_FEATURE_PS_WIDE
 	/* -w is a bit complicated */
 	int w_count = 0;
 	make_all_argv_opts(argv);
 	opts = getopt32(argv, "^"
-		IF_SELINUX("Z")IF_FEATURE_SHOW_THREADS("T")IF_FEATURE_PS_LONG("l")"w"
+		IF_SELINUX("Z")IF_FEATURE_SHOW_THREADS("T")IF_FEATURE_PS_LONG("l")IF_FEATURE_PS_JSON("J")"w"
 		"\0" "ww",
 		&w_count
 	);
@@ -700,7 +743,11 @@ int ps_main(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 # else
 	/* -w is not supported, only -Z and/or -T */
 	make_all_argv_opts(argv);
-	opts = getopt32(argv, IF_SELINUX("Z")IF_FEATURE_SHOW_THREADS("T")IF_FEATURE_PS_LONG("l"));
+	opts = getopt32(argv, IF_SELINUX("Z")IF_FEATURE_SHOW_THREADS("T")IF_FEATURE_PS_LONG("l")IF_FEATURE_PS_JSON("J"));
+# endif
+# if ENABLE_FEATURE_PS_JSON
+	if (opts & OPT_J)
+		return ps_json((opts & OPT_T) ? PSSCAN_TASKS : 0);
 # endif
 
 # if ENABLE_SELINUX
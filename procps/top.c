@@ -110,6 +110,15 @@
 //config:	depends on TOP
 //config:	help
 //config:	Enable 's' in top (gives lots of memory info).
+//config:
+//config:config FEATURE_TOP_JSON
+//config:	bool "Machine-readable output (-j)"
+//config:	default y
+//config:	depends on TOP
+//config:	help
+//config:	Enable -j: print memory, CPU and per-process counters
+//config:	as JSON objects, one per line, at every update.
+//config:	This is cheaper to collect and parse than the screen.
 
 //applet:IF_TOP(APPLET(top, BB_DIR_USR_BIN, BB_SUID_DROP))
 
@@ -128,6 +137,7 @@ typedef struct top_status_t {
 	unsigned long memsize;
 #if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
 	unsigned long ticks;
+	unsigned long start_time;
 	unsigned pcpu; /* delta of ticks */
 #endif
 	unsigned pid, ppid;
@@ -151,6 +161,7 @@ typedef struct jiffy_counts_t {
    the next. Used for finding deltas. */
 typedef struct save_hist {
 	unsigned long ticks;
+	unsigned long start_time; /* if it differs, pid was reused */
 	pid_t pid;
 } save_hist;
 
@@ -231,9 +242,11 @@ enum {
 	OPT_b = (1 << 2),
 	OPT_H = (1 << 3),
 	OPT_m = (1 << 4),
-	OPT_EOF = (1 << 5), /* pseudo: "we saw EOF in stdin" */
+	OPT_j = (1 << 5),
+	OPT_EOF = (1 << 6), /* pseudo: "we saw EOF in stdin" */
 };
 #define OPT_BATCH_MODE (option_mask32 & OPT_b)
+#define OPT_JSON (ENABLE_FEATURE_TOP_JSON && (option_mask32 & OPT_j))
 
 
 #if ENABLE_FEATURE_TOP_INTERACTIVE
@@ -385,6 +398,7 @@ static void do_stats(void)
 		 */
 		pid = cur->pid;
 		new_hist[n].ticks = cur->ticks;
+		new_hist[n].start_time = cur->start_time;
 		new_hist[n].pid = pid;
 
 		/* find matching entry from previous pass */
@@ -394,8 +408,11 @@ static void do_stats(void)
 		last_i = i;
 		if (prev_hist_count) do {
 			if (prev_hist[i].pid == pid) {
-				cur->pcpu = cur->ticks - prev_hist[i].ticks;
-				total_pcpu += cur->pcpu;
+				/* Not a new process with the same pid? */
+				if (prev_hist[i].start_time == cur->start_time) {
+					cur->pcpu = cur->ticks - prev_hist[i].ticks;
+					total_pcpu += cur->pcpu;
+				}
 				break;
 			}
 			i = (i+1) % prev_hist_count;
@@ -442,6 +459,8 @@ static void print_line_bold(void)
 
 static void print_end(void)
 {
+	if (OPT_JSON) /* each line is a complete record */
+		return;
 	fputs_stdout(OPT_BATCH_MODE ? "\n" : CLREOS"\r");
 	/* next print will be "first line" (will clear the screen) */
 	G.first_line_printed = 0;
@@ -811,13 +830,109 @@ static NOINLINE void display_process_list(void)
 #undef CALC_STAT
 #undef FMT
 
+#if ENABLE_FEATURE_TOP_JSON
+/* -j: unsorted, unscaled, all processes, one JSON object per line */
+static NOINLINE void display_process_list_json(void)
+{
+	unsigned long meminfo[MI_MAX];
+	unsigned long long now = time(NULL);
+	top_status_t *s;
+	int n;
+
+	/* Memory is in kbytes, CPU and process times in clock ticks */
+	parse_meminfo(meminfo);
+	printf("{\"time\":%llu,\"type\":\"mem\",\"total\":%lu,\"free\":%lu"
+		",\"shared\":%lu,\"buffers\":%lu,\"cached\":%lu"
+		",\"swap_total\":%lu,\"swap_free\":%lu}\n",
+		now,
+		meminfo[MI_MEMTOTAL], meminfo[MI_MEMFREE],
+		meminfo[MI_MEMSHARED] + meminfo[MI_SHMEM],
+		meminfo[MI_BUFFERS], meminfo[MI_CACHED],
+		meminfo[MI_SWAPTOTAL], meminfo[MI_SWAPFREE]
+	);
+# if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
+	/* Totals since boot: a collector can take deltas itself */
+	printf("{\"time\":%llu,\"type\":\"cpu\",\"usr\":%llu,\"nic\":%llu"
+		",\"sys\":%llu,\"idle\":%llu,\"iowait\":%llu,\"irq\":%llu"
+		",\"softirq\":%llu,\"steal\":%llu}\n",
+		now,
+		cur_jif.usr, cur_jif.nic, cur_jif.sys, cur_jif.idle,
+		cur_jif.iowait, cur_jif.irq, cur_jif.softirq, cur_jif.steal
+	);
+# endif
+
+	for (s = top, n = ntop; n != 0; s++, n--) {
+		json_proc_start(now, s->pid, s->ppid, s->uid, s->state, s->memsize);
+# if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
+		/* dticks: since last update */
+		printf(",\"start\":%lu,\"ticks\":%lu,\"dticks\":%u",
+			s->start_time, s->ticks, s->pcpu);
+# endif
+# if ENABLE_FEATURE_TOP_SMP_PROCESS
+		printf(",\"cpu\":%d", s->last_seen_on_cpu);
+# endif
+		json_proc_end(s->comm);
+	}
+}
+#endif
+
+/* Usernames are cached until exit: uids rarely get new names */
 static void clearmems(void)
 {
-	clear_username_cache();
 	free(top);
 	top = NULL;
 }
 
+/*
+ * Like qsort(), but only the first k elements need to end up sorted.
+ * Screen shows ~20 lines, no need to sort 10000 processes for it.
+ */
+static void qsort_first_k(void *base, int n, unsigned k, size_t size, int (*cmp)(const void *, const void *))
+{
+#define ELEM(i) (a + (i) * size)
+	char *a = base;
+
+	if (k < (unsigned)n) {
+		/* Quickselect (Hoare's FIND): partition until
+		 * [0..k-1] are not greater than [k..n-1] */
+		char *pivot = xmalloc(size * 2);
+		char *tmp = pivot + size;
+		int lo = 0;
+		int hi = n - 1;
+
+		while (lo < hi) {
+			int i = lo;
+			int j = hi;
+
+			memcpy(pivot, ELEM(lo + (hi - lo) / 2), size);
+			while (i <= j) {
+				while (cmp(ELEM(i), pivot) < 0)
+					i++;
+				while (cmp(ELEM(j), pivot) > 0)
+					j--;
+				if (i <= j) {
+					memcpy(tmp, ELEM(i), size);
+					memcpy(ELEM(i), ELEM(j), size);
+					memcpy(ELEM(j), tmp, size);
+					i++;
+					j--;
+				}
+			}
+			/* [lo..j] <= pivot <= [i..hi] */
+			if ((int)k <= j)
+				hi = j;
+			else if ((int)k >= i)
+				lo = i;
+			else
+				break;
+		}
+		free(pivot);
+		n = k;
+	}
+	qsort(a, n, size, cmp);
+#undef ELEM
+}
+
 #if ENABLE_FEATURE_TOP_INTERACTIVE
 static void reset_term(void)
 {
@@ -969,10 +1084,12 @@ enum {
 		| PSSCAN_RSS
 		| PSSCAN_STIME
 		| PSSCAN_UTIME
+		| PSSCAN_START_TIME
 		| PSSCAN_STATE
 		| PSSCAN_COMM
 		| PSSCAN_CPU
-		| PSSCAN_UIDGID,
+		| PSSCAN_UIDGID
+		| PSSCAN_KEEP_FD,
 	TOPMEM_MASK = 0
 		| PSSCAN_PID
 		| PSSCAN_SMAPS
@@ -1145,7 +1262,7 @@ static unsigned handle_input(unsigned scan_mask, duration_t interval)
 //usage:# define IF_SHOW_THREADS_OR_TOP_SMP(...)
 //usage:#endif
 //usage:#define top_trivial_usage
-//usage:       "[-b"IF_FEATURE_TOPMEM("m")IF_FEATURE_SHOW_THREADS("H")"]"
+//usage:       "[-b"IF_FEATURE_TOPMEM("m")IF_FEATURE_SHOW_THREADS("H")IF_FEATURE_TOP_JSON("j")"]"
 //usage:       " [-n COUNT] [-d SECONDS]"
 //usage:#define top_full_usage "\n\n"
 //usage:       "Show a view of process activity in real time."
@@ -1182,6 +1299,9 @@ static unsigned handle_input(unsigned scan_mask, duration_t interval)
 //usage:	IF_FEATURE_SHOW_THREADS(
 //usage:   "\n""	-H	Show threads"
 //usage:	)
+//usage:	IF_FEATURE_TOP_JSON(
+//usage:   "\n""	-j	Print all processes as JSON lines (implies -b)"
+//usage:	)
 
 /* Interactive testing:
  * echo sss | ./busybox top
@@ -1219,10 +1339,12 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 
 	/* all args are options; -n NUM */
 	make_all_argv_opts(argv); /* options can be specified w/o dash */
-	opt = getopt32(argv, "d:n:bHm", &str_interval, &str_iterations);
-	/* NB: -m and -H are accepted even if not configured */
+	opt = getopt32(argv, "d:n:bHmj", &str_interval, &str_iterations);
+	/* NB: -m, -H and -j are accepted even if not configured */
+	if (OPT_JSON)
+		option_mask32 |= OPT_b;
 #if ENABLE_FEATURE_TOPMEM
-	if (opt & OPT_m) /* -m (busybox specific) */
+	if ((opt & OPT_m) && !OPT_JSON) /* -m (busybox specific) */
 		scan_mask = TOPMEM_MASK;
 #endif
 	if (opt & OPT_d) {
@@ -1274,6 +1396,7 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 	while (scan_mask != EXIT_MASK) {
 		IF_FEATURE_TOP_INTERACTIVE(unsigned new_mask = scan_mask;)
 		procps_status_t *p = NULL;
+		unsigned k;
 
 		G.lines = INT_MAX;
 		G.scr_width = LINE_BUF_SIZE - 2; /* +2 bytes for '\n', NUL */
@@ -1303,6 +1426,7 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 				top[n].memsize = p->rss;
 #if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
 				top[n].ticks = p->stime + p->utime;
+				top[n].start_time = p->start_time;
 #endif
 				top[n].uid = p->uid;
 				strcpy(top[n].state, p->state);
@@ -1344,24 +1468,31 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 				continue;
 			}
 			do_stats();
-			/* TODO: we don't need to sort all 10000 processes, we need to find top 24! */
-			qsort(top, ntop, sizeof(top_status_t), (void*)mult_lvl_cmp);
-#else
-			qsort(top, ntop, sizeof(top_status_t), (void*)(sort_function[0]));
 #endif
 		}
-#if ENABLE_FEATURE_TOPMEM
-		else { /* TOPMEM */
-			qsort(topmem, ntop, sizeof(topmem_status_t), (void*)topmem_sort);
-		}
-#endif
  IF_FEATURE_TOP_INTERACTIVE(redraw:)
+		/* Sort here: redraw may be for a new sort order or scroll position.
+		 * Lines above the list make it an overestimate, which is fine */
+		k = G_scroll_ofs + G.lines;
 		G.lines_remaining = G.lines;
 		IF_FEATURE_TOPMEM(if (scan_mask != TOPMEM_MASK)) {
-			display_process_list();
+#if ENABLE_FEATURE_TOP_JSON
+			if (OPT_JSON)
+				display_process_list_json();
+			else
+#endif
+			{
+#if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
+				qsort_first_k(top, ntop, k, sizeof(top_status_t), (void*)mult_lvl_cmp);
+#else
+				qsort_first_k(top, ntop, k, sizeof(top_status_t), (void*)(sort_function[0]));
+#endif
+				display_process_list();
+			}
 		}
 #if ENABLE_FEATURE_TOPMEM
 		else { /* TOPMEM */
+			qsort_first_k(topmem, ntop, k, sizeof(topmem_status_t), (void*)topmem_sort);
 			display_topmem_process_list();
 		}
 #endif
@@ -1394,6 +1525,7 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 #endif
 	if (ENABLE_FEATURE_CLEAN_UP) {
 		clearmems();
+		clear_username_cache();
 #if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
 		free(prev_hist);
 #endif
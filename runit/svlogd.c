@@ -60,6 +60,12 @@ ttimeout
 !processor
     tells svlogd to feed each recent log file through processor
     (see above) on log file rotation. By default log files are not processed.
+zprog
+    (busybox extension) tells svlogd to compress each recent log file
+    with prog (default gzip) on log file rotation. prog reads the log
+    on stdin and writes to stdout, like processor, but is run without
+    a shell and in the background: rotation does not wait for it.
+    Not more than -j compressors run at once, the rest are queued.
 ua.b.c.d[:port]
     tells svlogd to transmit the first len characters of selected
     log messages to the IP address a.b.c.d, port number port.
@@ -131,12 +137,25 @@ log message, you can use a pattern like this instead
 //config:	filters log messages, and writes the data to one or more automatically
 //config:	rotated logs.
 
+//config:
+//config:config FEATURE_SVLOGD_COMPRESS
+//config:	bool "Support background compression of rotated logs"
+//config:	default y
+//config:	depends on SVLOGD
+//config:	help
+//config:	A "zPROG" line in DIR/config makes svlogd compress rotated logs
+//config:	with PROG (default gzip) in the background. Unlike "!PROG",
+//config:	rotation never waits for the previous file to be processed,
+//config:	and -j N limits how many compressors run at once.
+//config:	With FEATURE_PREFER_APPLETS, the gzip/bzip2 applets are used.
+
 //applet:IF_SVLOGD(APPLET(svlogd, BB_DIR_USR_SBIN, BB_SUID_DROP))
 
 //kbuild:lib-$(CONFIG_SVLOGD) += svlogd.o
 
 //usage:#define svlogd_trivial_usage
-//usage:       "[-tttv] [-r C] [-R CHARS] [-l MATCHLEN] [-b BUFLEN] DIR..."
+//usage:       "[-tttv] [-r C] [-R CHARS] [-l MATCHLEN] [-b BUFLEN]"
+//usage:	IF_FEATURE_SVLOGD_COMPRESS(" [-j N]")" DIR..."
 //usage:#define svlogd_full_usage "\n\n"
 //usage:       "Read log data from stdin and write to rotated log files in DIRs"
 //usage:   "\n"
@@ -146,6 +165,9 @@ log message, you can use a pattern like this instead
 //usage:   "\n""	-tt	Timestamp with yyyy-mm-dd_hh:mm:ss.sssss"
 //usage:   "\n""	-ttt	Timestamp with yyyy-mm-ddThh:mm:ss.sssss"
 //usage:   "\n""	-v	Verbose"
+//usage:	IF_FEATURE_SVLOGD_COMPRESS(
+//usage:   "\n""	-j N	Run up to N compressors at once (default 1)"
+//usage:	)
 //usage:   "\n"
 //usage:   "\n""DIR/config file modifies behavior:"
 //usage:   "\n""sSIZE - when to rotate logs (default 1000000, 0 disables)"
@@ -153,6 +175,9 @@ log message, you can use a pattern like this instead
 ///////:   "\n""NNUM - min number files to retain" - confusing
 ///////:   "\n""tSEC - rotate file if it get SEC seconds old" - confusing
 //usage:   "\n""!PROG - process rotated log with PROG"
+//usage:	IF_FEATURE_SVLOGD_COMPRESS(
+//usage:   "\n""zPROG - compress rotated log with PROG in background (default gzip)"
+//usage:	)
 ///////:   "\n""uIPADDR - send log over UDP" - unsupported
 ///////:   "\n""UIPADDR - send log over UDP and DONT log" - unsupported
 ///////:   "\n""pPFX - prefix each line with PFX" - unsupported
@@ -160,6 +185,7 @@ log message, you can use a pattern like this instead
 //usage:   "\n""E,ePATTERN - (de)select line for stderr"
 
 #include <sys/file.h>
+#include <sys/uio.h>
 #include "libbb.h"
 #include "common_bufsiz.h"
 #include "runit_lib.h"
@@ -168,11 +194,20 @@ log message, you can use a pattern like this instead
 
 #define FMT_PTIME 30
 
+enum {
+	/* stdin is read in blocks of this size */
+	INBUF_SIZE = 64 * 1024,
+	/* Linux UIO_MAXIOV; a block of short timestamped lines
+	 * needs two iovecs per line */
+	LOGDIR_IOV = 1024,
+};
+
 struct logdir {
 	////char *btmp;
 	/* pattern list to match, in "aa\0bb\0\cc\0\0" form */
 	char *inst;
 	char *processor;
+	IF_FEATURE_SVLOGD_COMPRESS(char *compress;)
 	char *name;
 	unsigned size;
 	unsigned sizemax;
@@ -182,7 +217,9 @@ struct logdir {
 	int ppid;
 	int fddir;
 	int fdcur;
-	FILE* filecur; ////
+	/* Pieces of the current batch not yet written to fdcur */
+	struct iovec *iov;
+	unsigned iovcnt;
 	int fdlock;
 	unsigned next_rotate;
 	char fnsave[FMT_PTIME];
@@ -191,8 +228,21 @@ struct logdir {
 };
 
 
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+struct zjob {
+	struct zjob *next;
+	pid_t pid; /* 0: not started yet */
+	int fddir;
+	const char *name;
+	char fn[28]; /* "@<tai64n>.u" */
+	char *cmd;
+	char *argv[8];
+};
+#endif
+
 struct globals {
 	struct logdir *dir;
+	char *line;
 	unsigned verbose;
 	int linemax;
 	////int buflen;
@@ -218,6 +268,12 @@ struct globals {
 	unsigned dirn;
 
 	sigset_t blocked_sigset;
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+	/* Rotated files waiting for or being compressed, oldest first */
+	struct zjob *zjobs;
+	unsigned zrunning;
+	unsigned zmax;
+#endif
 };
 #define G (*ptr_to_globals)
 #define dir            (G.dir           )
@@ -240,14 +296,14 @@ struct globals {
 #define blocked_sigset (G.blocked_sigset)
 #define fl_flag_0      (G.fl_flag_0     )
 #define dirn           (G.dirn          )
-#define line bb_common_bufsiz1
+#define line           (G.line          )
 #define INIT_G() do { \
-	setup_common_bufsiz(); \
 	SET_PTR_TO_GLOBALS(xzalloc(sizeof(G))); \
 	linemax = COMMON_BUFSIZE - 26; \
 	/*buflen = 1024;*/ \
 	linecomplete = 1; \
 	replace = ""; \
+	IF_FEATURE_SVLOGD_COMPRESS(G.zmax = 1;) \
 } while (0)
 
 
@@ -505,6 +561,157 @@ static unsigned processorstop(struct logdir *ld)
 	return 1;
 }
 
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+/* Compression runs in the background: rotate() only queues the
+ * rotated "@<tai64n>.u" file. The child writes "@<tai64n>.t",
+ * which replaces it as "@<tai64n>.s" once the child succeeds */
+static struct zjob *zjob_find(const char *fn)
+{
+	struct zjob *j;
+
+	for (j = G.zjobs; j; j = j->next)
+		if (memcmp(j->fn, fn, 26) == 0)
+			return j;
+	return NULL;
+}
+
+static void zjob_start(struct zjob *j)
+{
+	char tmp[28];
+	int pid;
+
+	memcpy(tmp, j->fn, 28);
+	tmp[26] = 't';
+
+	while ((pid = vfork()) == -1)
+		pause2cannot("vfork for compressor", j->name);
+	if (!pid) {
+		int fd;
+
+		/* child */
+		sigprocmask(SIG_UNBLOCK, &blocked_sigset, NULL);
+		if (fchdir(j->fddir) == -1)
+			bb_perror_msg_and_die(FATAL"can't %s compressor %s", "change directory for", j->name);
+		if (verbose)
+			bb_error_msg(INFO"compressing: %s/%s", j->name, j->fn);
+		fd = open(j->fn, O_RDONLY|O_NDELAY);
+		if (fd < 0)
+			_exit(0); /* deleted by rmoldest() meanwhile */
+		xmove_fd(fd, 0);
+		fd = xopen(tmp, O_WRONLY|O_NDELAY|O_TRUNC|O_CREAT);
+		xmove_fd(fd, 1);
+		BB_EXECVP(j->argv[0], j->argv);
+		bb_perror_msg_and_die(FATAL"can't %s compressor %s", "run", j->name);
+	}
+	j->pid = pid;
+	G.zrunning++;
+}
+
+static void zjob_run(void)
+{
+	struct zjob *j;
+
+	/* On exit, leave the rest as .u: they are queued again on next start */
+	for (j = G.zjobs; j && G.zrunning < G.zmax && !exitasap; j = j->next)
+		if (!j->pid)
+			zjob_start(j);
+}
+
+static void zjob_add(struct logdir *ld, const char *fn)
+{
+	struct zjob *j, **pp;
+	char *p;
+	int i;
+
+	if (zjob_find(fn))
+		return;
+	j = xzalloc(sizeof(*j));
+	while ((j->fddir = dup(ld->fddir)) == -1)
+		pause2cannot("dup directory, want compress", ld->name);
+	close_on_exec_on(j->fddir);
+	j->name = ld->name;
+	memcpy(j->fn, fn, 27);
+	j->cmd = p = xstrdup(ld->compress);
+	for (i = 0; i < ARRAY_SIZE(j->argv) - 1; i++) {
+		p = skip_whitespace(p);
+		if (!*p)
+			break;
+		j->argv[i] = p;
+		p = skip_non_whitespace(p);
+		if (*p)
+			*p++ = '\0';
+	}
+	if (!i)
+		j->argv[i] = (char*)"gzip";
+
+	for (pp = &G.zjobs; *pp; pp = &(*pp)->next)
+		continue;
+	*pp = j;
+	zjob_run();
+}
+
+/* Returns 0 if pid is not one of ours */
+static int zjob_done(pid_t pid, int status)
+{
+	struct zjob *j, **pp;
+	char tmp[28];
+	char f[28];
+
+	for (pp = &G.zjobs; (j = *pp) != NULL; pp = &j->next)
+		if (j->pid == pid)
+			goto found;
+	return 0;
+ found:
+	*pp = j->next;
+	G.zrunning--;
+
+	memcpy(tmp, j->fn, 28);
+	tmp[26] = 't';
+	memcpy(f, j->fn, 28);
+	f[26] = 's';
+	while (fchdir(j->fddir) == -1)
+		pause2cannot("change directory, want compress", j->name);
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		if (rename(tmp, f) == 0) {
+			chmod(f, 0744);
+			if (unlink(j->fn) == -1) {
+				/* rmoldest() deleted it meanwhile, don't resurrect */
+				unlink(f);
+			} else if (verbose)
+				bb_error_msg(INFO"compressed: %s/%s", j->name, f);
+		}
+	} else {
+		/* Keep the log uncompressed rather than retry forever */
+		warnx("compressor failed", j->name);
+		unlink(tmp);
+		rename(j->fn, f);
+	}
+	while (fchdir(fdwdir) == -1)
+		pause1cannot("change to initial working directory");
+
+	close(j->fddir);
+	free(j->cmd);
+	free(j);
+	zjob_run();
+	return 1;
+}
+
+/* Queue .u files left over by a previous run */
+static void zjob_scan(struct logdir *ld)
+{
+	DIR *d;
+	struct dirent *f;
+
+	d = opendir(".");
+	if (!d)
+		return;
+	while ((f = readdir(d)) != NULL)
+		if (f->d_name[0] == '@' && strlen(f->d_name) == 27 && f->d_name[26] == 'u')
+			zjob_add(ld, f->d_name);
+	closedir(d);
+}
+#endif
+
 static void rmoldest(struct logdir *ld)
 {
 	DIR *d;
@@ -519,6 +726,11 @@ static void rmoldest(struct logdir *ld)
 	while ((f = readdir(d))) {
 		if ((f->d_name[0] == '@') && (strlen(f->d_name) == 27)) {
 			if (f->d_name[26] == 't') {
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+				/* Being written by a compressor */
+				if (zjob_find(f->d_name))
+					continue;
+#endif
 				if (unlink(f->d_name) == -1)
 					warn2("can't unlink processor leftover", f->d_name);
 			} else {
@@ -541,6 +753,74 @@ static void rmoldest(struct logdir *ld)
 	}
 }
 
+/* Write out the pieces queued by buffer_pwrite(), as few writev()s
+ * as the kernel lets us */
+static void logdir_flush(struct logdir *ld)
+{
+	struct iovec *iov = ld->iov;
+	unsigned cnt = ld->iovcnt;
+
+	ld->iovcnt = 0;
+	while (cnt) {
+		ssize_t i = writev(ld->fdcur, iov, cnt);
+		if (i >= 0) {
+			/* Skip what was written, the last piece may be partial */
+			while (cnt && (size_t)i >= iov->iov_len) {
+				i -= iov->iov_len;
+				iov++;
+				cnt--;
+			}
+			if (cnt) {
+				iov->iov_base = (char*)iov->iov_base + i;
+				iov->iov_len -= i;
+			}
+			continue;
+		}
+
+		if ((errno == ENOSPC) && (ld->nmin < ld->nmax)) {
+			DIR *d;
+			struct dirent *f;
+			char oldest[FMT_PTIME];
+			int j = 0;
+
+			while (fchdir(ld->fddir) == -1)
+				pause2cannot("change directory, want remove old logfile",
+							ld->name);
+			oldest[0] = 'A';
+			oldest[1] = oldest[27] = '\0';
+			while (!(d = opendir(".")))
+				pause2cannot("open directory, want remove old logfile",
+							ld->name);
+			errno = 0;
+			while ((f = readdir(d)))
+				if ((f->d_name[0] == '@') && (strlen(f->d_name) == 27)) {
+					++j;
+					if (strcmp(f->d_name, oldest) < 0)
+						memcpy(oldest, f->d_name, 27);
+				}
+			if (errno) warn2("can't read directory, want remove old logfile",
+					ld->name);
+			closedir(d);
+			errno = ENOSPC;
+			if (j > ld->nmin) {
+				if (*oldest == '@') {
+					bb_error_msg(WARNING"out of disk space, delete: %s/%s",
+							ld->name, oldest);
+					errno = 0;
+					if (unlink(oldest) == -1) {
+						warn2("can't unlink oldest logfile", ld->name);
+						errno = ENOSPC;
+					}
+					while (fchdir(fdwdir) == -1)
+						pause1cannot("change to initial working directory");
+				}
+			}
+		}
+		if (errno)
+			pause2cannot("write to current", ld->name);
+	}
+}
+
 static unsigned rotate(struct logdir *ld)
 {
 	struct stat st;
@@ -560,7 +840,7 @@ static unsigned rotate(struct logdir *ld)
 	/* create new filename */
 	ld->fnsave[25] = '.';
 	ld->fnsave[26] = 's';
-	if (ld->processor)
+	if (ld->processor IF_FEATURE_SVLOGD_COMPRESS(|| ld->compress))
 		ld->fnsave[26] = 'u';
 	ld->fnsave[27] = '\0';
 	do {
@@ -577,12 +857,12 @@ static unsigned rotate(struct logdir *ld)
 	}
 
 	if (ld->size > 0) {
-		while (fflush(ld->filecur) || fsync(ld->fdcur) == -1)
+		logdir_flush(ld);
+		while (fsync(ld->fdcur) == -1)
 			pause2cannot("fsync current logfile", ld->name);
 		while (fchmod(ld->fdcur, 0744) == -1)
 			pause2cannot("set mode of current", ld->name);
-		////close(ld->fdcur);
-		fclose(ld->filecur);
+		close(ld->fdcur);
 
 		if (verbose) {
 			bb_error_msg(INFO"rename: %s/current %s %u", ld->name,
@@ -592,9 +872,6 @@ static unsigned rotate(struct logdir *ld)
 			pause2cannot("rename current", ld->name);
 		while ((ld->fdcur = open("current", O_WRONLY|O_NDELAY|O_APPEND|O_CREAT, 0600)) == -1)
 			pause2cannot("create new current", ld->name);
-		while ((ld->filecur = fdopen(ld->fdcur, "a")) == NULL) ////
-			pause2cannot("create new current", ld->name); /* very unlikely */
-		setvbuf(ld->filecur, NULL, _IOFBF, linelen); ////
 		close_on_exec_on(ld->fdcur);
 		ld->size = 0;
 		while (fchmod(ld->fdcur, 0644) == -1)
@@ -602,6 +879,10 @@ static unsigned rotate(struct logdir *ld)
 
 		rmoldest(ld);
 		processorstart(ld);
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+		if (ld->compress)
+			zjob_add(ld, ld->fnsave);
+#endif
 	}
 
 	while (fchdir(fdwdir) == -1)
@@ -609,72 +890,73 @@ static unsigned rotate(struct logdir *ld)
 	return 1;
 }
 
-static int buffer_pwrite(int n, char *s, unsigned len)
+static void logdir_queue(struct logdir *ld, const char *s, unsigned len)
 {
-	int i;
-	struct logdir *ld = &dir[n];
-
-	if (ld->sizemax) {
-		if (ld->size >= ld->sizemax)
-			rotate(ld);
-		if (len > (ld->sizemax - ld->size))
-			len = ld->sizemax - ld->size;
+	struct iovec *v;
+
+	if (ld->iovcnt) {
+		/* Untimestamped lines are adjacent in line[]: coalesce */
+		v = &ld->iov[ld->iovcnt - 1];
+		if ((char*)v->iov_base + v->iov_len == s) {
+			v->iov_len += len;
+			return;
+		}
+		if (ld->iovcnt == LOGDIR_IOV)
+			logdir_flush(ld);
 	}
-	while (1) {
-		////i = full_write(ld->fdcur, s, len);
-		////if (i != -1) break;
-		i = fwrite(s, 1, len, ld->filecur);
-		if (i == len) break;
+	v = &ld->iov[ld->iovcnt++];
+	v->iov_base = (char*)s;
+	v->iov_len = len;
+}
 
-		if ((errno == ENOSPC) && (ld->nmin < ld->nmax)) {
-			DIR *d;
-			struct dirent *f;
-			char oldest[FMT_PTIME];
-			int j = 0;
+/* Queue stamp[0..25] (if not NULL) and s[0..len-1] for logdir n.
+ * Nothing is copied: s and stamp must stay intact until flush_logdirs().
+ * A line which does not fit below sizemax is continued in the next file */
+static void buffer_pwrite(int n, const char *stamp, char *s, unsigned len)
+{
+	struct logdir *ld = &dir[n];
+	unsigned stamplen = stamp ? 26 : 0;
+	unsigned i;
 
-			while (fchdir(ld->fddir) == -1)
-				pause2cannot("change directory, want remove old logfile",
-							ld->name);
-			oldest[0] = 'A';
-			oldest[1] = oldest[27] = '\0';
-			while (!(d = opendir(".")))
-				pause2cannot("open directory, want remove old logfile",
-							ld->name);
-			errno = 0;
-			while ((f = readdir(d)))
-				if ((f->d_name[0] == '@') && (strlen(f->d_name) == 27)) {
-					++j;
-					if (strcmp(f->d_name, oldest) < 0)
-						memcpy(oldest, f->d_name, 27);
-				}
-			if (errno) warn2("can't read directory, want remove old logfile",
-					ld->name);
-			closedir(d);
-			errno = ENOSPC;
-			if (j > ld->nmin) {
-				if (*oldest == '@') {
-					bb_error_msg(WARNING"out of disk space, delete: %s/%s",
-							ld->name, oldest);
-					errno = 0;
-					if (unlink(oldest) == -1) {
-						warn2("can't unlink oldest logfile", ld->name);
-						errno = ENOSPC;
-					}
-					while (fchdir(fdwdir) == -1)
-						pause1cannot("change to initial working directory");
-				}
-			}
+	while (stamplen + len) {
+		unsigned room = UINT_MAX;
+
+		if (ld->sizemax) {
+			if (ld->size >= ld->sizemax)
+				rotate(ld);
+			room = ld->sizemax - ld->size;
+		}
+		if (stamplen) {
+			i = stamplen < room ? stamplen : room;
+			logdir_queue(ld, stamp, i);
+			stamp += i;
+			stamplen -= i;
+			room -= i;
+			ld->size += i;
+		}
+		i = len < room ? len : room;
+		if (i) {
+			logdir_queue(ld, s, i);
+			s += i;
+			len -= i;
+			ld->size += i;
 		}
-		if (errno)
-			pause2cannot("write to current", ld->name);
 	}
 
-	ld->size += i;
 	if (ld->sizemax)
-		if (s[i-1] == '\n')
+		if (s[-1] == '\n')
 			if (ld->size >= (ld->sizemax - linemax))
 				rotate(ld);
-	return i;
+}
+
+static void flush_logdirs(void)
+{
+	unsigned i;
+
+	for (i = 0; i < dirn; ++i)
+		if (dir[i].iovcnt)
+			logdir_flush(&dir[i]);
+	fflush_all();
 }
 
 static void logdir_close(struct logdir *ld)
@@ -687,12 +969,12 @@ static void logdir_close(struct logdir *ld)
 	ld->fddir = -1;
 	if (ld->fdcur == -1)
 		return; /* impossible */
-	while (fflush(ld->filecur) || fsync(ld->fdcur) == -1)
+	logdir_flush(ld);
+	while (fsync(ld->fdcur) == -1)
 		pause2cannot("fsync current logfile", ld->name);
 	while (fchmod(ld->fdcur, 0744) == -1)
 		pause2cannot("set mode of current", ld->name);
-	////close(ld->fdcur);
-	fclose(ld->filecur);
+	close(ld->fdcur);
 	ld->fdcur = -1;
 	if (ld->fdlock == -1)
 		return; /* impossible */
@@ -700,6 +982,7 @@ static void logdir_close(struct logdir *ld)
 	ld->fdlock = -1;
 	free(ld->processor);
 	ld->processor = NULL;
+	IF_FEATURE_SVLOGD_COMPRESS(free(ld->compress); ld->compress = NULL;)
 }
 
 static NOINLINE unsigned logdir_open(struct logdir *ld, const char *fn)
@@ -744,6 +1027,7 @@ static NOINLINE unsigned logdir_open(struct logdir *ld, const char *fn)
 	ld->match = '+';
 	free(ld->inst); ld->inst = NULL;
 	free(ld->processor); ld->processor = NULL;
+	IF_FEATURE_SVLOGD_COMPRESS(free(ld->compress); ld->compress = NULL;)
 
 	/* read config */
 	i = open_read_close("config", buf, sizeof(buf) - 1);
@@ -807,8 +1091,18 @@ static NOINLINE unsigned logdir_open(struct logdir *ld, const char *fn)
 				if (s[1]) {
 					free(ld->processor);
 					ld->processor = wstrdup(&s[1]);
+					IF_FEATURE_SVLOGD_COMPRESS(free(ld->compress); ld->compress = NULL;)
 				}
 				break;
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+			case 'z':
+				/* Last of '!' and 'z' wins */
+				free(ld->compress);
+				ld->compress = wstrdup(&s[1]);
+				free(ld->processor);
+				ld->processor = NULL;
+				break;
+#endif
 			}
 			s = np;
 		}
@@ -855,9 +1149,6 @@ static NOINLINE unsigned logdir_open(struct logdir *ld, const char *fn)
 	}
 	while ((ld->fdcur = open("current", O_WRONLY|O_NDELAY|O_APPEND|O_CREAT, 0600)) == -1)
 		pause2cannot("open current", ld->name);
-	while ((ld->filecur = fdopen(ld->fdcur, "a")) == NULL)
-		pause2cannot("open current", ld->name); ////
-	setvbuf(ld->filecur, NULL, _IOFBF, linelen); ////
 
 	close_on_exec_on(ld->fdcur);
 	while (fchmod(ld->fdcur, 0644) == -1)
@@ -867,6 +1158,10 @@ static NOINLINE unsigned logdir_open(struct logdir *ld, const char *fn)
 		if (i == 0) bb_error_msg(INFO"append: %s/current", ld->name);
 		else bb_error_msg(INFO"new: %s/current", ld->name);
 	}
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+	if (ld->compress)
+		zjob_scan(ld);
+#endif
 
 	while (fchdir(fdwdir) == -1)
 		pause1cannot("change to initial working directory");
@@ -999,6 +1294,10 @@ static void sig_child_handler(int sig_no UNUSED_PARAM)
 	if (verbose)
 		bb_error_msg(INFO"sig%s received", "child");
 	while ((pid = wait_any_nohang(&wstat)) > 0) {
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+		if (zjob_done(pid, wstat))
+			continue;
+#endif
 		for (l = 0; l < dirn; ++l) {
 			if (dir[l].ppid == pid) {
 				dir[l].ppid = 0;
@@ -1050,6 +1349,7 @@ static void logmatch(struct logdir *ld, char* lineptr, int lineptr_len)
 int svlogd_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int svlogd_main(int argc, char **argv)
 {
+	char stamp[FMT_PTIME];
 	char *r, *l, *b;
 	ssize_t stdin_cnt = 0;
 	int i;
@@ -1059,8 +1359,9 @@ int svlogd_main(int argc, char **argv)
 	INIT_G();
 
 	opt = getopt32(argv, "^"
-			"r:R:l:b:tv" "\0" "tt:vv",
-			&r, &replace, &l, &b, &timestamp, &verbose
+			"r:R:l:b:tv" IF_FEATURE_SVLOGD_COMPRESS("j:+") "\0" "tt:vv",
+			&r, &replace, &l, &b IF_FEATURE_SVLOGD_COMPRESS(, &G.zmax),
+			&timestamp, &verbose
 	);
 	if (opt & 1) { // -r
 		repl = r[0];
@@ -1068,6 +1369,10 @@ int svlogd_main(int argc, char **argv)
 			bb_show_usage();
 	}
 	if (opt & 2) if (!repl) repl = '_'; // -R
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+	if (G.zmax == 0) // -j0
+		G.zmax = 1;
+#endif
 	if (opt & 4) { // -l
 		linemax = xatou_range(l, 0, COMMON_BUFSIZE - 26);
 		if (linemax == 0)
@@ -1097,8 +1402,9 @@ int svlogd_main(int argc, char **argv)
 		dir[i].fdcur = -1;
 		////dir[i].btmp = xmalloc(buflen);
 		/*dir[i].ppid = 0;*/
+		dir[i].iov = xmalloc(LOGDIR_IOV * sizeof(dir[i].iov[0]));
 	}
-	/* line = xmalloc(linemax + (timestamp ? 26 : 0)); */
+	line = xmalloc(INBUF_SIZE);
 	fndir = argv;
 	/* We cannot set NONBLOCK on fd #0 permanently - this setting
 	 * _isn't_ per-process! It is shared among all other processes
@@ -1129,24 +1435,19 @@ int svlogd_main(int argc, char **argv)
 
 	/* Each iteration processes one or more lines */
 	while (1) {
-		char stamp[FMT_PTIME];
 		char *lineptr;
-		char *printptr;
 		char *np;
-		int printlen;
 		char ch;
 
 		lineptr = line;
-		if (timestamp)
-			lineptr += 26;
 
-		/* lineptr[0..linemax-1] - buffer for stdin */
+		/* lineptr[0..INBUF_SIZE-1] - buffer for stdin */
 		/* (possibly has some unprocessed data from prev loop) */
 
 		/* Refill the buffer if needed */
 		np = memRchr(lineptr, '\n', stdin_cnt);
 		if (!np && !exitasap) {
-			i = linemax - stdin_cnt; /* avail. bytes at tail */
+			i = INBUF_SIZE - stdin_cnt; /* avail. bytes at tail */
 			if (i >= 128) {
 				i = buffer_pread(/*0, */lineptr + stdin_cnt, i);
 				if (i <= 0) /* EOF or error on stdin */
@@ -1154,6 +1455,13 @@ int svlogd_main(int argc, char **argv)
 				else {
 					np = memRchr(lineptr + stdin_cnt, '\n', i);
 					stdin_cnt += i;
+					/* Lines which arrived in one read()
+					 * share one timestamp */
+					if (timestamp == 1)
+						fmt_time_bernstein_25(stamp);
+					else if (timestamp) /* 2+: */
+						fmt_time_human_30nul(stamp, timestamp == 2 ? '_' : 'T');
+					stamp[25] = ' ';
 				}
 			}
 		}
@@ -1171,46 +1479,33 @@ int svlogd_main(int argc, char **argv)
 		/* linelen == no of chars incl. '\n' (or == stdin_cnt) */
 		ch = lineptr[linelen-1];
 
-		/* Biggest performance hit was coming from the fact
-		 * that we did not buffer writes. We were reading many lines
-		 * in one read() above, but wrote one line per write().
-		 * We are using stdio to fix that */
-
-		/* write out lineptr[0..linelen-1] to each log destination
-		 * (or lineptr[-26..linelen-1] if timestamping) */
-		printlen = linelen;
-		printptr = lineptr;
-		if (timestamp) {
-			if (timestamp == 1)
-				fmt_time_bernstein_25(stamp);
-			else /* 2+: */
-				fmt_time_human_30nul(stamp, timestamp == 2 ? '_' : 'T');
-			printlen += 26;
-			printptr -= 26;
-			memcpy(printptr, stamp, 25);
-			printptr[25] = ' ';
-		}
+		/* Queue lineptr[0..linelen-1] (after the stamp if timestamping)
+		 * for each log destination. The whole block read above
+		 * goes out in one writev() per logdir in flush_logdirs() */
 		for (i = 0; i < dirn; ++i) {
 			struct logdir *ld = &dir[i];
 			if (ld->fddir == -1)
 				continue;
+			/* Patterns see at most the first linemax chars */
 			if (ld->inst)
-				logmatch(ld, lineptr, linelen);
+				logmatch(ld, lineptr, linelen < linemax ? linelen : linemax);
 			if (ld->matcherr == 'e') {
 				/* runit-1.8.0 compat: if timestamping, do it on stderr too */
-				////full_write(STDERR_FILENO, printptr, printlen);
-				fwrite(printptr, 1, printlen, stderr);
+				if (timestamp)
+					fwrite(stamp, 1, 26, stderr);
+				fwrite(lineptr, 1, linelen, stderr);
 			}
 			if (ld->match != '+')
 				continue;
-			buffer_pwrite(i, printptr, printlen);
+			buffer_pwrite(i, timestamp ? stamp : NULL, lineptr, linelen);
 		}
 
 		/* If we didn't see '\n' (long input line), */
 		/* read/write repeatedly until we see it */
 		while (ch != '\n') {
-			/* lineptr is emptied now, safe to use as buffer */
-			stdin_cnt = exitasap ? -1 : buffer_pread(/*0, */lineptr, linemax);
+			/* lineptr (== line here) is about to be reused */
+			flush_logdirs();
+			stdin_cnt = exitasap ? -1 : buffer_pread(/*0, */lineptr, INBUF_SIZE);
 			if (stdin_cnt <= 0) { /* EOF or error on stdin */
 				exitasap = 1;
 				lineptr[0] = ch = '\n';
@@ -1233,7 +1528,7 @@ int svlogd_main(int argc, char **argv)
 				}
 				if (dir[i].match != '+')
 					continue;
-				buffer_pwrite(i, lineptr, linelen);
+				buffer_pwrite(i, NULL, lineptr, linelen);
 			}
 		}
 
@@ -1245,10 +1540,11 @@ int svlogd_main(int argc, char **argv)
 			np = memRchr(lineptr, '\n', stdin_cnt);
 			if (np)
 				goto print_to_nl;
-			/* Move unprocessed data to the front of line */
-			memmove((timestamp ? line+26 : line), lineptr, stdin_cnt);
 		}
-		fflush_all();////
+		flush_logdirs();
+		/* Move unprocessed data to the front of line */
+		if (stdin_cnt > 0)
+			memmove(line, lineptr, stdin_cnt);
 	}
 
 	for (i = 0; i < dirn; ++i) {
@@ -1257,5 +1553,14 @@ int svlogd_main(int argc, char **argv)
 				continue;
 		logdir_close(&dir[i]);
 	}
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+	/* Let running compressors finish, zjob_run() starts no new ones */
+	while (G.zrunning) {
+		pid_t pid = safe_waitpid(-1, &wstat, 0);
+		if (pid <= 0)
+			break;
+		zjob_done(pid, wstat);
+	}
+#endif
 	return 0;
 }
@@ -170,6 +170,15 @@
 // * sleep_main() must not allocate anything as ^C in ash longjmp's.
 //   (currently, allocations are only on error paths, in message printing).
 //
+//config:config ASH_MAPFILE
+//config:	bool "mapfile builtin"
+//config:	default y
+//config:	depends on ASH_BASH_COMPAT
+//config:	help
+//config:	Enable 'mapfile' and 'readarray' builtins, which read all lines
+//config:	of input in one go and store them as positional parameters.
+//config:	This is much faster than set -- $(cat FILE).
+//config:
 //config:config ASH_HELP
 //config:	bool "help builtin"
 //config:	default y
@@ -2601,6 +2610,10 @@ static const struct {
 	{ VSTRFIXED|VTEXTFIXED|VUNSET, BB_OVERRIDE_APPLETS, change_override_applets },
 	{ VSTRFIXED|VTEXTFIXED|VUNSET, BB_CRITICAL_ERROR_DIALOGS, change_critical_error_dialogs },
 #endif
+#if !ENABLE_PLATFORM_MINGW32
+	/* Must be last, see vforkssaved */
+	{ VSTRFIXED|VTEXTFIXED       , NULL /* inited to forkssavedvar */, NULL },
+#endif
 };
 
 struct redirtab;
@@ -2615,6 +2628,11 @@ struct globals_var {
 	char linenovar[sizeof("LINENO=") + sizeof(int)*3];
 	char funcnamevar[sizeof("FUNCNAME=") + 64];
 	char *funcname;
+#if !ENABLE_PLATFORM_MINGW32
+	/* pipeline stages started by vfork, see vforkexec_pipestage() */
+	unsigned forks_saved;
+	char forkssavedvar[sizeof("BB_FORKS_SAVED=") + sizeof(int)*3];
+#endif
 	unsigned trap_depth;
 	bool in_trap_ERR; /* ERR cannot recurse, no need to be a counter */
 };
@@ -2629,6 +2647,8 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 #define linenovar     (G_var.linenovar    )
 #define funcnamevar   (G_var.funcnamevar  )
 #define funcname      (G_var.funcname     )
+#define forks_saved   (G_var.forks_saved  )
+#define forkssavedvar (G_var.forkssavedvar)
 #define trap_depth    (G_var.trap_depth   )
 #define in_trap_ERR   (G_var.in_trap_ERR  )
 #define vifs      varinit[0]
@@ -2655,6 +2675,9 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 # define vepochs  varinit[VAR_OFFSET3 + 7]
 # define vepochr  varinit[VAR_OFFSET3 + 8]
 #endif
+#if !ENABLE_PLATFORM_MINGW32
+# define vforkssaved varinit[ARRAY_SIZE(varinit_data) - 1]
+#endif
 #define INIT_G_var() do { \
 	unsigned i; \
 	XZALLOC_CONST_PTR(&ash_ptr_to_globals_var, sizeof(G_var)); \
@@ -2667,6 +2690,8 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 	vlineno.var_text = linenovar; \
 	strcpy(funcnamevar, "FUNCNAME="); \
 	vfuncname.var_text = funcnamevar; \
+	IF_NOT_PLATFORM_MINGW32(strcpy(forkssavedvar, "BB_FORKS_SAVED=");) \
+	IF_NOT_PLATFORM_MINGW32(vforkssaved.var_text = forkssavedvar;) \
 } while (0)
 
 /*
@@ -2788,6 +2813,12 @@ lookupvar(const char *name)
 			if (v->var_text == funcnamevar) {
 				safe_strncpy(funcnamevar+9, funcname ? funcname : "", sizeof(funcnamevar)-9);
 			}
+#if !ENABLE_PLATFORM_MINGW32
+			else
+			if (v->var_text == forkssavedvar) {
+				fmtstr(forkssavedvar+15, sizeof(forkssavedvar)-15, "%u", forks_saved);
+			}
+#endif
 			return var_end(v->var_text);
 		}
 	}
@@ -11305,6 +11336,167 @@ expredir(union node *n)
 	}
 }
 
+#if !ENABLE_PLATFORM_MINGW32
+/*
+ * Can this pipeline stage be expanded in the parent shell?
+ * Only if it is a simple command whose expansion has no side effects
+ * and can't fail: no assignments, no redirections,
+ * no $(cmd), $((expr)), ${v=w}, ${v?w}, no "set -u".
+ * Nor $RANDOM and other dynamic variables, nor $? $! $- $$:
+ * a forked child would see other values.
+ * Then expanding it again in a forked child is harmless, too.
+ */
+static int
+pipestage_is_simple(union node *n)
+{
+	union node *argp;
+
+	if (n->type != NCMD || !n->ncmd.args
+	 || n->ncmd.assign || n->ncmd.redirect
+	) {
+		return 0;
+	}
+	/* xtrace output is done by evalcommand() */
+	if (uflag || xflag)
+		return 0;
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next) {
+		const unsigned char *p = (unsigned char *)argp->narg.text;
+		unsigned char c;
+
+		while ((c = *p++) != '\0') {
+			if (c == CTLESC) {
+				if (*p)
+					p++;
+				continue;
+			}
+			if (c == CTLVAR) {
+				int subtype = *p++ & VSTYPE;
+				if (subtype == VSQUESTION || subtype == VSASSIGN
+				 IF_BASH_SUBSTR(|| subtype == VSSUBSTR)
+				) {
+					return 0;
+				}
+				/* Positional parameters and plain variables only */
+				if (is_name(*p)) {
+					struct var *vp = *findvar((char *)p);
+					if (vp && (vp->flags & VDYNAMIC))
+						return 0;
+				} else if (!isdigit(*p) && !strchr("@*#", *p)) {
+					return 0;
+				}
+				continue;
+			}
+			if (c == CTLBACKQ || c == CTLARI
+			 IF_BASH_PROCESS_SUBST(|| c == CTLTOPROC || c == CTLFROMPROC)
+			) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/*
+ * Is the command name a plain word which expands to itself?
+ * Then it can be looked up before anything is expanded.
+ */
+static int
+word_is_literal(const char *p)
+{
+	unsigned char c;
+
+	if (*p == '~')
+		return 0;
+	while ((c = *p++) != '\0') {
+		if ((c >= CTL_FIRST && c <= CTL_LAST)
+		 || c == '*' || c == '?' || c == '['
+		) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Start a pipeline stage which runs an external command with vfork:
+ * expand it in the parent, then exec it right away in the child.
+ * This avoids copying the whole shell with fork.
+ * Returns 0 if the stage needs a forked shell; nothing was
+ * expanded then, so the child expands it only once.
+ */
+static int
+vforkexec_pipestage(struct job *jp, union node *n, int mode, int prevfd, int pip[2])
+{
+	struct stackmark smark;
+	struct arglist arglist;
+	struct cmdentry entry;
+	struct strlist *sp;
+	union node *argp;
+	const char *path;
+	char **argv, **nargv;
+	int argc;
+	int pid;
+
+	if (!pipestage_is_simple(n) || !word_is_literal(n->ncmd.args->narg.text))
+		return 0;
+
+	path = pathval();
+	find_command(n->ncmd.args->narg.text, &entry, 0, path);
+	/* Builtins, functions, not found: leave it to the forked shell */
+	if (entry.cmdtype != CMDNORMAL)
+		return 0;
+
+	setstackmark(&smark);
+	arglist.list = NULL;
+	arglist.lastp = &arglist.list;
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next)
+		expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
+	*arglist.lastp = NULL;
+
+	argc = 0;
+	for (sp = arglist.list; sp; sp = sp->next)
+		argc++;
+
+	/* Reserve one extra spot at the front for shellexec. */
+	nargv = stalloc(sizeof(char *) * (argc + 2));
+	argv = ++nargv;
+	for (sp = arglist.list; sp; sp = sp->next)
+		*nargv++ = sp->text;
+	*nargv = NULL;
+
+	TRACE(("vforkexec_pipestage: '%s' without fork\n", argv[0]));
+	sigblockall(NULL);
+	vforked = 1;
+
+	pid = vfork();
+
+	if (!pid) {
+		forkchild(jp, n, mode);
+		sigclearmask();
+		if (pip[1] >= 0) {
+			close(pip[0]);
+		}
+		if (prevfd > 0) {
+			dup2(prevfd, 0);
+			close(prevfd);
+		}
+		if (pip[1] > 1) {
+			dup2(pip[1], 1);
+			close(pip[1]);
+		}
+		shellexec(argv[0], argv, path, entry.u.index, FALSE);
+		/* NOTREACHED */
+	}
+
+	vforked = 0;
+	sigclearmask();
+	forkparent(jp, n, mode, pid);
+	popstackmark(&smark);
+	forks_saved++;
+	return 1;
+}
+#endif
+
 /*
  * Evaluate a pipeline.  All the processes in the pipeline are children
  * of the process creating the pipeline.  (This differs from some versions
@@ -11351,6 +11543,9 @@ evalpipe(union node *n, int flags)
 		fs.fd[2] = prevfd;
 		spawn_forkshell(&fs, jp, lp->n, n->npipe.pipe_backgnd);
 #else
+		if (vforkexec_pipestage(jp, lp->n, n->npipe.pipe_backgnd, prevfd, pip)) {
+			/* started, nothing else to do in the child */
+		} else
 		if (forkshell(jp, lp->n, n->npipe.pipe_backgnd) == 0) {
 			/* child */
 			reset_exception_handler();
@@ -12014,6 +12209,9 @@ static int historycmd(int, char **) FAST_FUNC;
 #if ENABLE_FEATURE_SH_MATH
 static int letcmd(int, char **) FAST_FUNC;
 #endif
+#if ENABLE_ASH_MAPFILE
+static int mapfilecmd(int, char **) FAST_FUNC;
+#endif
 static int readcmd(int, char **) FAST_FUNC;
 static int setcmd(int, char **) FAST_FUNC;
 static int shiftcmd(int, char **) FAST_FUNC;
@@ -12114,11 +12312,17 @@ static const struct builtincmd builtintab[] = {
 	{ BUILTIN_NOSPEC        "let"     +1, letcmd     },
 #endif
 	{ BUILTIN_SPEC_REG_ASSG "local"   +1, localcmd   },
+#if ENABLE_ASH_MAPFILE
+	{ BUILTIN_REGULAR       "mapfile" +1, mapfilecmd },
+#endif
 #if ENABLE_ASH_PRINTF
 	{ BUILTIN_REGULAR       "printf"  +1, printfcmd  },
 #endif
 	{ BUILTIN_REGULAR       "pwd"     +1, pwdcmd     },
 	{ BUILTIN_REGULAR       "read"    +1, readcmd    },
+#if ENABLE_ASH_MAPFILE
+	{ BUILTIN_REGULAR       "readarray"+1, mapfilecmd },
+#endif
 	{ BUILTIN_SPEC_REG_ASSG "readonly"+1, exportcmd  },
 	{ BUILTIN_SPEC_REG      "return"  +1, returncmd  },
 	{ BUILTIN_SPEC_REG      "set"     +1, setcmd     },
@@ -16223,6 +16427,73 @@ readcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 	return (uintptr_t)r;
 }
 
+#if ENABLE_ASH_MAPFILE
+/*
+ * The mapfile (aka readarray) builtin. Options:
+ *      -t              Remove trailing delimiter from each line
+ *      -d DELIM        Lines end on DELIM char, not newline
+ *      -n COUNT        Store at most COUNT lines
+ *      -s COUNT        Discard first COUNT lines
+ *      -u FD           Read from given FD instead of fd 0
+ * We have no arrays, lines are stored into positional parameters.
+ * With -n, input is read in big chunks and excess data can be put back
+ * only if it is a regular file.
+ */
+static int FAST_FUNC
+mapfilecmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
+{
+	struct builtin_mapfile_params params;
+	const char *r;
+	int i;
+
+	memset(&params, 0, sizeof(params));
+
+	while ((i = nextopt("td:n:s:u:")) != '\0') {
+		switch (i) {
+		case 't':
+			params.mapfile_flags |= BUILTIN_MAPFILE_TRIM;
+			break;
+		case 'd':
+			params.opt_d = optionarg;
+			break;
+		case 'n':
+			params.opt_n = optionarg;
+			break;
+		case 's':
+			params.opt_s = optionarg;
+			break;
+		case 'u':
+			params.opt_u = optionarg;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (*argptr)
+		ash_msg_and_raise_error("arrays are not supported");
+
+	INTOFF;
+ again:
+	r = shell_builtin_mapfile(&params);
+	if ((uintptr_t)r == 1 && errno == EINTR) {
+		/* Not a trapped signal (say, SIGCHLD)? Continue reading */
+		if (pending_sig == 0)
+			goto again;
+	}
+	if (r == NULL)
+		setparam(params.lines);
+	free(params.lines);
+	free(params.buf);
+	INTON;
+
+	if ((uintptr_t)r > 1)
+		ash_msg_and_raise_error(r);
+
+	return (uintptr_t)r;
+}
+#endif
+
 static int FAST_FUNC
 umaskcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 {
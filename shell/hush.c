@@ -314,6 +314,14 @@
 //config:	default y
 //config:	depends on SHELL_HUSH
 //config:
+//config:config HUSH_MAPFILE
+//config:	bool "mapfile builtin"
+//config:	default y
+//config:	depends on HUSH_BASH_COMPAT && HUSH_SET
+//config:	help
+//config:	Enable 'mapfile' and 'readarray' builtins, which read all lines
+//config:	of input in one go and store them as positional parameters.
+//config:
 //config:config HUSH_UNSET
 //config:	bool "unset builtin"
 //config:	default y
@@ -1142,6 +1150,9 @@ static int builtin_pwd(char **argv) FAST_FUNC;
 #if ENABLE_HUSH_READ
 static int builtin_read(char **argv) FAST_FUNC;
 #endif
+#if ENABLE_HUSH_MAPFILE
+static int builtin_mapfile(char **argv) FAST_FUNC;
+#endif
 #if ENABLE_HUSH_SET
 static int builtin_set(char **argv) FAST_FUNC;
 #endif
@@ -1241,12 +1252,18 @@ static const struct built_in_command bltins1[] ALIGN_PTR = {
 #if ENABLE_HUSH_LOCAL
 	BLTIN("local"    , builtin_local   , "Set local variables"),
 #endif
+#if ENABLE_HUSH_MAPFILE
+	BLTIN("mapfile"  , builtin_mapfile , "Read lines into positional parameters"),
+#endif
 #if ENABLE_HUSH_MEMLEAK
 	BLTIN("memleak"  , builtin_memleak , NULL),
 #endif
 #if ENABLE_HUSH_READ
 	BLTIN("read"     , builtin_read    , "Input into variable"),
 #endif
+#if ENABLE_HUSH_MAPFILE
+	BLTIN("readarray", builtin_mapfile , NULL),
+#endif
 #if ENABLE_HUSH_READONLY
 	BLTIN("readonly" , builtin_readonly, "Make variables read-only"),
 #endif
@@ -12050,6 +12067,29 @@ static int FAST_FUNC builtin_unset(char **argv)
 #endif
 
 #if ENABLE_HUSH_SET
+static void set_positional_params(char **argv)
+{
+	char **pp, **g_argv;
+
+	/* NB: G.global_argv[0] ($0) is never freed/changed */
+	g_argv = G.global_argv;
+	if (G.global_args_malloced) {
+		pp = g_argv;
+		while (*++pp)
+			free(*pp);
+		g_argv[1] = NULL;
+	} else {
+		G.global_args_malloced = 1;
+		pp = xzalloc(sizeof(pp[0]) * 2);
+		pp[0] = g_argv[0]; /* retain $0 */
+		g_argv = pp;
+	}
+	/* This realloc's G.global_argv */
+	G.global_argv = pp = add_strings_to_strings(g_argv, argv, /*dup:*/ 1);
+
+	G.global_argc = 1 + string_array_len(pp + 1);
+}
+
 /* http://www.opengroup.org/onlinepubs/9699919799/utilities/V3_chap02.html#set
  * built-in 'set' handler
  * SUSv3 says:
@@ -12074,7 +12114,6 @@ static int FAST_FUNC builtin_unset(char **argv)
 static int FAST_FUNC builtin_set(char **argv)
 {
 	int n;
-	char **pp, **g_argv;
 	char *arg = *++argv;
 
 	if (arg == NULL) {
@@ -12106,26 +12145,55 @@ static int FAST_FUNC builtin_set(char **argv)
 	if (arg == NULL)
 		return EXIT_SUCCESS;
  set_argv:
+	set_positional_params(argv);
+	return EXIT_SUCCESS;
+}
+#endif
 
-	/* NB: G.global_argv[0] ($0) is never freed/changed */
-	g_argv = G.global_argv;
-	if (G.global_args_malloced) {
-		pp = g_argv;
-		while (*++pp)
-			free(*pp);
-		g_argv[1] = NULL;
-	} else {
-		G.global_args_malloced = 1;
-		pp = xzalloc(sizeof(pp[0]) * 2);
-		pp[0] = g_argv[0]; /* retain $0 */
-		g_argv = pp;
+#if ENABLE_HUSH_MAPFILE
+/* mapfile [-t] [-d DELIM] [-n COUNT] [-s COUNT] [-u FD]
+ * We have no arrays, lines are stored into positional parameters.
+ */
+static int FAST_FUNC builtin_mapfile(char **argv)
+{
+	const char *r;
+	struct builtin_mapfile_params params;
+
+	memset(&params, 0, sizeof(params));
+
+	/* "!": do not abort on errors.
+	 * Option string must start with "t" to match BUILTIN_MAPFILE_xxx
+	 */
+	params.mapfile_flags = getopt32(argv, "!td:n:s:u:",
+		&params.opt_d, &params.opt_n, &params.opt_s, &params.opt_u
+	);
+	if ((uint32_t)params.mapfile_flags == (uint32_t)-1)
+		return EXIT_FAILURE;
+	if (argv[optind]) {
+		bb_error_msg("%s: arrays are not supported", argv[0]);
+		return 2;
 	}
-	/* This realloc's G.global_argv */
-	G.global_argv = pp = add_strings_to_strings(g_argv, argv, /*dup:*/ 1);
 
-	G.global_argc = 1 + string_array_len(pp + 1);
+ again:
+	r = shell_builtin_mapfile(&params);
 
-	return EXIT_SUCCESS;
+	if ((uintptr_t)r == 1 && errno == EINTR) {
+		unsigned sig = check_and_run_traps();
+		if (sig != SIGINT)
+			goto again;
+	}
+
+	if (r == NULL)
+		set_positional_params(params.lines);
+	free(params.lines);
+	free(params.buf);
+
+	if ((uintptr_t)r > 1) {
+		bb_simple_error_msg(r);
+		r = (char*)(uintptr_t)1;
+	}
+
+	return (uintptr_t)r;
 }
 #endif
 
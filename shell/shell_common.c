@@ -43,6 +43,10 @@ int FAST_FUNC varcmp(const char *p, const char *q)
 
 /* read builtin */
 
+#if ENABLE_FEATURE_SH_READ_BUFFERED
+enum { READ_BUFSIZE = 1024 };
+#endif
+
 /* Needs to be interruptible: shell must handle traps and shell-special signals
  * while inside read. To implement this, be sure to not loop on EINTR
  * and return errno == EINTR reliably.
@@ -75,6 +79,10 @@ shell_builtin_read(struct builtin_read_params *params)
 	char **argv;
 	const char *ifs;
 	int read_flags;
+#if ENABLE_FEATURE_SH_READ_BUFFERED
+	char *rabuf; /* readahead, only for seekable regular files */
+	int rapos, ralen;
+#endif
 
 	errno = err = 0;
 
@@ -203,6 +211,22 @@ shell_builtin_read(struct builtin_read_params *params)
 	buffer = NULL;
 	bufpos = 0;
 	delim = params->opt_d ? params->opt_d[0] : '\n';
+#if ENABLE_FEATURE_SH_READ_BUFFERED
+	/* Reading one byte at a time is needed to not consume input
+	 * past the delimiter. For seekable files, we can read a block
+	 * and seek back over the unused part when done.
+	 */
+	rabuf = NULL;
+	rapos = ralen = 0;
+	{
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+		 && lseek(fd, 0, SEEK_CUR) != (off_t)-1
+		) {
+			rabuf = xmalloc(READ_BUFSIZE);
+		}
+	}
+#endif
 	do {
 		char c;
 		int timeout;
@@ -231,6 +255,29 @@ shell_builtin_read(struct builtin_read_params *params)
 		errno = 0;
 		pfd->events = POLLIN;
 
+#if ENABLE_FEATURE_SH_READ_BUFFERED
+		if (rabuf) {
+			/* Regular files never block: skip poll(),
+			 * but still be interruptible by signals */
+			if (bb_got_signal) {
+				err = EINTR;
+				retval = (const char *)(uintptr_t)1;
+				goto ret;
+			}
+			if (rapos >= ralen) {
+				rapos = 0;
+				ralen = read(fd, rabuf, READ_BUFSIZE);
+				if (ralen <= 0) {
+					ralen = 0;
+					err = errno;
+					retval = (const char *)(uintptr_t)1;
+					break;
+				}
+			}
+			buffer[bufpos] = rabuf[rapos++];
+			goto got_char;
+		}
+#endif
 #if ENABLE_PLATFORM_MINGW32
 		if (fd_is_tty) {
 			int64_t key;
@@ -290,7 +337,7 @@ shell_builtin_read(struct builtin_read_params *params)
 #if ENABLE_PLATFORM_MINGW32
 		}
 #endif
-
+ IF_FEATURE_SH_READ_BUFFERED(got_char:)
 		c = buffer[bufpos];
 #if ENABLE_PLATFORM_MINGW32
 		if (c == '\n') {
@@ -418,6 +465,14 @@ shell_builtin_read(struct builtin_read_params *params)
 
  ret:
 	free(buffer);
+#if ENABLE_FEATURE_SH_READ_BUFFERED
+	if (rabuf) {
+		/* Give back what we did not consume */
+		if (ralen > rapos)
+			lseek(fd, rapos - ralen, SEEK_CUR);
+		free(rabuf);
+	}
+#endif
 #if !ENABLE_PLATFORM_MINGW32
 	if (read_flags & BUILTIN_READ_SILENT)
 		tcsetattr(fd, TCSANOW, &old_tty);
@@ -428,6 +483,119 @@ shell_builtin_read(struct builtin_read_params *params)
 #undef fd
 }
 
+/* mapfile builtin */
+
+#if ENABLE_ASH_MAPFILE || ENABLE_HUSH_MAPFILE
+/* Reads all input in big chunks and splits it into lines in one pass.
+ * Returns NULL on success, with params->lines set;
+ * (char*)1 on read error (errno is set, EINTR can be retried:
+ * data read so far is kept in params->buf);
+ * or error message.
+ */
+const char* FAST_FUNC
+shell_builtin_mapfile(struct builtin_mapfile_params *params)
+{
+	enum { CHUNK = 64 * 1024 };
+	unsigned count, skip;
+	unsigned nlines;
+	size_t size, scan;
+	char delim;
+	char *p, *end, *text;
+	char **lp;
+	int fd;
+
+	count = 0; /* 0: all lines */
+	if (params->opt_n) {
+		count = bb_strtou(params->opt_n, NULL, 10);
+		if (errno)
+			return "invalid count";
+	}
+	skip = 0;
+	if (params->opt_s) {
+		skip = bb_strtou(params->opt_s, NULL, 10);
+		if (errno)
+			return "invalid count";
+	}
+	fd = STDIN_FILENO;
+	if (params->opt_u) {
+		fd = bb_strtou(params->opt_u, NULL, 10);
+		if (fd < 0 || errno)
+			return "invalid file descriptor";
+	}
+	delim = params->opt_d ? params->opt_d[0] : '\n';
+
+	nlines = 0;
+	scan = 0;
+	size = params->len;
+	for (;;) {
+		ssize_t n;
+
+		if (count) {
+			/* Stop reading once we have enough lines */
+			p = params->buf + scan;
+			end = params->buf + params->len;
+			while (p < end && (p = memchr(p, delim, end - p)) != NULL) {
+				p++;
+				if (++nlines == skip + count) {
+					/* Give back extra data if we can (regular file) */
+					if (p < end)
+						lseek(fd, p - end, SEEK_CUR);
+					params->len = p - params->buf;
+					goto got_all;
+				}
+			}
+			scan = params->len;
+		}
+		if (size - params->len < CHUNK) {
+			size = params->len + CHUNK;
+			params->buf = xrealloc(params->buf, size);
+		}
+		n = read(fd, params->buf + params->len, size - params->len);
+		if (n < 0)
+			return (const char *)(uintptr_t)1;
+		if (n == 0)
+			break;
+		params->len += n;
+	}
+ got_all:
+
+	/* Count lines: the last one may lack the delimiter */
+	p = params->buf;
+	end = p + params->len;
+	nlines = 0;
+	while (p < end) {
+		p = memchr(p, delim, end - p);
+		nlines++;
+		if (!p)
+			break;
+		p++;
+	}
+
+	/* Vector and text in one block */
+	lp = params->lines = xmalloc((nlines + 1) * sizeof(lp[0]) + params->len + nlines);
+	text = (char *)(lp + nlines + 1);
+	p = params->buf;
+	while (p < end) {
+		char *e = memchr(p, delim, end - p);
+		size_t linelen = (e ? e + 1 : end) - p;
+
+		if (skip) {
+			skip--;
+		} else {
+			*lp++ = text;
+			memcpy(text, p, linelen);
+			text += linelen;
+			if (e && (params->mapfile_flags & BUILTIN_MAPFILE_TRIM))
+				text--;
+			*text++ = '\0';
+		}
+		p += linelen;
+	}
+	*lp = NULL;
+	return NULL;
+}
+#endif
+
 /* ulimit builtin */
 
 #if !ENABLE_PLATFORM_MINGW32
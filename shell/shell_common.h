@@ -53,6 +53,24 @@ enum {
 const char* FAST_FUNC
 shell_builtin_read(struct builtin_read_params *params);
 
+struct builtin_mapfile_params {
+	int        mapfile_flags;
+	const char *opt_n;
+	const char *opt_s;
+	const char *opt_u;
+	const char *opt_d;
+	/* Input read so far (kept across EINTR retries) */
+	char       *buf;
+	size_t     len;
+	/* Result: NULL-terminated, one malloced block */
+	char       **lines;
+};
+enum {
+	BUILTIN_MAPFILE_TRIM = 1 << 0,
+};
+const char* FAST_FUNC
+shell_builtin_mapfile(struct builtin_mapfile_params *params);
+
 int FAST_FUNC
 shell_builtin_ulimit(char **argv);
 
@@ -22,7 +22,7 @@
 //config:config FEATURE_LOGREAD_REDUCED_LOCKING
 //config:	bool "Double buffering"
 //config:	default y
-//config:	depends on LOGREAD
+//config:	depends on LOGREAD && !FEATURE_IPC_SYSLOG_LOCKLESS
 //config:	help
 //config:	'logread' output to slow serial terminals can have
 //config:	side effects on syslog because of the semaphore.
@@ -37,19 +37,130 @@
 
 //usage:#define logread_trivial_usage
 //usage:       "[-fF]"
+//usage:	IF_FEATURE_SYSLOGD_INDEX(" | [-s TIME] [-u TIME] [-p PRIO] FILE...")
 //usage:#define logread_full_usage "\n\n"
 //usage:       "Show messages in syslogd's circular buffer\n"
 //usage:     "\n	-f	Output data as log grows"
 //usage:     "\n	-F	Same as -f, but dump buffer first"
+//usage:	IF_FEATURE_SYSLOGD_INDEX(
+//usage:     "\n\nShow messages in log FILEs, using FILE.idx if syslogd -I made it\n"
+//usage:     "\n	-s TIME	Since TIME ([YYYY-]MM-DD hh:mm[:ss], hh:mm, @EPOCH...)"
+//usage:     "\n	-u TIME	Until TIME"
+//usage:     "\n	-p [FAC.]PRIO	Only PRIO (err, warning, 3, *...) and more urgent,"
+//usage:     "\n		of facility FAC (daemon, local0, 16...) if given"
+//usage:	)
 
 #include "libbb.h"
 #include "common_bufsiz.h"
 #include <sys/ipc.h>
 #include <sys/sem.h>
 #include <sys/shm.h>
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+#include <syslog.h>
+#endif
+#if ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #define DEBUG 0
 
+#if ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
+/* our shared key (syslogd.c and logread.c must be in sync) */
+enum { KEY_ID = 0x324e4547 }; /* "GEN2" */
+
+struct shbuf_ds {
+	uint32_t size;     /* size of data */
+	uint32_t seq;      /* number of next message */
+	uint32_t head;     /* where next record goes */
+	uint32_t tail;     /* oldest record */
+	uint32_t tail_seq; /* its number */
+	char data[1];      /* records */
+};
+struct shrec {
+	uint32_t seq;
+	uint32_t len;      /* with NUL; 0: continue at start of data */
+	char text[1];
+};
+#define SHREC_HDR offsetof(struct shrec, text)
+#define SHREC_SIZE(len) ((SHREC_HDR + (len) + 3) & ~3)
+
+static void interrupted(int sig)
+{
+	kill_myself_with_sig(sig);
+}
+
+static void read_shbuf(int follow)
+{
+	const struct shbuf_ds *shbuf;
+	uint32_t size, s, off, first, stop;
+	char *copy;
+	int log_shmid;
+
+	log_shmid = shmget(KEY_ID, 0, 0);
+	if (log_shmid == -1)
+		bb_perror_msg_and_die("can't %s syslogd buffer", "find");
+	shbuf = shmat(log_shmid, NULL, SHM_RDONLY);
+	if (shbuf == (void*) -1L)
+		bb_perror_msg_and_die("can't %s syslogd buffer", "access");
+
+	bb_signals(BB_FATAL_SIGS, interrupted);
+
+	size = shbuf->size;
+	copy = xmalloc(size);
+	/* -f: show only new messages */
+	first = stop = shbuf->seq;
+	if (!(follow & 1))
+		first -= size; /* everything */
+	goto resync;
+
+	for (;;) {
+		const struct shrec *r;
+		uint32_t len;
+
+		if (s == shbuf->seq || (!follow && s == stop)) {
+			if (!follow)
+				break;
+			fflush_all();
+			/* Sleep until syslogd adds a message */
+			syscall(SYS_futex, &shbuf->seq, FUTEX_WAIT, s, NULL, NULL, 0);
+			continue;
+		}
+		__sync_synchronize();
+		if (off + SHREC_HDR > size)
+			off = 0;
+		r = (const struct shrec *)(shbuf->data + off);
+		len = r->len;
+		if (r->seq != s)
+			goto resync; /* we fell behind */
+		if (len == 0) {
+			off = 0;
+			continue;
+		}
+		if (len > size - off - SHREC_HDR)
+			goto resync;
+		memcpy(copy, r->text, len);
+		/* Was it overwritten while we copied? */
+		__sync_synchronize();
+		if ((int32_t)(shbuf->tail_seq - s) > 0)
+			goto resync;
+		copy[len - 1] = '\0';
+		if ((int32_t)(s - first) >= 0)
+			fputs_stdout(copy);
+		s++;
+		off += SHREC_SIZE(len);
+		continue;
+ resync:
+		/* Restart at the oldest message. If it is not
+		 * consistent with its offset, r->seq check will catch it */
+		s = shbuf->tail_seq;
+		__sync_synchronize();
+		off = shbuf->tail;
+	}
+
+	fflush_stdout_and_exit_SUCCESS();
+}
+#else
 /* our shared key (syslogd.c and logread.c must be in sync) */
 enum { KEY_ID = 0x414e4547 }; /* "GENA" */
 
@@ -106,13 +217,11 @@ static void interrupted(int sig)
 	kill_myself_with_sig(sig);
 }
 
-int logread_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
-int logread_main(int argc UNUSED_PARAM, char **argv)
+static void read_shbuf(int follow)
 {
 	unsigned cur;
 	int log_semid; /* ipc semaphore id */
 	int log_shmid; /* ipc shared memory id */
-	int follow = getopt32(argv, "fF");
 
 	INIT_G();
 
@@ -228,3 +337,291 @@ int logread_main(int argc UNUSED_PARAM, char **argv)
 
 	fflush_stdout_and_exit_SUCCESS();
 }
+#endif
+
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+/* FILE.idx entry (syslogd.c and logread.c must be in sync) */
+struct log_index {
+	uint32_t start;    /* offset of the first message */
+	uint32_t len;      /* total length of the messages */
+	uint32_t t_first;  /* when the first one was received */
+	uint32_t t_last;   /* when the last one was received */
+	uint32_t facmap[4]; /* bit LOG_FAC(pri) (0..127) of each message */
+	uint8_t primap;    /* 1 << LOG_PRI(pri) of each message */
+	uint8_t pad[3];
+};
+
+enum { LINES_BUFSZ = 64 * 1024 };
+
+typedef struct log_filter_t {
+	smallint use_time;
+	uint8_t primask;   /* 1 << prio of the wanted priorities */
+	int fac;           /* wanted facility, or -1 */
+	time_t since, until;
+	char *buf;
+} log_filter_t;
+
+/* syslogd writes the first name <syslog.h> has for a prio ("warn", not
+ * "warning"), -p takes the others too */
+static const char prio_names[] ALIGN1 =
+	"emerg\0""panic\0""emergency\0"
+	"alert\0"
+	"crit\0""critical\0"
+	"err\0""error\0"
+	"warn\0""warning\0"
+	"notice\0""info\0""debug\0";
+static const uint8_t prio_vals[] ALIGN1 = {
+	LOG_EMERG, LOG_EMERG, LOG_EMERG,
+	LOG_ALERT,
+	LOG_CRIT, LOG_CRIT,
+	LOG_ERR, LOG_ERR,
+	LOG_WARNING, LOG_WARNING,
+	LOG_NOTICE, LOG_INFO, LOG_DEBUG
+};
+
+/* Names as in <syslog.h> facilitynames[] (logread can't use it:
+ * with SYSLOG_NAMES, <syslog.h> defines it, and syslogd has it) */
+static const char fac_names[] ALIGN1 =
+	"kern\0""user\0""mail\0""daemon\0""auth\0""syslog\0""lpr\0""news\0"
+	"uucp\0""cron\0""authpriv\0""ftp\0"
+	"local0\0""local1\0""local2\0""local3\0"
+	"local4\0""local5\0""local6\0""local7\0"
+	"security\0";
+static const uint8_t fac_vals[] ALIGN1 = {
+	0, 1, 2, 3, 4, 5, 6, 7,
+	8, 9, 10, 11,
+	16, 17, 18, 19,
+	20, 21, 22, 23,
+	4
+};
+
+static int prio_by_name(const char *name)
+{
+	int i = index_in_strings(prio_names, name);
+	return i < 0 ? i : prio_vals[i];
+}
+
+static int fac_by_name(const char *name)
+{
+	int i = index_in_strings(fac_names, name);
+	return i < 0 ? i : fac_vals[i];
+}
+
+static time_t parse_time(const char *str)
+{
+	struct tm tm;
+	time_t t;
+
+	/* Makes "hh:mm" mean today */
+	time(&t);
+	localtime_r(&t, &tm);
+	if (parse_datestr(str, &tm))
+		tm.tm_isdst = -1;
+	return validate_tm_time(str, &tm);
+}
+
+/* "Mmm dd hh:mm:ss[.mmm] host fac.prio msg\n", as written by syslogd.
+ * Year is not in the line: it is the one of 'ref', or the one before
+ * if that would put the line in the future.
+ */
+static int line_matches(const log_filter_t *f, const char *line, time_t ref)
+{
+	if (f->use_time) {
+		struct tm tm;
+		time_t t;
+
+		localtime_r(&ref, &tm);
+		tm.tm_isdst = -1;
+		if (!strptime(line, "%b %d %H:%M:%S", &tm))
+			return 0;
+		t = mktime(&tm);
+		if (t > ref + 24*60*60) {
+			tm.tm_year--;
+			t = mktime(&tm);
+		}
+		if (t < f->since || t > f->until)
+			return 0;
+	}
+	if (f->primask != 0xff || f->fac >= 0) {
+		char word[16];
+		const char *p = line;
+		const char *dot;
+		int i, fac;
+
+		for (i = 0; i < 4; i++)
+			p = skip_whitespace(skip_non_whitespace(p));
+		i = strcspn(p, " \n");
+		if (*p == '<') {
+			i = bb_strtou(p + 1, NULL, 10);
+			fac = LOG_FAC(i);
+			i &= LOG_PRIMASK;
+		} else {
+			dot = memchr(p, '.', i);
+			if (!dot || i >= (int)sizeof(word))
+				return 1; /* -S: there is no prio */
+			safe_strncpy(word, p, dot - p + 1);
+			fac = fac_by_name(word);
+			safe_strncpy(word, dot + 1, i - (dot - p));
+			i = prio_by_name(word);
+			if (i < 0)
+				return 0;
+		}
+		if (f->fac >= 0 && fac != f->fac)
+			return 0;
+		return (f->primask >> i) & 1;
+	}
+	return 1;
+}
+
+/* Show matching lines in bytes from..to-1 of fd */
+static void show_range(const log_filter_t *f, int fd, off_t from, off_t to, time_t ref)
+{
+	char *buf = f->buf;
+
+	while (from < to) {
+		char *p, *end;
+		ssize_t len = pread(fd, buf, MIN(to - from, LINES_BUFSZ), from);
+
+		if (len <= 0)
+			break;
+		/* Only whole lines, unless one is longer than buf */
+		end = memrchr(buf, '\n', len);
+		if (end)
+			len = end - buf + 1;
+		from += len;
+		buf[len] = '\0';
+		end = buf + len;
+		for (p = buf; p < end;) {
+			char *nl = memchr(p, '\n', end - p);
+			nl = nl ? nl + 1 : end;
+			if (line_matches(f, p, ref))
+				fwrite(p, 1, nl - p, stdout);
+			p = nl;
+		}
+	}
+}
+
+static void read_indexed(const log_filter_t *f, const char *name)
+{
+	struct stat st;
+	struct log_index *idx;
+	char *idx_name;
+	size_t size;
+	off_t pos;
+	unsigned cnt, lo, hi;
+	int fd;
+
+	fd = open_or_warn(name, O_RDONLY);
+	if (fd < 0)
+		return;
+	fstat(fd, &st);
+	idx_name = xasprintf("%s.idx", name);
+	size = INT_MAX;
+	idx = xmalloc_open_read_close(idx_name, &size);
+	free(idx_name);
+	cnt = idx ? size / sizeof(*idx) : 0;
+
+	/* Receive times do not decrease: find first entry
+	 * with messages since f->since, skip what is before it */
+	lo = 0;
+	hi = cnt;
+	while (f->use_time && lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if ((time_t)idx[mid].t_last < f->since)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	pos = lo ? idx[lo - 1].start + idx[lo - 1].len : 0;
+	for (; lo < cnt; lo++) {
+		struct log_index *e = &idx[lo];
+
+		/* Index is not for this file (anymore)? */
+		if (e->start < pos || e->start + (off_t)e->len > st.st_size)
+			break;
+		/* Messages between entries are not indexed */
+		if (e->start > pos)
+			show_range(f, fd, pos, e->start, e->t_first);
+		if (f->use_time && (time_t)e->t_first > f->until) {
+			pos = st.st_size;
+			break;
+		}
+		if ((e->primap & f->primask)
+		 && (f->fac < 0 || (e->facmap[f->fac / 32] >> (f->fac % 32)) & 1)
+		)
+			show_range(f, fd, e->start, e->start + e->len, e->t_last);
+		pos = e->start + e->len;
+	}
+	/* After the last entry */
+	show_range(f, fd, pos, st.st_size, st.st_mtime);
+
+	free(idx);
+	close(fd);
+}
+#endif
+
+int logread_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
+int logread_main(int argc UNUSED_PARAM, char **argv)
+{
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+	enum {
+		OPT_s = 1 << 2,
+		OPT_u = 1 << 3,
+		OPT_p = 1 << 4,
+	};
+# if ENABLE_LONG_OPTS
+	static const char logread_longopts[] ALIGN1 =
+		"since\0"  Required_argument "s"
+		"until\0"  Required_argument "u"
+		"prio\0"   Required_argument "p"
+	;
+# endif
+	log_filter_t f;
+	const char *opt_s, *opt_u;
+	char *opt_p;
+	int opts = getopt32long(argv, "fFs:u:p:", logread_longopts,
+			&opt_s, &opt_u, &opt_p);
+
+	argv += optind;
+	if (argv[0]) {
+		memset(&f, 0, sizeof(f));
+		f.use_time = (opts & (OPT_s | OPT_u)) != 0;
+		f.until = (time_t)LONG_MAX;
+		if (opts & OPT_s)
+			f.since = parse_time(opt_s);
+		if (opts & OPT_u)
+			f.until = parse_time(opt_u);
+		f.primask = 0xff;
+		f.fac = -1;
+		if (opts & OPT_p) {
+			char *prio_str = strchr(opt_p, '.');
+
+			if (prio_str) {
+				*prio_str++ = '\0';
+				f.fac = fac_by_name(opt_p);
+				if (f.fac < 0)
+					f.fac = xatou_range(opt_p, 0, 127);
+			} else {
+				prio_str = opt_p;
+			}
+			if (NOT_LONE_CHAR(prio_str, '*')) {
+				int prio = prio_by_name(prio_str);
+				if (prio < 0)
+					prio = xatou_range(prio_str, 0, 7);
+				f.primask = (2 << prio) - 1;
+			}
+		}
+		f.buf = xmalloc(LINES_BUFSZ + 1);
+		do
+			read_indexed(&f, *argv);
+		while (*++argv);
+		fflush_stdout_and_exit_SUCCESS();
+	}
+	if (opts & (OPT_s | OPT_u | OPT_p))
+		bb_show_usage();
+	read_shbuf(opts & 3);
+#else
+	read_shbuf(getopt32(argv, "fF"));
+#endif
+	return EXIT_SUCCESS;
+}
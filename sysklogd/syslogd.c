@@ -64,6 +64,18 @@
 //config:	help
 //config:	Supports restricted syslogd config. See docs/syslog.conf.txt
 //config:
+//config:config FEATURE_SYSLOGD_INDEX
+//config:	bool "Support -I (index log files)"
+//config:	default y
+//config:	depends on SYSLOGD
+//config:	help
+//config:	With -I N, next to each log FILE syslogd writes FILE.idx:
+//config:	an entry per N messages with their offset in FILE,
+//config:	the time they were received and bitmaps of their
+//config:	facilities and priorities. "logread -s/-u/-p FILE"
+//config:	uses it to find messages of a time range, facility
+//config:	or priority without reading all of FILE.
+//config:
 //config:config FEATURE_SYSLOGD_PRECISE_TIMESTAMPS
 //config:	bool "Include milliseconds in timestamps"
 //config:	default n
@@ -82,6 +94,17 @@
 //config:	Actual memory usage increases around five times the
 //config:	change done here.
 //config:
+//config:config FEATURE_SYSLOGD_BATCH
+//config:	bool "Receive and write messages in batches"
+//config:	default y
+//config:	depends on SYSLOGD
+//config:	help
+//config:	Receive up to 16 queued messages per system call (recvmmsg)
+//config:	and collect log file output in a buffer, written out when
+//config:	no more messages are waiting, when it fills up, or once
+//config:	a second. Makes syslogd much cheaper at high message rates.
+//config:	Memory usage grows by 16 read buffers and 8k per log file.
+//config:
 //config:config FEATURE_IPC_SYSLOG
 //config:	bool "Circular Buffer support"
 //config:	default y
@@ -105,6 +128,20 @@
 //config:	This option sets the size of the circular buffer
 //config:	used to record system log messages.
 //config:
+//config:config FEATURE_IPC_SYSLOG_LOCKLESS
+//config:	bool "Lock-free circular buffer (Linux only)"
+//config:	default y
+//config:	depends on FEATURE_IPC_SYSLOG
+//config:	help
+//config:	Use a buffer of numbered records which logread reads
+//config:	without taking a lock, instead of guarding every message
+//config:	with SysV semaphores. "logread -f" sleeps on a futex
+//config:	until syslogd adds messages instead of polling once
+//config:	a second. Any number of readers can follow the log
+//config:	without slowing syslogd down.
+//config:	The buffer format is different: syslogd and logread
+//config:	must be built with the same setting.
+//config:
 //config:config FEATURE_KMSG_SYSLOG
 //config:	bool "Linux kernel printk buffer support"
 //config:	default y
@@ -154,6 +191,9 @@
 //usage:	IF_FEATURE_SYSLOGD_CFG(
 //usage:     "\n	-f FILE		Use FILE as config (default:/etc/syslog.conf)"
 //usage:	)
+//usage:	IF_FEATURE_SYSLOGD_INDEX(
+//usage:     "\n	-I N		Index every N messages in FILE.idx (for logread -s/-u/-p)"
+//usage:	)
 /* //usage:  "\n	-m MIN		Minutes between MARK lines (default 20, 0=off)" */
 //usage:
 //usage:#define syslogd_example_usage
@@ -183,6 +223,10 @@
 #include <sys/sem.h>
 #include <sys/shm.h>
 #endif
+#if ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 
 #define DEBUG 0
@@ -195,17 +239,51 @@
 /* Write locking does not seem to be useful either */
 #undef SYSLOGD_WRLOCK
 
+#if ENABLE_FEATURE_SYSLOGD_BATCH && defined(MSG_WAITFORONE)
+# define SYSLOGD_RECVMMSG 1
+#endif
+
 enum {
 	MAX_READ = CONFIG_FEATURE_SYSLOGD_READ_BUFFER_SIZE,
 	DNS_WAIT_SEC = 2 * 60,
+#ifdef SYSLOGD_RECVMMSG
+	RECV_BATCH = 16,
+#else
+	RECV_BATCH = 1,
+#endif
+	/* Receive ring: one more slot keeps the previous message for -D */
+	RECV_SLOTS = RECV_BATCH + ENABLE_FEATURE_SYSLOGD_DUP,
+	LOG_WBUF_SIZE = 8 * 1024,
 };
 
+#if !ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
 /* Semaphore operation structures */
 struct shbuf_ds {
 	int32_t size;   /* size of data - 1 */
 	int32_t tail;   /* end of message list */
 	char data[1];   /* data/messages */
 };
+#else
+/* Lock-free ring, written only by us (syslogd.c and logread.c must be in sync).
+ * Readers never write to it: they copy a record, then check that
+ * tail_seq did not move past it meanwhile, else they start over at tail.
+ */
+struct shbuf_ds {
+	uint32_t size;     /* size of data */
+	uint32_t seq;      /* number of next message; readers wait on it */
+	uint32_t head;     /* where next record goes */
+	uint32_t tail;     /* oldest record */
+	uint32_t tail_seq; /* its number */
+	char data[1];      /* records */
+};
+struct shrec {
+	uint32_t seq;
+	uint32_t len;      /* with NUL; 0: continue at start of data */
+	char text[1];
+};
+# define SHREC_HDR offsetof(struct shrec, text)
+# define SHREC_SIZE(len) ((SHREC_HDR + (len) + 3) & ~3)
+#endif
 
 #if ENABLE_FEATURE_REMOTE_LOG
 typedef struct {
@@ -216,14 +294,40 @@ typedef struct {
 } remoteHost_t;
 #endif
 
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+/* FILE.idx entry (syslogd.c and logread.c must be in sync) */
+struct log_index {
+	uint32_t start;    /* offset of the first message */
+	uint32_t len;      /* total length of the messages */
+	uint32_t t_first;  /* when the first one was received */
+	uint32_t t_last;   /* when the last one was received */
+	uint32_t facmap[4]; /* bit LOG_FAC(pri) (0..127) of each message */
+	uint8_t primap;    /* 1 << LOG_PRI(pri) of each message */
+	uint8_t pad[3];
+};
+#endif
+
 typedef struct logFile_t {
 	const char *path;
 	int fd;
 	time_t last_log_time;
+	/* identity of the opened file, to notice it was renamed or deleted */
+	dev_t dev;
+	ino_t ino;
 #if ENABLE_FEATURE_ROTATE_LOGFILE
 	unsigned size;
 	uint8_t isRegular;
 #endif
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	unsigned wlen;
+	char *wbuf;
+#endif
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+	int idx_fd;
+	unsigned idx_count; /* messages in idx */
+	uint32_t idx_end;   /* where next message goes */
+	struct log_index idx;
+#endif
 } logFile_t;
 
 #if ENABLE_FEATURE_SYSLOGD_CFG
@@ -260,6 +364,10 @@ IF_FEATURE_SYSLOGD_CFG( \
 IF_FEATURE_KMSG_SYSLOG( \
 	int kmsgfd; \
 	int primask; \
+) \
+IF_FEATURE_SYSLOGD_INDEX( \
+	/* messages per index entry, 0: no index */ \
+	unsigned indexEvery; \
 )
 
 struct init_globals {
@@ -277,9 +385,15 @@ struct globals {
 #endif
 	/* localhost's name. We print only first 64 chars */
 	char *hostname;
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	/* some log file has buffered output */
+	smallint log_pending;
+	unsigned last_flush; /* monotonic_sec() of last flush_log_files() */
+#endif
 
-	/* We recv into recvbuf... */
-	char recvbuf[MAX_READ * (1 + ENABLE_FEATURE_SYSLOGD_DUP)];
+	/* We recv into recvbuf slots... */
+	unsigned recvlen[RECV_BATCH];
+	char recvbuf[RECV_SLOTS][MAX_READ];
 	/* ...then copy to parsebuf, escaping control chars */
 	/* (can grow x2 max) */
 	char parsebuf[MAX_READ*2];
@@ -293,6 +407,9 @@ static const struct init_globals init_data = {
 	.logFile = {
 		.path = "/var/log/messages",
 		.fd = -1,
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+		.idx_fd = -1,
+#endif
 	},
 #ifdef SYSLOGD_MARK
 	.markInterval = 20 * 60,
@@ -333,6 +450,7 @@ enum {
 	IF_FEATURE_SYSLOGD_DUP(   OPTBIT_dup        ,)	// -D
 	IF_FEATURE_SYSLOGD_CFG(   OPTBIT_cfg        ,)	// -f
 	IF_FEATURE_KMSG_SYSLOG(   OPTBIT_kmsg       ,)	// -K
+	IF_FEATURE_SYSLOGD_INDEX( OPTBIT_index      ,)	// -I
 
 	OPT_mark        = 1 << OPTBIT_mark    ,
 	OPT_nofork      = 1 << OPTBIT_nofork  ,
@@ -348,6 +466,7 @@ enum {
 	OPT_dup         = IF_FEATURE_SYSLOGD_DUP(   (1 << OPTBIT_dup        )) + 0,
 	OPT_cfg         = IF_FEATURE_SYSLOGD_CFG(   (1 << OPTBIT_cfg        )) + 0,
 	OPT_kmsg        = IF_FEATURE_KMSG_SYSLOG(   (1 << OPTBIT_kmsg       )) + 0,
+	OPT_index       = IF_FEATURE_SYSLOGD_INDEX( (1 << OPTBIT_index      )) + 0,
 };
 #define OPTION_STR "m:nO:l:St" \
 	IF_FEATURE_ROTATE_LOGFILE("s:" ) \
@@ -357,18 +476,21 @@ enum {
 	IF_FEATURE_IPC_SYSLOG(    "C::") \
 	IF_FEATURE_SYSLOGD_DUP(   "D"  ) \
 	IF_FEATURE_SYSLOGD_CFG(   "f:" ) \
-	IF_FEATURE_KMSG_SYSLOG(   "K"  )
+	IF_FEATURE_KMSG_SYSLOG(   "K"  ) \
+	IF_FEATURE_SYSLOGD_INDEX( "I:" )
 #define OPTION_DECL *opt_m, *opt_l \
 	IF_FEATURE_ROTATE_LOGFILE(,*opt_s) \
 	IF_FEATURE_ROTATE_LOGFILE(,*opt_b) \
 	IF_FEATURE_IPC_SYSLOG(    ,*opt_C = NULL) \
-	IF_FEATURE_SYSLOGD_CFG(   ,*opt_f = NULL)
+	IF_FEATURE_SYSLOGD_CFG(   ,*opt_f = NULL) \
+	IF_FEATURE_SYSLOGD_INDEX( ,*opt_I)
 #define OPTION_PARAM &opt_m, &(G.logFile.path), &opt_l \
 	IF_FEATURE_ROTATE_LOGFILE(,&opt_s) \
 	IF_FEATURE_ROTATE_LOGFILE(,&opt_b) \
 	IF_FEATURE_REMOTE_LOG(    ,&remoteAddrList) \
 	IF_FEATURE_IPC_SYSLOG(    ,&opt_C) \
-	IF_FEATURE_SYSLOGD_CFG(   ,&opt_f)
+	IF_FEATURE_SYSLOGD_CFG(   ,&opt_f) \
+	IF_FEATURE_SYSLOGD_INDEX( ,&opt_I)
 
 
 #if ENABLE_FEATURE_SYSLOGD_CFG
@@ -534,6 +656,9 @@ static void parse_syslogdcfg(const char *file)
 		}
 		cur_rule->file = xzalloc(sizeof(*cur_rule->file));
 		cur_rule->file->fd = -1;
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+		cur_rule->file->idx_fd = -1;
+#endif
 		cur_rule->file->path = xstrdup(tok[1]);
  found:
 		pp_rule = &cur_rule->next;
@@ -557,7 +682,11 @@ static void parse_syslogdcfg(const char *file)
 #endif
 
 /* our shared key (syslogd.c and logread.c must be in sync) */
+#if !ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
 enum { KEY_ID = 0x414e4547 }; /* "GENA" */
+#else
+enum { KEY_ID = 0x324e4547 }; /* "GEN2": old logread must not find it */
+#endif
 
 static void ipcsyslog_cleanup(void)
 {
@@ -588,6 +717,11 @@ static void ipcsyslog_init(void)
 	}
 
 	memset(G.shbuf, 0, G.shm_size);
+#if ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
+	G.shbuf->size = (G.shm_size - offsetof(struct shbuf_ds, data)) & ~3;
+	/* no semaphores */
+	return;
+#endif
 	G.shbuf->size = G.shm_size - offsetof(struct shbuf_ds, data) - 1;
 	/*G.shbuf->tail = 0;*/
 
@@ -603,6 +737,85 @@ static void ipcsyslog_init(void)
 	}
 }
 
+#if ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
+static struct shrec *shrec_at(uint32_t off)
+{
+	return (struct shrec *)(G.shbuf->data + off);
+}
+
+/* Wake up "logread -f" */
+static void ipcsyslog_wakeup(void)
+{
+	syscall(SYS_futex, &G.shbuf->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Drop the oldest record */
+static void shmem_evict(void)
+{
+	struct shbuf_ds *b = G.shbuf;
+
+	if (b->tail + SHREC_HDR > b->size || shrec_at(b->tail)->len == 0) {
+		b->tail = 0;
+		return;
+	}
+	b->tail += SHREC_SIZE(shrec_at(b->tail)->len);
+	b->tail_seq++;
+}
+
+/* Write message to shared mem buffer */
+static void log_to_shmem(const char *msg)
+{
+	struct shbuf_ds *b = G.shbuf;
+	struct shrec *r;
+	uint32_t s = b->seq;
+	uint32_t len = strlen(msg) + 1; /* length with NUL included */
+	uint32_t rs;
+	uint32_t p = b->head;
+
+	/* A record must fit in the buffer: truncate longer messages
+	 * (-C 4 with a large read buffer) */
+	if (len > b->size - SHREC_HDR)
+		len = b->size - SHREC_HDR;
+	rs = SHREC_SIZE(len);
+
+	/* Records do not wrap: a record with len 0 (or no room left
+	 * even for the header) says "continue at start of data".
+	 * Move tail past all records which we are about to overwrite.
+	 */
+	if (p + rs > b->size) {
+		while (b->tail_seq != s && b->tail >= p)
+			shmem_evict();
+		__sync_synchronize();
+		if (p + SHREC_HDR <= b->size) {
+			r = shrec_at(p);
+			r->len = 0;
+			r->seq = s;
+		}
+		p = 0;
+	}
+	while (b->tail_seq != s && b->tail >= p && b->tail < p + rs)
+		shmem_evict();
+	if (b->tail_seq == s) /* empty */
+		b->tail = p;
+	/* Readers must see the new tail before we change the data */
+	__sync_synchronize();
+
+	r = shrec_at(p);
+	r->len = len;
+	memcpy(r->text, msg, len - 1);
+	r->text[len - 1] = '\0';
+	r->seq = s;
+	b->head = p + rs;
+	__sync_synchronize();
+	b->seq = s + 1;
+# if ENABLE_FEATURE_SYSLOGD_BATCH
+	/* Woken up in flush_log_files() when no more messages are waiting */
+	G.log_pending = 1;
+# else
+	ipcsyslog_wakeup();
+# endif
+}
+#else
 /* Write message to shared mem buffer */
 static void log_to_shmem(const char *msg)
 {
@@ -643,6 +856,7 @@ static void log_to_shmem(const char *msg)
 	if (DEBUG)
 		printf("tail:%d\n", G.shbuf->tail);
 }
+#endif
 #else
 static void ipcsyslog_cleanup(void) {}
 static void ipcsyslog_init(void) {}
@@ -687,8 +901,144 @@ static void kmsg_cleanup(void) {}
 static void log_to_kmsg(int pri UNUSED_PARAM, const char *msg UNUSED_PARAM) {}
 #endif /* FEATURE_KMSG_SYSLOG */
 
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+/* Write out buffered data of log_file, followed by msg */
+static void flush_log_file(logFile_t *log_file, const char *msg, int len)
+{
+	struct iovec iov[2];
+	ssize_t n;
+	int i;
+
+	if (log_file->wlen == 0 && len == 0)
+		return;
+	iov[0].iov_base = log_file->wbuf;
+	iov[0].iov_len = log_file->wlen;
+	iov[1].iov_base = (char *)msg;
+	iov[1].iov_len = len;
+	log_file->wlen = 0;
+/* TODO: what to do on write errors ("disk full")? */
+	n = writev(log_file->fd, iov, 2);
+	/* Short write (fd is O_NONBLOCK): finish it the slow way */
+	for (i = 0; n >= 0 && i < 2; i++) {
+		if ((size_t)n < iov[i].iov_len) {
+			full_write(log_file->fd, (char *)iov[i].iov_base + n, iov[i].iov_len - n);
+			n = 0;
+		} else {
+			n -= iov[i].iov_len;
+		}
+	}
+}
+
+static void log_file_write(logFile_t *log_file, const char *msg, int len)
+{
+	if (log_file->wlen + len > LOG_WBUF_SIZE) {
+		flush_log_file(log_file, msg, len);
+		return;
+	}
+	if (!log_file->wbuf)
+		log_file->wbuf = xmalloc(LOG_WBUF_SIZE);
+	memcpy(log_file->wbuf + log_file->wlen, msg, len);
+	log_file->wlen += len;
+	G.log_pending = 1;
+}
+
+static void flush_log_files(void)
+{
+# if ENABLE_FEATURE_SYSLOGD_CFG
+	logRule_t *rule;
+
+	/* files shared by several rules are flushed only once: wlen is 0 then */
+	for (rule = G.log_rules; rule; rule = rule->next)
+		flush_log_file(rule->file, NULL, 0);
+# endif
+	flush_log_file(&G.logFile, NULL, 0);
+# if ENABLE_FEATURE_IPC_SYSLOG_LOCKLESS
+	if (G.shbuf)
+		ipcsyslog_wakeup();
+# endif
+	G.log_pending = 0;
+	G.last_flush = monotonic_sec();
+}
+#else
+# define flush_log_file(log_file, msg, len) ((void)0)
+# define log_file_write(log_file, msg, len) full_write((log_file)->fd, msg, len)
+#endif
+
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+static void index_open(logFile_t *log_file, off_t size)
+{
+	char *name = xasprintf("%s.idx", log_file->path);
+	/* A new (or emptied) log file gets a new index */
+	log_file->idx_fd = open(name, O_WRONLY | O_CREAT | O_NOCTTY | O_APPEND
+			| (size == 0 ? O_TRUNC : 0), 0666);
+	free(name);
+	log_file->idx_count = 0;
+	log_file->idx_end = size;
+}
+
+static void index_close(logFile_t *log_file)
+{
+	if (log_file->idx_fd < 0)
+		return;
+	if (log_file->idx_count) {
+		/* Entry must not point past the end of FILE */
+		flush_log_file(log_file, NULL, 0);
+		log_file->idx.len = log_file->idx_end - log_file->idx.start;
+		full_write(log_file->idx_fd, &log_file->idx, sizeof(log_file->idx));
+		log_file->idx_count = 0;
+	}
+	close(log_file->idx_fd);
+	log_file->idx_fd = -1;
+}
+
+/* Called after msg is written (or buffered) */
+static void index_add(logFile_t *log_file, time_t now, int pri, int len)
+{
+	struct log_index *idx = &log_file->idx;
+	unsigned fac = LOG_FAC(pri);
+
+	if (log_file->idx_fd < 0 || len <= 0)
+		return;
+	if (!now)
+		now = time(NULL);
+	if (log_file->idx_count == 0) {
+		memset(idx, 0, sizeof(*idx));
+		idx->start = log_file->idx_end;
+		idx->t_first = now;
+	}
+	idx->t_last = now;
+	idx->facmap[fac / 32] |= 1U << (fac % 32);
+	idx->primap |= 1 << LOG_PRI(pri);
+	log_file->idx_end += len;
+	if (++log_file->idx_count >= G.indexEvery) {
+		/* Messages after the last entry are found by reading FILE.
+		 * Readers trust the entry: FILE must have its messages first
+		 */
+		flush_log_file(log_file, NULL, 0);
+		idx->len = log_file->idx_end - idx->start;
+		full_write(log_file->idx_fd, idx, sizeof(*idx));
+		log_file->idx_count = 0;
+	}
+}
+
+# if ENABLE_FEATURE_ROTATE_LOGFILE
+static void rename_index(const char *from, const char *to)
+{
+	char *f = xasprintf("%s.idx", from);
+	char *t = xasprintf("%s.idx", to);
+	rename(f, t);
+	free(t);
+	free(f);
+}
+# endif
+#else
+static void index_close(logFile_t *log_file UNUSED_PARAM) {}
+static void index_add(logFile_t *log_file UNUSED_PARAM, time_t now UNUSED_PARAM,
+		int pri UNUSED_PARAM, int len UNUSED_PARAM) {}
+#endif
+
 /* Print a message to the log file. */
-static void log_locally(time_t now, char *msg, logFile_t *log_file)
+static void log_locally(time_t now, int pri, char *msg, logFile_t *log_file)
 {
 #ifdef SYSLOGD_WRLOCK
 	struct flock fl;
@@ -698,8 +1048,9 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 	/* fd can't be 0 (we connect fd 0 to /dev/log socket) */
 	/* fd is 1 if "-O -" is in use */
 	if (log_file->fd > 1) {
-		/* Reopen log files every second. This allows admin
-		 * to delete the files and not worry about restarting us.
+		/* Check every second that the log file is still there.
+		 * This allows admin to delete or rename the files
+		 * and not worry about restarting us.
 		 * This costs almost nothing since it happens
 		 * _at most_ once a second for each file, and happens
 		 * only when each file is actually written.
@@ -707,9 +1058,27 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 		if (!now)
 			now = time(NULL);
 		if (log_file->last_log_time != now) {
+			struct stat statf;
+
 			log_file->last_log_time = now;
-			close(log_file->fd);
-			goto reopen;
+			/* Buffered output is at most a second old */
+			flush_log_file(log_file, NULL, 0);
+			if (stat(log_file->path, &statf) != 0
+			 || statf.st_ino != log_file->ino
+			 || statf.st_dev != log_file->dev
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+			 /* truncated? then index is stale */
+			 || (log_file->idx_fd >= 0 && statf.st_size < log_file->idx_end)
+#endif
+			) {
+				index_close(log_file);
+				close(log_file->fd);
+				goto reopen;
+			}
+#if ENABLE_FEATURE_ROTATE_LOGFILE
+			/* Someone may have truncated it */
+			log_file->size = statf.st_size;
+#endif
 		}
 	}
 	else if (log_file->fd == 1) {
@@ -734,14 +1103,22 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 					close(fd);
 				return;
 			}
-#if ENABLE_FEATURE_ROTATE_LOGFILE
 			{
 				struct stat statf;
-				log_file->isRegular = (fstat(log_file->fd, &statf) == 0 && S_ISREG(statf.st_mode));
+				int r = fstat(log_file->fd, &statf);
+				log_file->dev = statf.st_dev;
+				log_file->ino = statf.st_ino;
+#if ENABLE_FEATURE_ROTATE_LOGFILE
+				log_file->isRegular = (r == 0 && S_ISREG(statf.st_mode));
 				/* bug (mostly harmless): can wrap around if file > 4gb */
 				log_file->size = statf.st_size;
-			}
 #endif
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+				if (G.indexEvery && r == 0 && S_ISREG(statf.st_mode))
+					index_open(log_file, statf.st_size);
+#endif
+				(void)r;
+			}
 		}
 	}
 
@@ -755,6 +1132,9 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 
 #if ENABLE_FEATURE_ROTATE_LOGFILE
 	if (G.logFileSize && log_file->isRegular && log_file->size > G.logFileSize) {
+		/* Buffered messages belong to the old file */
+		flush_log_file(log_file, NULL, 0);
+		index_close(log_file);
 		if (G.logFileRotate) { /* always 0..99 */
 			int i = strlen(log_file->path) + 3 + 1;
 			char oldFile[i];
@@ -767,9 +1147,17 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 				sprintf(oldFile, "%s.%d", log_file->path, --i);
 				/* ignore errors - file might be missing */
 				rename(oldFile, newFile);
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+				if (G.indexEvery)
+					rename_index(oldFile, newFile);
+#endif
 			}
 			/* newFile == "f.0" now */
 			rename(log_file->path, newFile);
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+			if (G.indexEvery)
+				rename_index(log_file->path, newFile);
+#endif
 		}
 
 		/* We may or may not have just renamed the file away;
@@ -782,6 +1170,13 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 		 * So ensure old file is gone in any case:
 		 */
 		unlink(log_file->path);
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+		if (G.indexEvery) {
+			char *name = xasprintf("%s.idx", log_file->path);
+			unlink(name);
+			free(name);
+		}
+#endif
 #ifdef SYSLOGD_WRLOCK
 		fl.l_type = F_UNLCK;
 		fcntl(log_file->fd, F_SETLKW, &fl);
@@ -789,13 +1184,19 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 		close(log_file->fd);
 		goto reopen;
 	}
+# if ENABLE_FEATURE_SYSLOGD_BATCH
+	log_file_write(log_file, msg, len);
+	log_file->size += len;
+# else
 /* TODO: what to do on write errors ("disk full")? */
 	len = full_write(log_file->fd, msg, len);
 	if (len > 0)
 		log_file->size += len;
+# endif
 #else
-	full_write(log_file->fd, msg, len);
+	log_file_write(log_file, msg, len);
 #endif
+	index_add(log_file, now, pri, len);
 
 #ifdef SYSLOGD_WRLOCK
 	fl.l_type = F_UNLCK;
@@ -881,7 +1282,7 @@ static void timestamp_and_log(int pri, char *msg, int len)
 
 		for (rule = G.log_rules; rule; rule = rule->next) {
 			if (rule->enabled_facility_priomap[facility] & prio_bit) {
-				log_locally(now, G.printbuf, rule->file);
+				log_locally(now, pri, G.printbuf, rule->file);
 				match = 1;
 			}
 		}
@@ -896,7 +1297,7 @@ static void timestamp_and_log(int pri, char *msg, int len)
 			return;
 		}
 #endif
-		log_locally(now, G.printbuf, &G.logFile);
+		log_locally(now, pri, G.printbuf, &G.logFile);
 	}
 }
 
@@ -1000,6 +1401,34 @@ static int try_to_resolve_remote(remoteHost_t *rh)
 }
 #endif
 
+/* Receive up to RECV_BATCH messages into recvbuf slots,
+ * starting at slot 'first'. Returns their number or -1.
+ */
+static int recv_msgs(unsigned first, int flags)
+{
+#ifdef SYSLOGD_RECVMMSG
+	struct mmsghdr msgs[RECV_BATCH];
+	struct iovec iov[RECV_BATCH];
+	int i, n;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RECV_BATCH; i++) {
+		iov[i].iov_base = G.recvbuf[(first + i) % RECV_SLOTS];
+		iov[i].iov_len = MAX_READ - 1;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	n = recvmmsg(STDIN_FILENO, msgs, RECV_BATCH, flags, NULL);
+	for (i = 0; i < n; i++)
+		G.recvlen[i] = msgs[i].msg_len;
+	return n;
+#else
+	ssize_t sz = recv(STDIN_FILENO, G.recvbuf[first], MAX_READ - 1, flags);
+	G.recvlen[0] = sz;
+	return sz < 0 ? -1 : 1;
+#endif
+}
+
 /* By doing init in a separate function we decrease stack usage
  * in main loop.
  */
@@ -1039,6 +1468,10 @@ static int NOINLINE syslogd_init(char **argv)
 	if (opts & OPT_rotatecnt) // -b
 		G.logFileRotate = xatou_range(opt_b, 0, 99);
 #endif
+#if ENABLE_FEATURE_SYSLOGD_INDEX
+	if (opts & OPT_index) // -I
+		G.indexEvery = xatou_range(opt_I, 0, INT_MAX);
+#endif
 #if ENABLE_FEATURE_IPC_SYSLOG
 	if (opt_C) // -Cn
 		G.shm_size = xatoul_range(opt_C, 4, INT_MAX/1024) * 1024;
@@ -1084,15 +1517,13 @@ int syslogd_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int syslogd_main(int argc UNUSED_PARAM, char **argv)
 {
 	int opts;
+	unsigned slot;
 #if ENABLE_FEATURE_REMOTE_LOG
 	llist_t *item;
 #endif
 #if ENABLE_FEATURE_SYSLOGD_DUP
 	int last_sz = -1;
-	char *last_buf;
-	char *recvbuf;
-#else
-#define recvbuf (G.recvbuf)
+	char *last_buf = NULL;
 #endif
 
 	INIT_G();
@@ -1101,103 +1532,137 @@ int syslogd_main(int argc UNUSED_PARAM, char **argv)
 	timestamp_and_log_internal("syslogd started: BusyBox v" BB_VER);
 	write_pidfile_std_path_and_ext("syslogd");
 
-#if ENABLE_FEATURE_SYSLOGD_DUP
-	recvbuf = G.recvbuf;
-#endif
+	slot = 0;
 	while (!bb_got_signal) {
-		ssize_t sz;
+		int n, i;
 
-#if ENABLE_FEATURE_SYSLOGD_DUP
-		last_buf = recvbuf;
-		if (recvbuf == G.recvbuf)
-			recvbuf = G.recvbuf + MAX_READ;
-		else
-			recvbuf = G.recvbuf;
-#endif
- read_again:
-		sz = read(STDIN_FILENO, recvbuf, MAX_READ - 1);
-		if (sz < 0) {
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+		/* Write out log files only when no more messages are waiting,
+		 * or if a steady stream of them kept us busy for a second
+		 */
+		if (G.log_pending) {
+			if (G.last_flush == monotonic_sec()) {
+				n = recv_msgs(slot, MSG_DONTWAIT);
+				if (n >= 0 || errno != EAGAIN)
+					goto got_msgs;
+			}
+			flush_log_files();
+		}
+#endif
+#ifdef SYSLOGD_RECVMMSG
+		n = recv_msgs(slot, MSG_WAITFORONE);
+#else
+		n = recv_msgs(slot, 0);
+#endif
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+ got_msgs:
+#endif
+		if (n < 0) {
 			if (!bb_got_signal)
 				bb_perror_msg("read from %s", _PATH_LOG);
 			break;
 		}
 
-		/* Drop trailing '\n' and NULs (typically there is one NUL) */
-		while (1) {
-			if (sz == 0)
-				goto read_again;
-			/* man 3 syslog says: "A trailing newline is added when needed".
-			 * However, neither glibc nor uclibc do this:
-			 * syslog(prio, "test")   sends "test\0" to /dev/log,
-			 * syslog(prio, "test\n") sends "test\n\0".
-			 * IOW: newline is passed verbatim!
-			 * I take it to mean that it's syslogd's job
-			 * to make those look identical in the log files. */
-			if (recvbuf[sz-1] != '\0' && recvbuf[sz-1] != '\n')
-				break;
-			sz--;
-		}
+		for (i = 0; i < n; i++) {
+			char *recvbuf = G.recvbuf[(slot + i) % RECV_SLOTS];
+			int sz = G.recvlen[i];
+
+			/* Drop trailing '\n' and NULs (typically there is one NUL) */
+			while (1) {
+				if (sz == 0)
+					goto next_msg;
+				/* man 3 syslog says: "A trailing newline is added when needed".
+				 * However, neither glibc nor uclibc do this:
+				 * syslog(prio, "test")   sends "test\0" to /dev/log,
+				 * syslog(prio, "test\n") sends "test\n\0".
+				 * IOW: newline is passed verbatim!
+				 * I take it to mean that it's syslogd's job
+				 * to make those look identical in the log files. */
+				if (recvbuf[sz-1] != '\0' && recvbuf[sz-1] != '\n')
+					break;
+				sz--;
+			}
 #if ENABLE_FEATURE_SYSLOGD_DUP
-		if ((opts & OPT_dup) && (sz == last_sz))
-			if (memcmp(last_buf, recvbuf, sz) == 0)
-				continue;
-		last_sz = sz;
+			if ((opts & OPT_dup) && (sz == last_sz))
+				if (memcmp(last_buf, recvbuf, sz) == 0)
+					continue;
+			last_sz = sz;
+			last_buf = recvbuf;
 #endif
 #if ENABLE_FEATURE_REMOTE_LOG
-		/* Stock syslogd sends it '\n'-terminated
-		 * over network, mimic that */
-		recvbuf[sz] = '\n';
-
-		/* We are not modifying log messages in any way before send */
-		/* Remote site cannot trust _us_ anyway and need to do validation again */
-		for (item = G.remoteHosts; item != NULL; item = item->link) {
-			remoteHost_t *rh = (remoteHost_t *)item->data;
-
-			if (rh->remoteFD == -1) {
-				rh->remoteFD = try_to_resolve_remote(rh);
-				if (rh->remoteFD == -1)
-					continue;
-			}
+			/* Stock syslogd sends it '\n'-terminated
+			 * over network, mimic that */
+			recvbuf[sz] = '\n';
+
+			/* We are not modifying log messages in any way before send */
+			/* Remote site cannot trust _us_ anyway and need to do validation again */
+			for (item = G.remoteHosts; item != NULL; item = item->link) {
+				remoteHost_t *rh = (remoteHost_t *)item->data;
+
+				if (rh->remoteFD == -1) {
+					rh->remoteFD = try_to_resolve_remote(rh);
+					if (rh->remoteFD == -1)
+						continue;
+				}
 
-			/* Send message to remote logger.
-			 * On some errors, close and set remoteFD to -1
-			 * so that DNS resolution is retried.
-			 */
-			if (sendto(rh->remoteFD, recvbuf, sz+1,
-					MSG_DONTWAIT | MSG_NOSIGNAL,
-					&(rh->remoteAddr->u.sa), rh->remoteAddr->len) == -1
-			) {
-				switch (errno) {
-				case ECONNRESET:
-				case ENOTCONN: /* paranoia */
-				case EPIPE:
-					close(rh->remoteFD);
-					rh->remoteFD = -1;
-					free(rh->remoteAddr);
-					rh->remoteAddr = NULL;
+				/* Send message to remote logger.
+				 * On some errors, close and set remoteFD to -1
+				 * so that DNS resolution is retried.
+				 */
+				if (sendto(rh->remoteFD, recvbuf, sz+1,
+						MSG_DONTWAIT | MSG_NOSIGNAL,
+						&(rh->remoteAddr->u.sa), rh->remoteAddr->len) == -1
+				) {
+					switch (errno) {
+					case ECONNRESET:
+					case ENOTCONN: /* paranoia */
+					case EPIPE:
+						close(rh->remoteFD);
+						rh->remoteFD = -1;
+						free(rh->remoteAddr);
+						rh->remoteAddr = NULL;
+					}
 				}
 			}
-		}
 #endif
-		if (!ENABLE_FEATURE_REMOTE_LOG || (opts & OPT_locallog)) {
-			recvbuf[sz] = '\0'; /* ensure it *is* NUL terminated */
-			split_escape_and_log(recvbuf, sz);
+			if (!ENABLE_FEATURE_REMOTE_LOG || (opts & OPT_locallog)) {
+				recvbuf[sz] = '\0'; /* ensure it *is* NUL terminated */
+				split_escape_and_log(recvbuf, sz);
+			}
+ next_msg: ;
 		}
+
+		slot = (slot + n) % RECV_SLOTS;
+#if ENABLE_FEATURE_SYSLOGD_DUP
+		/* The next batch reuses all slots but the one received last */
+		if (last_sz >= 0) {
+			char *keep = G.recvbuf[(slot + RECV_SLOTS - 1) % RECV_SLOTS];
+			if (last_buf != keep) {
+				memcpy(keep, last_buf, last_sz);
+				last_buf = keep;
+			}
+		}
+#endif
 	} /* while (!bb_got_signal) */
 
 	timestamp_and_log_internal("syslogd exiting");
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	flush_log_files();
+#endif
 	remove_pidfile_std_path_and_ext("syslogd");
 	ipcsyslog_cleanup();
 	if (opts & OPT_kmsg)
 		kmsg_cleanup();
 	kill_myself_with_sig(bb_got_signal);
-#undef recvbuf
 }
 
 /* Clean up. Needed because we are included from syslogd_and_logger.c */
 #undef DEBUG
 #undef SYSLOGD_MARK
 #undef SYSLOGD_WRLOCK
+#undef SYSLOGD_RECVMMSG
+#undef SHREC_HDR
+#undef SHREC_SIZE
 #undef G
 #undef GLOBALS
 #undef INIT_G